@@ -0,0 +1,151 @@
+#include "arena.hpp"
+#include "epoch.hpp"
+#include <new>
+using namespace std;
+
+// Size classes: 16-byte steps up to 256, 64-byte steps up to 1 KB and
+// 256-byte steps up to 4 KB - at most ~20% internal waste per block.
+size_t SlabArena::classIndex(size_t size) {
+    if (size == 0) size = 1;
+    if (size <= 256) return (size - 1) / 16;
+    if (size <= 1024) return 16 + (size - 257) / 64;
+    return 28 + (size - 1025) / 256;
+}
+
+size_t SlabArena::classSize(size_t index) {
+    if (index < 16) return (index + 1) * 16;
+    if (index < 28) return 256 + (index - 15) * 64;
+    return 1024 + (index - 27) * 256;
+}
+
+SlabArena::~SlabArena() {
+    for (void* slab : slabs_) {
+        ::operator delete(slab);
+    }
+    while (large_) {
+        LargeHeader* next = large_->next;
+        ::operator delete(large_);
+        large_ = next;
+    }
+}
+
+void* SlabArena::allocate(size_t size) {
+    if (size > MAX_SMALL_SIZE) return allocateLarge(size);
+
+    size_t index = classIndex(size);
+    size_t block = classSize(index);
+    bytes_in_use_ += block;
+
+    if (FreeBlock* head = free_lists_[index]) {
+        free_lists_[index] = head->next;
+        return head;
+    }
+    if (bump_ + block > bump_end_) {
+        // The tail of the old slab is simply abandoned; it is at most one
+        // block's worth of space.
+        char* slab = static_cast<char*>(::operator new(SLAB_SIZE));
+        slabs_.push_back(slab);
+        bytes_reserved_ += SLAB_SIZE;
+        bump_ = slab;
+        bump_end_ = slab + SLAB_SIZE;
+    }
+    void* result = bump_;
+    bump_ += block;
+    return result;
+}
+
+void SlabArena::deallocate(void* ptr, size_t size) {
+    if (size > MAX_SMALL_SIZE) {
+        freeLarge(ptr);
+        return;
+    }
+    size_t index = classIndex(size);
+    bytes_in_use_ -= classSize(index);
+    auto* block = static_cast<FreeBlock*>(ptr);
+    block->next = free_lists_[index];
+    free_lists_[index] = block;
+}
+
+void SlabArena::retire(void* ptr, size_t size, const atomic<uint32_t>* holds) {
+    limbo_.push_back(Retired{ptr, size, EpochManager::instance().currentEpoch(), holds});
+    if (++retired_since_reclaim_ >= RECLAIM_BATCH) {
+        retired_since_reclaim_ = 0;
+        recycleRetired();
+    }
+}
+
+void SlabArena::recycleRetired() {
+    // Retirements are appended in epoch order, so the safe ones form a prefix.
+    uint64_t safe = EpochManager::instance().reclaimableEpoch();
+    while (!limbo_.empty() && limbo_.front().epoch <= safe) {
+        const Retired& retired = limbo_.front();
+        // Holders took their count inside an epoch guard that has ended
+        // since, so the count read here is complete; it can only go down.
+        if (retired.holds && retired.holds->load(memory_order_acquire) != 0) held_.push_back(retired);
+        else deallocate(retired.ptr, retired.size);
+        limbo_.pop_front();
+    }
+    size_t kept = 0;
+    for (const Retired& retired : held_) {
+        if (retired.holds->load(memory_order_acquire) != 0) held_[kept++] = retired;
+        else deallocate(retired.ptr, retired.size);
+    }
+    held_.resize(kept);
+}
+
+void SlabArena::absorb(SlabArena& other) {
+    slabs_.insert(slabs_.end(), other.slabs_.begin(), other.slabs_.end());
+    other.slabs_.clear();
+    other.bump_ = other.bump_end_ = nullptr;
+
+    for (size_t i = 0; i < NUM_CLASSES; ++i) {
+        FreeBlock* head = other.free_lists_[i];
+        if (!head) continue;
+        FreeBlock* tail = head;
+        while (tail->next) tail = tail->next;
+        tail->next = free_lists_[i];
+        free_lists_[i] = head;
+        other.free_lists_[i] = nullptr;
+    }
+    if (LargeHeader* head = other.large_) {
+        LargeHeader* tail = head;
+        while (tail->next) tail = tail->next;
+        tail->next = large_;
+        if (large_) large_->prev = tail;
+        large_ = head;
+        other.large_ = nullptr;
+    }
+    // Both lists are in epoch order; merged, the safe ones are no longer
+    // a prefix, which only delays some recycling until later passes.
+    limbo_.insert(limbo_.end(), other.limbo_.begin(), other.limbo_.end());
+    other.limbo_.clear();
+    held_.insert(held_.end(), other.held_.begin(), other.held_.end());
+    other.held_.clear();
+
+    bytes_in_use_ += other.bytes_in_use_;
+    bytes_reserved_ += other.bytes_reserved_;
+    other.bytes_in_use_ = 0;
+    other.bytes_reserved_ = 0;
+}
+
+void* SlabArena::allocateLarge(size_t size) {
+    auto* header = static_cast<LargeHeader*>(::operator new(sizeof(LargeHeader) + size));
+    header->prev = nullptr;
+    header->next = large_;
+    header->size = size;
+    if (large_) large_->prev = header;
+    large_ = header;
+    bytes_in_use_ += size;
+    bytes_reserved_ += sizeof(LargeHeader) + size;
+    return header + 1;
+}
+
+void SlabArena::freeLarge(void* ptr) {
+    LargeHeader* header = static_cast<LargeHeader*>(ptr) - 1;
+    if (header->prev) header->prev->next = header->next;
+    else large_ = header->next;
+    if (header->next) header->next->prev = header->prev;
+    bytes_in_use_ -= header->size;
+    bytes_reserved_ -= sizeof(LargeHeader) + header->size;
+    ::operator delete(header);
+}
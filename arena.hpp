@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+using namespace std;
+
+// Size-class slab allocator.
+//
+// Memory is carved out of 64 KB slabs and recycled through one free list
+// per size class, so a steady-state insert costs no malloc at all. The
+// arena is meant to be used by one writer at a time (the Trie it belongs to
+// is already externally serialized), so none of its paths take a lock.
+//
+// Blocks that lock-free readers may still be looking at are `retire`d
+// instead of deallocated; they return to their free list once
+// EpochManager reports that no reader can reach them anymore.
+//
+// A block retired with a hold counter (see ValueHandle) is not recycled
+// while the counter is non-zero: it waits on a list of its own, which
+// needs no epoch any more - readers can no longer find the block, only let
+// go of it - and is rechecked on every reclamation pass.
+//
+// Destroying the arena releases its slabs wholesale - O(slabs), no matter
+// how many objects were carved out of them.
+class SlabArena {
+public:
+    SlabArena() = default;
+    ~SlabArena();
+
+    SlabArena(const SlabArena&) = delete;
+    SlabArena& operator=(const SlabArena&) = delete;
+
+    void* allocate(size_t size);
+
+    // For blocks that were never visible to readers.
+    void deallocate(void* ptr, size_t size);
+
+    // For blocks that concurrent readers may still hold. With `holds`, also
+    // kept until it reads zero.
+    void retire(void* ptr, size_t size, const atomic<uint32_t>* holds = nullptr);
+
+    // Takes over everything `other` holds - slabs, large blocks, free and
+    // retired blocks - leaving it empty, so blocks allocated from it may be
+    // deallocated or retired here. For adopting a structure built off to
+    // the side; the unused tail of `other`'s current slab is abandoned.
+    void absorb(SlabArena& other);
+
+    // Bytes handed out and not yet returned (retired blocks still count).
+    size_t bytesInUse() const { return bytes_in_use_; }
+
+    // Bytes reserved from the system, including free-list slack.
+    size_t bytesReserved() const { return bytes_reserved_; }
+
+    // Blocks above this size bypass the slabs.
+    static constexpr size_t MAX_SMALL_SIZE = 4096;
+
+private:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t NUM_CLASSES = 40;
+    // How many retirements to collect before checking the epoch again.
+    static constexpr size_t RECLAIM_BATCH = 64;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    // Large blocks are chained so the destructor can find them.
+    struct LargeHeader {
+        LargeHeader* prev;
+        LargeHeader* next;
+        size_t size;
+        size_t padding; // Keeps the payload 16-byte aligned
+    };
+
+    struct Retired {
+        void* ptr;
+        size_t size;
+        uint64_t epoch;
+        const atomic<uint32_t>* holds;
+    };
+
+    static size_t classIndex(size_t size);
+    static size_t classSize(size_t index);
+
+    void* allocateLarge(size_t size);
+    void freeLarge(void* ptr);
+    void recycleRetired();
+
+    FreeBlock* free_lists_[NUM_CLASSES] = {};
+    vector<void*> slabs_;
+    char* bump_ = nullptr;
+    char* bump_end_ = nullptr;
+    LargeHeader* large_ = nullptr;
+    deque<Retired> limbo_;
+    vector<Retired> held_; // Past their epoch but still held
+    size_t retired_since_reclaim_ = 0;
+
+    size_t bytes_in_use_ = 0;
+    size_t bytes_reserved_ = 0;
+};
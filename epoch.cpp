@@ -0,0 +1,137 @@
+#include "epoch.hpp"
+#include <thread>
+using namespace std;
+
+EpochManager& EpochManager::instance() {
+    static EpochManager manager;
+    return manager;
+}
+
+EpochManager::~EpochManager() {
+    // Process teardown: no readers are left, so everything can go.
+    lock_guard lock(orphans_mutex_);
+    freeUpTo(orphans_, UINT64_MAX);
+    for (ThreadRecord* r = records_.load(); r;) {
+        ThreadRecord* next = r->next;
+        freeUpTo(r->retired, UINT64_MAX);
+        delete r;
+        r = next;
+    }
+}
+
+EpochManager::ThreadHandle::~ThreadHandle() {
+    if (!record) return;
+    EpochManager& manager = EpochManager::instance();
+    if (!record->retired.empty()) {
+        lock_guard lock(manager.orphans_mutex_);
+        manager.orphans_.insert(manager.orphans_.end(), record->retired.begin(), record->retired.end());
+        record->retired.clear();
+    }
+    record->local_epoch.store(0, memory_order_release);
+    record->in_use.store(false, memory_order_release);
+}
+
+EpochManager::ThreadRecord* EpochManager::localRecord() {
+    thread_local ThreadHandle handle;
+    if (handle.record) return handle.record;
+
+    // Reuse a record abandoned by an exited thread before allocating.
+    for (ThreadRecord* r = records_.load(memory_order_acquire); r; r = r->next) {
+        bool expected = false;
+        if (!r->in_use.load(memory_order_relaxed) &&
+            r->in_use.compare_exchange_strong(expected, true, memory_order_acq_rel)) {
+            handle.record = r;
+            return r;
+        }
+    }
+
+    auto* r = new ThreadRecord();
+    r->in_use.store(true, memory_order_relaxed);
+    ThreadRecord* head = records_.load(memory_order_relaxed);
+    do {
+        r->next = head;
+    } while (!records_.compare_exchange_weak(head, r, memory_order_release, memory_order_relaxed));
+    handle.record = r;
+    return r;
+}
+
+EpochGuard::EpochGuard() {
+    // Cached per thread so the read path skips the registry entirely.
+    thread_local EpochManager::ThreadRecord* cached = nullptr;
+    if (!cached) cached = EpochManager::instance().localRecord();
+    record_ = cached;
+    if (record_->nesting++ == 0) {
+        uint64_t epoch = EpochManager::instance().global_epoch_.load(memory_order_relaxed);
+        // A seq_cst exchange publishes the epoch before any shared pointer
+        // is read, and is cheaper than a store followed by a full fence.
+        record_->local_epoch.exchange((epoch << 1) | 1, memory_order_seq_cst);
+    }
+}
+
+EpochGuard::~EpochGuard() {
+    if (--record_->nesting == 0) {
+        record_->local_epoch.store(0, memory_order_release);
+    }
+}
+
+bool EpochManager::tryAdvance() {
+    uint64_t epoch = global_epoch_.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    for (ThreadRecord* r = records_.load(memory_order_acquire); r; r = r->next) {
+        uint64_t local = r->local_epoch.load(memory_order_acquire);
+        // A thread still inside an older epoch holds everyone back.
+        if ((local & 1) && (local >> 1) != epoch) return false;
+    }
+    global_epoch_.compare_exchange_strong(epoch, epoch + 1, memory_order_acq_rel);
+    return true;
+}
+
+void EpochManager::freeUpTo(vector<Retired>& list, uint64_t safe_epoch) {
+    size_t kept = 0;
+    for (size_t i = 0; i < list.size(); ++i) {
+        if (list[i].epoch <= safe_epoch) {
+            list[i].deleter(list[i].ptr);
+        } else {
+            list[kept++] = list[i];
+        }
+    }
+    list.resize(kept);
+}
+
+void EpochManager::retire(void* ptr, Deleter deleter) {
+    ThreadRecord* record = localRecord();
+    record->retired.push_back(Retired{ptr, deleter, global_epoch_.load(memory_order_acquire)});
+    if (record->retired.size() % RECLAIM_BATCH == 0) {
+        reclaim();
+    }
+}
+
+uint64_t EpochManager::reclaimableEpoch() {
+    tryAdvance();
+    uint64_t epoch = global_epoch_.load(memory_order_acquire);
+    return epoch < GRACE_EPOCHS ? 0 : epoch - GRACE_EPOCHS;
+}
+
+void EpochManager::synchronize() {
+    // Same argument as GRACE_EPOCHS: a guard entered at epoch e blocks the
+    // step from e+1 to e+2, so reaching that far means it has exited.
+    uint64_t target = currentEpoch() + GRACE_EPOCHS;
+    while (currentEpoch() < target) {
+        if (!tryAdvance()) this_thread::yield();
+    }
+}
+
+void EpochManager::reclaim() {
+    uint64_t safe = reclaimableEpoch();
+    if (safe == 0) return;
+
+    ThreadRecord* record = localRecord();
+    // Freeing from inside a guard is fine: anything this thread can still
+    // see was retired in the current epoch, which is never below `safe`.
+    freeUpTo(record->retired, safe);
+
+    unique_lock lock(orphans_mutex_, try_to_lock);
+    if (lock.owns_lock()) {
+        freeUpTo(orphans_, safe);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+// Epoch-based memory reclamation.
+//
+// Lock-free readers may still be looking at a node after a writer has
+// unlinked it. Instead of deleting such memory right away, writers `retire`
+// it; it is only freed once every thread that was inside an EpochGuard at
+// retirement time has left it. Readers pay one store to their own
+// thread-local record on entry and one on exit - no shared cache line is
+// written on the read path.
+class EpochManager {
+public:
+    using Deleter = void (*)(void*);
+
+    static EpochManager& instance();
+
+    // Hands `ptr` over for deferred deletion by `deleter`.
+    void retire(void* ptr, Deleter deleter);
+
+    // Tries to advance the global epoch and frees whatever became safe.
+    void reclaim();
+
+    // For structures that keep their own retire lists (e.g. SlabArena):
+    // the epoch to tag a retirement with, and the newest epoch whose
+    // retirements can no longer be reached by any reader.
+    uint64_t currentEpoch() const { return global_epoch_.load(memory_order_acquire); }
+    uint64_t reclaimableEpoch();
+
+    // Blocks until every guard that was active on entry has been left, so
+    // anything unlinked before the call is unreachable afterwards. Must not
+    // be called from inside an EpochGuard.
+    void synchronize();
+
+    ~EpochManager();
+
+private:
+    friend class EpochGuard;
+
+    struct Retired {
+        void* ptr;
+        Deleter deleter;
+        uint64_t epoch;
+    };
+
+    // One per thread, padded so readers never share a line with each other.
+    struct alignas(64) ThreadRecord {
+        // 0 while the thread is outside any guard, otherwise (epoch << 1) | 1
+        atomic<uint64_t> local_epoch{0};
+        atomic<bool> in_use{false};
+        ThreadRecord* next = nullptr;
+
+        // Owner-thread-only state
+        uint32_t nesting = 0;
+        vector<Retired> retired;
+    };
+
+    // Releases a thread's record when the thread exits.
+    struct ThreadHandle {
+        ThreadRecord* record = nullptr;
+        ~ThreadHandle();
+    };
+
+    EpochManager() = default;
+
+    ThreadRecord* localRecord();
+    bool tryAdvance();
+    static void freeUpTo(vector<Retired>& list, uint64_t safe_epoch);
+
+    // Retired objects older than this many epochs are unreachable by anyone.
+    static constexpr uint64_t GRACE_EPOCHS = 2;
+    // How many retirements a thread collects before attempting reclamation.
+    static constexpr size_t RECLAIM_BATCH = 64;
+
+    atomic<uint64_t> global_epoch_{1};
+    atomic<ThreadRecord*> records_{nullptr};
+
+    // Garbage left behind by threads that exited before it became safe.
+    mutex orphans_mutex_;
+    vector<Retired> orphans_;
+};
+
+// RAII guard marking the current thread as reading shared structures.
+// Guards nest; only the outermost one publishes and clears the epoch.
+class EpochGuard {
+public:
+    EpochGuard();
+    ~EpochGuard();
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+private:
+    EpochManager::ThreadRecord* record_;
+};
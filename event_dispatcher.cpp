@@ -0,0 +1,216 @@
+#include "event_dispatcher.hpp"
+#include "epoch.hpp"
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+EventDispatcher::~EventDispatcher() {
+    lock_guard lock(attach_mutex_);
+    const SubscriptionList* list = subscriptions_.load(memory_order_acquire);
+    if (!list) return;
+    SubscriptionList remaining = *list;
+    replaceList(nullptr);
+    for (Subscription* subscription : remaining) {
+        delete subscription;
+    }
+}
+
+void EventDispatcher::attach(StoreObserver* observer, const ObserverOptions& options) {
+    if (!observer) return;
+    lock_guard lock(attach_mutex_);
+    const SubscriptionList* current = subscriptions_.load(memory_order_acquire);
+    auto* list = current ? new SubscriptionList(*current) : new SubscriptionList();
+    list->push_back(new Subscription(observer, options));
+    replaceList(list);
+}
+
+bool EventDispatcher::detach(StoreObserver* observer) {
+    lock_guard lock(attach_mutex_);
+    const SubscriptionList* current = subscriptions_.load(memory_order_acquire);
+    if (!current) return false;
+    auto it = find_if(current->begin(), current->end(),
+                      [&](Subscription* s) { return s->observer() == observer; });
+    if (it == current->end()) return false;
+
+    Subscription* removed = *it;
+    const SubscriptionList* list = nullptr;
+    if (current->size() > 1) {
+        auto* rest = new SubscriptionList(*current);
+        rest->erase(rest->begin() + (it - current->begin()));
+        list = rest;
+    }
+    // After this no writer can reach `removed`, so its queue is final.
+    replaceList(list);
+    delete removed;
+    return true;
+}
+
+void EventDispatcher::replaceList(const SubscriptionList* list) {
+    const SubscriptionList* old = subscriptions_.exchange(list, memory_order_acq_rel);
+    // Writers hold the list only inside an EpochGuard; wait them out. This
+    // is rare (attach/detach) so a blocking grace period is simpler than
+    // retiring the list.
+    EpochManager::instance().synchronize();
+    delete old;
+}
+
+void EventDispatcher::publish(EventType type, string_view key, string_view value) {
+    // Nothing attached: skip the guard and the copies.
+    if (!subscriptions_.load(memory_order_relaxed)) return;
+
+    EpochGuard guard;
+    const SubscriptionList* list = subscriptions_.load(memory_order_acquire);
+    if (!list) return;
+    for (Subscription* subscription : *list) {
+        subscription->publish(StoreEvent{type, string(key), string(value)});
+    }
+}
+
+void EventDispatcher::publish(vector<StoreEvent>&& events) {
+    if (!subscriptions_.load(memory_order_relaxed)) return;
+
+    EpochGuard guard;
+    const SubscriptionList* list = subscriptions_.load(memory_order_acquire);
+    if (!list) return;
+    // The last subscription takes the events themselves, the rest copies
+    for (size_t i = 0; i < list->size(); ++i) {
+        bool last = i + 1 == list->size();
+        for (StoreEvent& event : events) {
+            (*list)[i]->publish(last ? move(event) : StoreEvent(event));
+        }
+    }
+}
+
+void EventDispatcher::flush() {
+    lock_guard lock(attach_mutex_);
+    const SubscriptionList* list = subscriptions_.load(memory_order_acquire);
+    if (!list) return;
+    for (Subscription* subscription : *list) {
+        subscription->waitDelivered();
+    }
+}
+
+EventDispatcher::Subscription::Subscription(StoreObserver* observer, const ObserverOptions& options)
+    : observer_(observer),
+      options_(options),
+      ring_(max<size_t>(options.queue_capacity, 2)),
+      worker_(&Subscription::run, this) {}
+
+EventDispatcher::Subscription::~Subscription() {
+    {
+        lock_guard lock(wake_mutex_);
+        stopping_.store(true, memory_order_release);
+    }
+    wake_.notify_one();
+    worker_.join();
+}
+
+void EventDispatcher::Subscription::publish(StoreEvent&& event) {
+    published_.fetch_add(1, memory_order_relaxed);
+    switch (options_.backpressure) {
+        case Backpressure::Block:
+            // tryPush leaves the event alone when it fails, so just retry.
+            while (!ring_.tryPush(move(event))) {
+                wakeDispatcher();
+                this_thread::yield();
+            }
+            break;
+        case Backpressure::Drop:
+            if (!ring_.tryPush(move(event))) {
+                dropped_.fetch_add(1, memory_order_relaxed);
+            }
+            break;
+        case Backpressure::Coalesce:
+            if (overflowing_.load(memory_order_acquire) || !ring_.tryPush(move(event))) {
+                addOverflow(move(event));
+            }
+            break;
+    }
+    wakeDispatcher();
+}
+
+void EventDispatcher::Subscription::addOverflow(StoreEvent&& event) {
+    lock_guard lock(overflow_mutex_);
+    overflowing_.store(true, memory_order_release);
+    auto [it, inserted] = overflow_index_.try_emplace(event.key, overflow_.size());
+    if (inserted) {
+        overflow_.push_back(move(event));
+    } else {
+        overflow_[it->second] = move(event);
+        ++coalesced_;
+    }
+}
+
+void EventDispatcher::Subscription::wakeDispatcher() {
+    // Pairs with the fence in run(): either the dispatcher sees the new
+    // event before sleeping, or we see it asleep and wake it.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (sleeping_.load(memory_order_relaxed)) {
+        lock_guard lock(wake_mutex_);
+        wake_.notify_one();
+    }
+}
+
+void EventDispatcher::Subscription::waitDelivered() const {
+    uint64_t target = published_.load(memory_order_acquire);
+    while (delivered_.load(memory_order_acquire) < target) {
+        this_thread::sleep_for(chrono::microseconds(100));
+    }
+}
+
+void EventDispatcher::Subscription::run() {
+    const size_t max_batch = max<size_t>(options_.max_batch, 1);
+    vector<StoreEvent> batch;
+    vector<StoreEvent> overflow;
+    batch.reserve(max_batch);
+    StoreEvent event;
+    for (;;) {
+        batch.clear();
+        while (batch.size() < max_batch && ring_.tryPop(event)) {
+            batch.push_back(move(event));
+        }
+        size_t handled = batch.size();
+
+        // The overflow only holds events newer than everything in the ring,
+        // so it is taken once the ring has run dry.
+        if (batch.size() < max_batch && overflowing_.load(memory_order_acquire)) {
+            lock_guard lock(overflow_mutex_);
+            handled += overflow_.size() + coalesced_;
+            overflow.swap(overflow_);
+            overflow_index_.clear();
+            coalesced_ = 0;
+            overflowing_.store(false, memory_order_release);
+        }
+
+        if (!batch.empty()) observer_->onEvents(batch);
+        for (size_t i = 0; i < overflow.size(); i += max_batch) {
+            batch.clear();
+            size_t end = min(overflow.size(), i + max_batch);
+            for (size_t j = i; j < end; ++j) batch.push_back(move(overflow[j]));
+            observer_->onEvents(batch);
+        }
+        overflow.clear();
+
+        if (size_t drops = dropped_.exchange(0, memory_order_acq_rel)) {
+            observer_->onDropped(drops);
+            handled += drops;
+        }
+        if (handled > 0) {
+            delivered_.fetch_add(handled, memory_order_release);
+            continue;
+        }
+
+        // Nothing left. Stopping only happens once writers can no longer
+        // reach this subscription, so an empty queue here is final.
+        if (stopping_.load(memory_order_acquire)) return;
+
+        unique_lock lock(wake_mutex_);
+        sleeping_.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        wake_.wait(lock, [&] {
+            return !ring_.empty() || overflowing_.load(memory_order_acquire) ||
+                   dropped_.load(memory_order_acquire) > 0 || stopping_.load(memory_order_acquire);
+        });
+        sleeping_.store(false, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "ring_buffer.hpp"
+#include "store_observer.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Delivers store events to observers off the write path.
+//
+// Each attached observer gets its own subscription: a lock-free ring that
+// writers publish into, and a dispatcher thread that drains it in batches
+// and calls the observer. A slow observer therefore only backs up its own
+// queue, and what happens when that queue is full is the observer's
+// Backpressure policy.
+//
+// Writers find the subscriptions through an immutable list swapped in by
+// attach/detach and read under an EpochGuard, so publishing takes no lock
+// and observers can come and go while writes are in flight.
+class EventDispatcher {
+public:
+    EventDispatcher() = default;
+
+    // Detaches every observer, delivering whatever is still queued.
+    ~EventDispatcher();
+
+    EventDispatcher(const EventDispatcher&) = delete;
+    EventDispatcher& operator=(const EventDispatcher&) = delete;
+
+    void attach(StoreObserver* observer, const ObserverOptions& options);
+
+    // Stops delivery to `observer` after handing it everything already
+    // published. Once this returns the observer is never called again and
+    // may be destroyed. Returns false if it was not attached.
+    bool detach(StoreObserver* observer);
+
+    // Queues an event for every attached observer. Cheap when there are none.
+    void publish(EventType type, string_view key, string_view value);
+
+    // Queues a batch of events, in order, for every attached observer,
+    // walking the observer list once for the whole batch.
+    void publish(vector<StoreEvent>&& events);
+
+    // Whether any observer is attached, for callers that would otherwise
+    // assemble many events just to have them dropped.
+    bool hasObservers() const { return subscriptions_.load(memory_order_relaxed) != nullptr; }
+
+    // Waits until every event published before the call has been delivered.
+    void flush();
+
+    // attach/detach/flush must not be called from inside an observer
+    // callback: they wait on the dispatcher thread that is running it.
+
+private:
+    class Subscription {
+    public:
+        Subscription(StoreObserver* observer, const ObserverOptions& options);
+        // Delivers what is left and joins the dispatcher thread.
+        ~Subscription();
+
+        void publish(StoreEvent&& event);
+        void waitDelivered() const;
+
+        StoreObserver* observer() const { return observer_; }
+
+    private:
+        void run();
+        void addOverflow(StoreEvent&& event);
+        void wakeDispatcher();
+
+        StoreObserver* observer_;
+        ObserverOptions options_;
+        MpmcRing<StoreEvent> ring_;
+
+        // Coalesce policy: once the ring is full, events go here instead -
+        // one slot per key, overwritten in place - until the dispatcher has
+        // drained the ring and taken them. While `overflowing_` is set every
+        // writer uses the overflow, so a key's events are never reordered.
+        atomic<bool> overflowing_{false};
+        mutex overflow_mutex_;
+        vector<StoreEvent> overflow_;
+        unordered_map<string, size_t> overflow_index_;
+        size_t coalesced_ = 0; // Events overwritten in the overflow
+
+        atomic<size_t> dropped_{0}; // Drop policy: not yet reported
+
+        // For flush(): every publish counts once, and every event counts as
+        // delivered once its callback has returned (or it was dropped or
+        // coalesced away).
+        atomic<uint64_t> published_{0};
+        atomic<uint64_t> delivered_{0};
+
+        // The dispatcher sleeps on `wake_` when there is nothing to do;
+        // writers only touch the mutex if `sleeping_` is set.
+        mutex wake_mutex_;
+        condition_variable wake_;
+        atomic<bool> sleeping_{false};
+        atomic<bool> stopping_{false};
+
+        thread worker_; // Started last, once everything above exists
+    };
+
+    using SubscriptionList = vector<Subscription*>;
+
+    // Publishes `list` and frees `old` once no writer can still be using it.
+    void replaceList(const SubscriptionList* list);
+
+    atomic<const SubscriptionList*> subscriptions_{nullptr};
+    mutex attach_mutex_; // Serializes attach/detach/flush
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Flat combining: instead of every writer taking a lock in turn, writers
+// publish their requests in slots and whichever of them wins the combiner
+// role applies everything published so far as one batch - one lock
+// acquisition, one pass over the data while it is hot in one core's cache.
+// The others wait on their own slot (a cache line each) until a combiner
+// marks it done, and become the combiner themselves if none is running.
+//
+// Requests stay on their submitters' stacks; a slot only points at one, and
+// the combiner writes the results back into it. A bit per slot marks the
+// pending ones, so the combiner collects a batch with one atomic exchange
+// rather than a look at every slot. Each thread starts looking for a free
+// slot at a place of its own, so with no more threads than slots it keeps
+// finding the same one.
+template <typename Request>
+class FlatCombiner {
+public:
+    static constexpr size_t SLOTS = 64; // One bit each in pending_
+
+    FlatCombiner() = default;
+    FlatCombiner(const FlatCombiner&) = delete;
+    FlatCombiner& operator=(const FlatCombiner&) = delete;
+
+    // Publishes `request` and returns once it has been applied, either by
+    // this thread as the combiner or by another. `combine(vector<Request*>&)`
+    // applies a batch (in slot order) and is never called concurrently
+    // with itself. It should record failures in the requests rather than
+    // throw: if it does throw, the batch is still marked done and the
+    // combiner role released, so the waiters return, but only the thread
+    // that was combining sees the exception. Returns false, having done
+    // nothing, if every slot is taken; the caller then applies the
+    // request itself.
+    template <typename Combine>
+    bool apply(Request& request, Combine&& combine);
+
+private:
+    enum : uint8_t { FREE, CLAIMED, DONE };
+
+    struct alignas(64) Slot {
+        atomic<uint8_t> state{FREE};
+        Request* request = nullptr;
+    };
+
+    // Polls before yielding while waiting for a combiner.
+    static constexpr unsigned SPINS = 16;
+
+    Slot* claim();
+
+    array<Slot, SLOTS> slots_;
+    alignas(64) atomic<uint64_t> pending_{0};
+    alignas(64) atomic<bool> combining_{false};
+    // Owned by the current combiner
+    vector<Request*> batch_;
+};
+
+template <typename Request>
+typename FlatCombiner<Request>::Slot* FlatCombiner<Request>::claim() {
+    static atomic<size_t> next_thread{0};
+    thread_local size_t home = next_thread.fetch_add(1, memory_order_relaxed);
+    for (size_t i = 0; i < SLOTS; ++i) {
+        Slot& slot = slots_[(home + i) % SLOTS];
+        uint8_t free = FREE;
+        if (slot.state.load(memory_order_relaxed) == FREE &&
+            slot.state.compare_exchange_strong(free, CLAIMED, memory_order_acquire)) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+template <typename Request>
+template <typename Combine>
+bool FlatCombiner<Request>::apply(Request& request, Combine&& combine) {
+    Slot* mine = claim();
+    if (!mine) return false;
+    mine->request = &request;
+    pending_.fetch_or(uint64_t(1) << (mine - slots_.data()), memory_order_release);
+
+    // Runs even if combine() throws: the batch is released and so is our
+    // slot, whoever finished our request.
+    struct Release {
+        FlatCombiner* combiner;
+        Slot* mine;
+        uint64_t taken = 0; // Slots of the batch being combined
+        bool combining = false;
+        void finishBatch() {
+            for (uint64_t bits = taken; bits != 0; bits &= bits - 1) {
+                combiner->slots_[__builtin_ctzll(bits)].state.store(DONE, memory_order_release);
+            }
+            taken = 0;
+            combining = false;
+            combiner->combining_.store(false, memory_order_release);
+        }
+        ~Release() {
+            if (combining) finishBatch();
+            mine->state.store(FREE, memory_order_release);
+        }
+    } release{this, mine};
+
+    for (unsigned polls = 0;; ++polls) {
+        if (mine->state.load(memory_order_acquire) == DONE) break;
+        if (!combining_.load(memory_order_relaxed) && !combining_.exchange(true, memory_order_acquire)) {
+            release.combining = true;
+            // Empty if an earlier combiner already took our slot
+            release.taken = pending_.exchange(0, memory_order_acquire);
+            batch_.clear();
+            for (uint64_t bits = release.taken; bits != 0; bits &= bits - 1) {
+                batch_.push_back(slots_[__builtin_ctzll(bits)].request);
+            }
+            if (!batch_.empty()) combine(batch_);
+            release.finishBatch();
+            continue;
+        }
+        if (polls >= SPINS) this_thread::yield();
+    }
+    return true;
+}
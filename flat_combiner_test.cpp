@@ -0,0 +1,96 @@
+// Checks that FlatCombiner releases every waiter when combining fails:
+// a combine() that throws must not leave slots or the combiner role held.
+// Exits non-zero on failure; a hang shows up as a ctest timeout.
+
+#include "flat_combiner.hpp"
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace {
+
+struct Request {
+    int value = 0;
+    exception_ptr error; // Set by a combine() that records failures
+};
+
+constexpr int THREADS = 8;
+constexpr int ROUNDS = 2000;
+
+int failures = 0;
+
+void check(bool ok, const char* what) {
+    if (ok) return;
+    fprintf(stderr, "flat_combiner_test: %s\n", what);
+    failures++;
+}
+
+// Every thread applies ROUNDS requests through `combine` and counts how
+// its calls ended.
+template <typename Combine>
+void run(FlatCombiner<Request>& combiner, Combine combine, atomic<int>& returned, atomic<int>& threw) {
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < ROUNDS; ++i) {
+                Request request;
+                request.value = 1;
+                try {
+                    if (!combiner.apply(request, combine)) continue;
+                    if (request.error) rethrow_exception(request.error);
+                    returned++;
+                } catch (const runtime_error&) {
+                    threw++;
+                }
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+}
+
+} // namespace
+
+int main() {
+    FlatCombiner<Request> combiner;
+
+    // combine() throws: the combining thread gets the exception, the rest
+    // of its batch returns as if done
+    {
+        atomic<int> returned{0}, threw{0};
+        run(combiner, [](vector<Request*>&) { throw runtime_error("combine failed"); }, returned, threw);
+        check(returned + threw == THREADS * ROUNDS, "a throwing combine lost waiters");
+        check(threw > 0, "a throwing combine reached no caller");
+    }
+
+    // combine() records the failure in every request, as KVStore does
+    {
+        atomic<int> returned{0}, threw{0};
+        run(combiner,
+            [](vector<Request*>& batch) {
+                exception_ptr error = make_exception_ptr(runtime_error("log failed"));
+                for (Request* request : batch) request->error = error;
+            },
+            returned, threw);
+        check(threw == THREADS * ROUNDS, "a recorded failure did not reach every writer");
+    }
+
+    // And the combiner still works afterwards
+    {
+        atomic<int> returned{0}, threw{0};
+        long sum = 0;
+        run(combiner,
+            [&](vector<Request*>& batch) {
+                for (Request* request : batch) sum += request->value;
+            },
+            returned, threw);
+        check(returned == THREADS * ROUNDS && threw == 0, "combining failed after earlier failures");
+        check(sum == THREADS * ROUNDS, "requests lost after earlier failures");
+    }
+
+    if (failures == 0) printf("flat_combiner_test: ok\n");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,325 @@
+#pragma once
+
+#include "arena.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+using namespace std;
+
+// Open-addressing hash table from keys to small trivially copyable values,
+// laid out like a Swiss table: a control byte per slot holds 7 bits of the
+// key's hash (or EMPTY / DELETED), and a lookup compares a whole group of
+// 16 control bytes against them at once, touching the slots themselves
+// only for the few that match. Groups are probed quadratically.
+//
+// Concurrency: `find` is lock-free and may run alongside one writer; every
+// other call needs external mutual exclusion. An entry (key and value) is
+// immutable once published - an update publishes a new one in its slot -
+// and replaced entries and outgrown tables are retired to the index's
+// arena, so a reader inside an EpochGuard never sees freed memory. A
+// reader may see a stale control byte, but never one that cuts a probe
+// short: a group only regains an EMPTY byte if it never filled up, in
+// which case no key was pushed past it.
+template <typename Value>
+class HashIndex {
+    static_assert(is_trivially_copyable<Value>::value, "entries are copied as raw bytes");
+
+public:
+    HashIndex() = default;
+    ~HashIndex() = default; // The arena releases tables and entries
+
+    HashIndex(const HashIndex&) = delete;
+    HashIndex& operator=(const HashIndex&) = delete;
+
+    // The value stored for `key`, or null. The caller holds an EpochGuard
+    // for as long as it uses the result.
+    const Value* find(string_view key) const;
+
+    // Starts pulling in the control group `key` probes first, for batched
+    // lookups. Lock-free like find().
+    void prefetch(string_view key) const;
+
+    // Adds `key` or replaces its value.
+    void insertOrAssign(string_view key, const Value& value);
+
+    // Removes `key`; returns whether it was there.
+    bool erase(string_view key);
+
+    // Makes room for `count` keys without growing again.
+    void reserve(size_t count);
+
+    // Takes over `other`'s contents (typically built off to the side),
+    // leaving it empty. The replaced entries are retired, not freed.
+    void replaceWith(HashIndex& other);
+
+    size_t size() const { return size_; }
+
+    // Bytes held by tables and entries, retired ones not yet recycled included.
+    size_t memoryUsage() const { return arena_.bytesInUse(); }
+
+private:
+    static constexpr size_t GROUP = 16;
+    static constexpr uint8_t EMPTY = 0x80;
+    static constexpr uint8_t DELETED = 0xfe;
+    // Grow past 7/8 full (tombstones included)
+    static constexpr size_t MAX_LOAD_NUM = 7, MAX_LOAD_DEN = 8;
+
+    struct Entry {
+        Value value;
+        uint32_t key_len;
+        const char* key() const { return reinterpret_cast<const char*>(this + 1); }
+        char* key() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    // One arena block: this header, `capacity` control bytes, then the
+    // slots. The header keeps the control bytes 16-byte aligned.
+    struct alignas(16) Table {
+        size_t capacity; // A power of two, at least GROUP
+        atomic<uint8_t>* control() { return reinterpret_cast<atomic<uint8_t>*>(this + 1); }
+        const atomic<uint8_t>* control() const { return reinterpret_cast<const atomic<uint8_t>*>(this + 1); }
+        atomic<const Entry*>* slots() { return reinterpret_cast<atomic<const Entry*>*>(control() + capacity); }
+        const atomic<const Entry*>* slots() const {
+            return reinterpret_cast<const atomic<const Entry*>*>(control() + capacity);
+        }
+    };
+    static_assert(sizeof(atomic<uint8_t>) == 1, "control bytes are loaded 16 at a time");
+
+    // The hash's low 7 bits go to the control byte, the rest pick the group.
+    // std::hash also routes keys to shards, so it is remixed first:
+    // otherwise every key in a shard would share some of those 7 bits.
+    static uint64_t hashKey(string_view key) {
+        uint64_t h = hash<string_view>{}(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    // Bit i set where control byte i of the group equals `byte`.
+    static unsigned matchByte(const atomic<uint8_t>* group, uint8_t byte);
+    static bool keyEquals(const Entry* entry, string_view key) {
+        return entry->key_len == key.size() && memcmp(entry->key(), key.data(), key.size()) == 0;
+    }
+
+    static size_t tableBytes(size_t capacity) { return sizeof(Table) + capacity * (1 + sizeof(Entry*)); }
+    Table* newTable(size_t capacity);
+    void retireEntry(const Entry* entry) {
+        arena_.retire(const_cast<Entry*>(entry), sizeof(Entry) + entry->key_len);
+    }
+    // The first EMPTY or DELETED slot on `hash`'s probe sequence.
+    static size_t freeSlot(const Table* table, uint64_t hash);
+    // Moves every entry into a fresh table of `capacity` slots.
+    void rehash(size_t capacity);
+    static size_t capacityFor(size_t count);
+
+    atomic<Table*> table_{nullptr};
+    size_t size_ = 0; // Live entries
+    size_t used_ = 0; // Slots not EMPTY: live entries and tombstones
+    SlabArena arena_;
+};
+
+template <typename Value>
+unsigned HashIndex<Value>::matchByte(const atomic<uint8_t>* group, uint8_t byte) {
+#if defined(__SSE2__)
+    // The bytes may be changing under us; see the class comment for why a
+    // stale one is harmless.
+    __m128i control = _mm_load_si128(reinterpret_cast<const __m128i*>(group));
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(static_cast<char>(byte)))));
+#else
+    unsigned mask = 0;
+    for (size_t i = 0; i < GROUP; ++i) {
+        if (group[i].load(memory_order_relaxed) == byte) mask |= 1u << i;
+    }
+    return mask;
+#endif
+}
+
+template <typename Value>
+const Value* HashIndex<Value>::find(string_view key) const {
+    const Table* table = table_.load(memory_order_acquire);
+    if (!table) return nullptr;
+    uint64_t h = hashKey(key);
+    uint8_t tag = static_cast<uint8_t>(h & 0x7f);
+    size_t group_mask = table->capacity / GROUP - 1;
+    size_t group = (h >> 7) & group_mask;
+    for (size_t step = 1;; ++step) {
+        const atomic<uint8_t>* control = table->control() + group * GROUP;
+        for (unsigned match = matchByte(control, tag); match; match &= match - 1) {
+            // Acquire: the entry was filled in before its pointer was stored
+            const Entry* entry = table->slots()[group * GROUP + __builtin_ctz(match)].load(memory_order_acquire);
+            if (entry && keyEquals(entry, key)) return &entry->value;
+        }
+        if (matchByte(control, EMPTY)) return nullptr;
+        group = (group + step) & group_mask;
+    }
+}
+
+template <typename Value>
+void HashIndex<Value>::prefetch(string_view key) const {
+    const Table* table = table_.load(memory_order_acquire);
+    if (!table) return;
+    uint64_t h = hashKey(key);
+    size_t group = (h >> 7) & (table->capacity / GROUP - 1);
+    __builtin_prefetch(table->control() + group * GROUP);
+    __builtin_prefetch(table->slots() + group * GROUP);
+}
+
+template <typename Value>
+typename HashIndex<Value>::Table* HashIndex<Value>::newTable(size_t capacity) {
+    auto* table = new (arena_.allocate(tableBytes(capacity))) Table();
+    table->capacity = capacity;
+    memset(static_cast<void*>(table->control()), EMPTY, capacity);
+    memset(static_cast<void*>(table->slots()), 0, capacity * sizeof(Entry*));
+    return table;
+}
+
+template <typename Value>
+size_t HashIndex<Value>::freeSlot(const Table* table, uint64_t hash) {
+    size_t group_mask = table->capacity / GROUP - 1;
+    size_t group = (hash >> 7) & group_mask;
+    for (size_t step = 1;; ++step) {
+        const atomic<uint8_t>* control = table->control() + group * GROUP;
+        // EMPTY and DELETED are the only control bytes with the top bit set
+        for (size_t i = 0; i < GROUP; ++i) {
+            if (control[i].load(memory_order_relaxed) & 0x80) return group * GROUP + i;
+        }
+        group = (group + step) & group_mask;
+    }
+}
+
+template <typename Value>
+size_t HashIndex<Value>::capacityFor(size_t count) {
+    size_t capacity = GROUP;
+    while (capacity * MAX_LOAD_NUM / MAX_LOAD_DEN < count) capacity *= 2;
+    return capacity;
+}
+
+template <typename Value>
+void HashIndex<Value>::rehash(size_t capacity) {
+    Table* old_table = table_.load(memory_order_relaxed);
+    Table* table = newTable(capacity);
+    if (old_table) {
+        for (size_t i = 0; i < old_table->capacity; ++i) {
+            const Entry* entry = old_table->slots()[i].load(memory_order_relaxed);
+            if (!entry) continue;
+            uint64_t h = hashKey(string_view(entry->key(), entry->key_len));
+            size_t slot = freeSlot(table, h);
+            table->control()[slot].store(static_cast<uint8_t>(h & 0x7f), memory_order_relaxed);
+            table->slots()[slot].store(entry, memory_order_relaxed);
+        }
+    }
+    // Release: readers that find the new table find it filled in. The
+    // entries move over as they are; only the old table is retired.
+    table_.store(table, memory_order_release);
+    if (old_table) arena_.retire(old_table, tableBytes(old_table->capacity));
+    used_ = size_;
+}
+
+template <typename Value>
+void HashIndex<Value>::insertOrAssign(string_view key, const Value& value) {
+    auto* entry = static_cast<Entry*>(arena_.allocate(sizeof(Entry) + key.size()));
+    entry->value = value;
+    entry->key_len = static_cast<uint32_t>(key.size());
+    memcpy(entry->key(), key.data(), key.size());
+
+    Table* table = table_.load(memory_order_relaxed);
+    uint64_t h = hashKey(key);
+    uint8_t tag = static_cast<uint8_t>(h & 0x7f);
+    if (table) {
+        size_t group_mask = table->capacity / GROUP - 1;
+        size_t group = (h >> 7) & group_mask;
+        for (size_t step = 1;; ++step) {
+            const atomic<uint8_t>* control = table->control() + group * GROUP;
+            for (unsigned match = matchByte(control, tag); match; match &= match - 1) {
+                auto& slot = table->slots()[group * GROUP + __builtin_ctz(match)];
+                const Entry* old_entry = slot.load(memory_order_relaxed);
+                if (old_entry && keyEquals(old_entry, key)) {
+                    slot.store(entry, memory_order_release);
+                    retireEntry(old_entry);
+                    return;
+                }
+            }
+            if (matchByte(control, EMPTY)) break;
+            group = (group + step) & group_mask;
+        }
+    }
+
+    size_t slot = table ? freeSlot(table, h) : 0;
+    bool fills_empty = !table || table->control()[slot].load(memory_order_relaxed) == EMPTY;
+    if (fills_empty && (used_ + 1) * MAX_LOAD_DEN > (table ? table->capacity : 0) * MAX_LOAD_NUM) {
+        // Room for twice the live keys: a table full of them doubles, one
+        // clogged with tombstones is cleaned out.
+        rehash(capacityFor((size_ + 1) * 2));
+        table = table_.load(memory_order_relaxed);
+        slot = freeSlot(table, h);
+    }
+    if (table->control()[slot].load(memory_order_relaxed) == EMPTY) used_++;
+    // The entry goes in before its control byte, so a reader that matches
+    // the byte finds the entry (or, if it is quick, a null slot to skip).
+    table->slots()[slot].store(entry, memory_order_release);
+    table->control()[slot].store(tag, memory_order_release);
+    size_++;
+}
+
+template <typename Value>
+bool HashIndex<Value>::erase(string_view key) {
+    Table* table = table_.load(memory_order_relaxed);
+    if (!table) return false;
+    uint64_t h = hashKey(key);
+    uint8_t tag = static_cast<uint8_t>(h & 0x7f);
+    size_t group_mask = table->capacity / GROUP - 1;
+    size_t group = (h >> 7) & group_mask;
+    for (size_t step = 1;; ++step) {
+        atomic<uint8_t>* control = table->control() + group * GROUP;
+        for (unsigned match = matchByte(control, tag); match; match &= match - 1) {
+            size_t index = group * GROUP + __builtin_ctz(match);
+            const Entry* entry = table->slots()[index].load(memory_order_relaxed);
+            if (!entry || !keyEquals(entry, key)) continue;
+            // A group that still has an EMPTY byte never filled up, so no
+            // probe went on past it and the slot can be EMPTY again.
+            bool reusable = matchByte(control, EMPTY) != 0;
+            table->control()[index].store(reusable ? EMPTY : DELETED, memory_order_release);
+            table->slots()[index].store(nullptr, memory_order_release);
+            if (reusable) used_--;
+            size_--;
+            retireEntry(entry);
+            return true;
+        }
+        if (matchByte(control, EMPTY)) return false;
+        group = (group + step) & group_mask;
+    }
+}
+
+template <typename Value>
+void HashIndex<Value>::reserve(size_t count) {
+    Table* table = table_.load(memory_order_relaxed);
+    size_t capacity = capacityFor(count);
+    if (!table || table->capacity < capacity) rehash(capacity);
+}
+
+template <typename Value>
+void HashIndex<Value>::replaceWith(HashIndex& other) {
+    arena_.absorb(other.arena_);
+    Table* old_table = table_.load(memory_order_relaxed);
+    table_.store(other.table_.load(memory_order_relaxed), memory_order_release);
+    if (old_table) {
+        for (size_t i = 0; i < old_table->capacity; ++i) {
+            if (const Entry* entry = old_table->slots()[i].load(memory_order_relaxed)) retireEntry(entry);
+        }
+        arena_.retire(old_table, tableBytes(old_table->capacity));
+    }
+    size_ = other.size_;
+    used_ = other.used_;
+    other.table_.store(nullptr, memory_order_relaxed);
+    other.size_ = 0;
+    other.used_ = 0;
+}
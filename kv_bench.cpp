@@ -0,0 +1,973 @@
+// kv_bench: YCSB-style workloads against KVStore.
+//
+// Every run preloads a fresh store, then lets N threads issue a fixed
+// number of operations drawn from one of the YCSB core workload mixes:
+//
+//   A  50% read, 50% update                 (session store)
+//   B  95% read,  5% update                 (photo tagging)
+//   C  100% read                            (user profile cache)
+//   D  95% read,  5% insert, reads skewed to recent inserts
+//   E  95% scan,  5% insert                 (threaded conversations)
+//   F  50% read, 50% read-modify-write      (user database)
+//   W  100% update                          (write storm; not in YCSB,
+//                                            and only run when asked for)
+//
+// Keys are chosen uniformly, from a scrambled zipfian (theta 0.99, hot keys
+// spread over the key space), or from the latest distribution (zipfian
+// over recency). Results go to stdout (or --output) as JSON; --compare
+// re-runs the configurations of a stored result file and reports the
+// difference, exiting non-zero if anything regressed past --tolerance.
+//
+// --budgets runs each configuration again under StoreOptions::memory_budget
+// with every --evictions policy. Reads then act as a cache-aside client: a
+// miss writes the record back. The JSON reports the read hit rate beside
+// throughput, so policies can be compared at each budget.
+//
+// --read-api picks how reads fetch the value: a copy (get), a pinned
+// handle (getHandle) or a visitor (get(key, fn)). With large --value-size
+// the difference is the cost of the copy.
+//
+// --loader picks how the records are preloaded: put per key, multiPut in
+// batches, or one bulkLoad. The load rate goes into the JSON with each run.
+//
+// --index hash turns on StoreOptions::hash_index, so point reads probe a
+// hash table instead of walking the trie. Each run's JSON records the
+// store's memory after the preload, the index's share of it separately.
+//
+// --writes combine turns on StoreOptions::combine_writes, so put() and
+// del() go through each shard's flat combiner instead of queuing on its
+// lock; try it with workload W and a zipfian distribution at high thread
+// counts.
+//
+// --compression lz|dict sets StoreOptions::value_compression, and --values
+// picks what the values look like, since constant filler compresses better
+// than anything real: JSON records, 19-digit integers (nanosecond
+// timestamps) or English-like text, each of --value-size bytes (integers
+// excepted) and different for every record; each thread's updates cycle
+// through 1024 of their own. Compare memory_bytes and latencies across
+// encodings.
+//
+// --counters N runs a contended-counter benchmark instead: threads bump N
+// counters with get() then put(), and again with the atomic increment(),
+// and a table shows the throughput of each and the updates get+put lost.
+//
+// Build with -DCMAKE_BUILD_TYPE=Release for numbers worth comparing; the
+// JSON records whether the binary was optimized.
+
+#include "kv_store.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+namespace {
+
+// --- Configuration ---
+
+struct BenchConfig {
+    vector<char> workloads{'A', 'B', 'C', 'D', 'E', 'F'};
+    vector<string> distributions{"uniform", "zipfian", "latest"};
+    vector<size_t> threads{1, 2, 4, 8};
+    size_t records = 100000;    // Keys preloaded before each run
+    size_t operations = 500000; // Operations per run, split across threads
+    size_t key_size = 16;
+    size_t value_size = 100;
+    string read_api = "copy"; // copy, handle or visit
+    string loader = "multiput"; // put, multiput or bulk
+    string index = "trie";      // trie, or hash for StoreOptions::hash_index
+    string writes = "lock";     // lock, or combine for StoreOptions::combine_writes
+    string compression = "none"; // none, lz or dict for StoreOptions::value_compression
+    string values = "fill";     // fill, json, int or text
+    size_t max_scan = 100;      // Workload E scans 1..max_scan keys
+    size_t shards = 16;
+    vector<size_t> budgets{0};  // Bytes; 0 runs without a budget
+    vector<string> evictions{"lru", "clock", "lfu"};
+    uint64_t seed = 1;
+    string output;              // Empty: stdout
+    string compare;             // Baseline file for compare mode
+    double tolerance = 0.10;    // Allowed relative regression in compare mode
+    size_t counters = 0;        // Keys for the counter benchmark; 0 runs the workloads
+};
+
+struct RunResult {
+    char workload;
+    string distribution;
+    size_t budget;
+    string eviction; // "none" without a budget
+    size_t threads;
+    size_t operations;
+    double seconds;
+    double ops_per_sec;
+    uint64_t p50_ns, p99_ns, p999_ns, max_ns;
+    double hit_rate; // Reads that found their key
+    double load_per_sec; // Records preloaded per second
+    size_t memory_bytes; // Trie arenas plus index, right after the preload
+    size_t index_bytes;  // The hash index's part of that
+};
+
+void printUsage() {
+    cout << "usage: kv_bench [options]\n"
+            "  --workloads LIST       e.g. A,B,C or W (default A,B,C,D,E,F)\n"
+            "  --distributions LIST   uniform,zipfian,latest (default all)\n"
+            "  --threads LIST         e.g. 1,2,4,8 (default 1,2,4,8)\n"
+            "  --records N            keys preloaded per run (default 100000)\n"
+            "  --operations N         operations per run (default 500000)\n"
+            "  --key-size N           key bytes, at least 16 (default 16)\n"
+            "  --value-size N         value bytes (default 100)\n"
+            "  --read-api API         copy, handle or visit (default copy)\n"
+            "  --loader HOW           preload with put, multiput or bulk (default multiput)\n"
+            "  --index KIND           point reads through the trie or a hash index (default trie)\n"
+            "  --writes PATH          put/del take the shard lock or combine (default lock)\n"
+            "  --compression MODE     value encoding: none, lz or dict (default none)\n"
+            "  --values KIND          fill, json, int or text values (default fill)\n"
+            "  --max-scan N           longest workload E scan (default 100)\n"
+            "  --shards N             StoreOptions::num_shards (default 16)\n"
+            "  --budgets LIST         memory budgets, e.g. 0,8M,32M (default 0: none)\n"
+            "  --evictions LIST       lru,clock,lfu for budgeted runs (default all)\n"
+            "  --seed N               random seed (default 1)\n"
+            "  --output FILE          write JSON here instead of stdout\n"
+            "  --compare FILE         re-run FILE's configurations and compare\n"
+            "  --tolerance F          allowed regression for --compare (default 0.10)\n"
+            "  --counters N           contended-counter benchmark over N keys instead\n";
+}
+
+vector<string> splitList(const string& text) {
+    vector<string> parts;
+    stringstream stream(text);
+    string part;
+    while (getline(stream, part, ',')) {
+        if (!part.empty()) parts.push_back(part);
+    }
+    return parts;
+}
+
+// "64M" and the like; plain numbers are bytes.
+size_t parseBytes(const string& text) {
+    size_t end = 0;
+    size_t bytes = stoul(text, &end);
+    switch (end < text.size() ? toupper(static_cast<unsigned char>(text[end])) : 0) {
+        case 'K': return bytes << 10;
+        case 'M': return bytes << 20;
+        case 'G': return bytes << 30;
+    }
+    return bytes;
+}
+
+EvictionPolicy parseEviction(const string& name) {
+    if (name == "clock") return EvictionPolicy::Clock;
+    if (name == "lfu") return EvictionPolicy::Lfu;
+    if (name == "lru") return EvictionPolicy::Lru;
+    return EvictionPolicy::None;
+}
+
+ValueCompression parseCompression(const string& name) {
+    if (name == "lz") return ValueCompression::Lz;
+    if (name == "dict") return ValueCompression::Dictionary;
+    return ValueCompression::None;
+}
+
+// Returns false (after printing why) on a bad command line.
+bool parseArgs(int argc, char** argv, BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            cerr << "kv_bench: " << arg << " needs a value\n";
+            return false;
+        }
+        string value = argv[++i];
+        if (arg == "--workloads") {
+            config.workloads.clear();
+            for (const string& w : splitList(value)) {
+                char c = static_cast<char>(toupper(static_cast<unsigned char>(w[0])));
+                if (w.size() != 1 || ((c < 'A' || c > 'F') && c != 'W')) {
+                    cerr << "kv_bench: unknown workload '" << w << "'\n";
+                    return false;
+                }
+                config.workloads.push_back(c);
+            }
+        } else if (arg == "--distributions") {
+            config.distributions = splitList(value);
+            for (const string& d : config.distributions) {
+                if (d != "uniform" && d != "zipfian" && d != "latest") {
+                    cerr << "kv_bench: unknown distribution '" << d << "'\n";
+                    return false;
+                }
+            }
+        } else if (arg == "--threads") {
+            config.threads.clear();
+            for (const string& t : splitList(value)) config.threads.push_back(max<size_t>(1, stoul(t)));
+        } else if (arg == "--records") {
+            config.records = max<size_t>(1, stoul(value));
+        } else if (arg == "--operations") {
+            config.operations = stoul(value);
+        } else if (arg == "--key-size") {
+            config.key_size = max<size_t>(16, stoul(value));
+        } else if (arg == "--value-size") {
+            config.value_size = stoul(value);
+        } else if (arg == "--read-api") {
+            if (value != "copy" && value != "handle" && value != "visit") {
+                cerr << "kv_bench: unknown read API '" << value << "'\n";
+                return false;
+            }
+            config.read_api = value;
+        } else if (arg == "--loader") {
+            if (value != "put" && value != "multiput" && value != "bulk") {
+                cerr << "kv_bench: unknown loader '" << value << "'\n";
+                return false;
+            }
+            config.loader = value;
+        } else if (arg == "--index") {
+            if (value != "trie" && value != "hash") {
+                cerr << "kv_bench: unknown index '" << value << "'\n";
+                return false;
+            }
+            config.index = value;
+        } else if (arg == "--writes") {
+            if (value != "lock" && value != "combine") {
+                cerr << "kv_bench: unknown write path '" << value << "'\n";
+                return false;
+            }
+            config.writes = value;
+        } else if (arg == "--compression") {
+            if (value != "none" && value != "lz" && value != "dict") {
+                cerr << "kv_bench: unknown compression '" << value << "'\n";
+                return false;
+            }
+            config.compression = value;
+        } else if (arg == "--values") {
+            if (value != "fill" && value != "json" && value != "int" && value != "text") {
+                cerr << "kv_bench: unknown value kind '" << value << "'\n";
+                return false;
+            }
+            config.values = value;
+        } else if (arg == "--counters") {
+            config.counters = max<size_t>(1, stoul(value));
+        } else if (arg == "--max-scan") {
+            config.max_scan = max<size_t>(1, stoul(value));
+        } else if (arg == "--shards") {
+            config.shards = max<size_t>(1, stoul(value));
+        } else if (arg == "--budgets") {
+            config.budgets.clear();
+            for (const string& b : splitList(value)) config.budgets.push_back(parseBytes(b));
+        } else if (arg == "--evictions") {
+            config.evictions = splitList(value);
+            for (const string& e : config.evictions) {
+                if (parseEviction(e) == EvictionPolicy::None) {
+                    cerr << "kv_bench: unknown eviction policy '" << e << "'\n";
+                    return false;
+                }
+            }
+        } else if (arg == "--seed") {
+            config.seed = stoull(value);
+        } else if (arg == "--output") {
+            config.output = value;
+        } else if (arg == "--compare") {
+            config.compare = value;
+        } else if (arg == "--tolerance") {
+            config.tolerance = stod(value);
+        } else {
+            cerr << "kv_bench: unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- Keys and values ---
+
+// Bijective 64-bit mix, so distinct record numbers give distinct keys while
+// neighbouring records land far apart in key order.
+uint64_t scramble(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// "user" + 12 base-32 digits of the scrambled record number (60 bits,
+// unique for any realistic record count), padded out to key_size.
+void makeKey(uint64_t record, size_t key_size, string& key) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuv";
+    uint64_t x = scramble(record);
+    key.assign("user");
+    for (int i = 0; i < 12; ++i, x >>= 5) key.push_back(digits[x & 31]);
+    key.resize(key_size, '0');
+}
+
+// A value in the --values style for `record`; `salt` tells one write of
+// it from another. "fill" values are constant and built by the callers.
+void makeValue(const BenchConfig& config, uint64_t record, uint64_t salt, string& value) {
+    static const char* const words[] = {
+        "the",   "of",     "and",   "order",  "to",      "in",    "shipped", "customer", "account", "for",
+        "is",    "with",   "store", "was",    "payment", "on",    "item",    "by",       "status",  "from",
+        "price", "review", "new",   "update", "delivery", "that", "user",    "product",  "cart",    "return"};
+    constexpr size_t WORDS = sizeof(words) / sizeof(words[0]);
+    uint64_t x = scramble(record * 31 + salt);
+    char buffer[32];
+    if (config.values == "int") {
+        // Nanoseconds since the epoch, around 2023
+        value.assign(buffer, snprintf(buffer, sizeof(buffer), "%llu",
+                                      static_cast<unsigned long long>(1700000000000000000ULL + x % 100000000000000000ULL)));
+        return;
+    }
+    auto appendWords = [&](size_t until) {
+        while (value.size() < until) {
+            x = scramble(x);
+            if (!value.empty() && value.back() != '"') value.push_back(' ');
+            value += words[x % WORDS];
+        }
+    };
+    if (config.values == "text") {
+        value.clear();
+        appendWords(config.value_size);
+    } else {
+        auto n = [&](uint64_t v) { return string(buffer, snprintf(buffer, sizeof(buffer), "%llu",
+                                                                  static_cast<unsigned long long>(v))); };
+        value = "{\"id\":" + n(record) + ",\"name\":\"user" + n(record % 100000) + "\",\"email\":\"user" +
+                n(record % 100000) + "@example.com\",\"active\":" + (x & 1 ? "true" : "false") +
+                ",\"visits\":" + n(x % 1000) + ",\"created\":" + n(1700000000 + x % 100000000) + ",\"note\":\"";
+        appendWords(config.value_size > 2 ? config.value_size - 2 : 0);
+        value += "\"}";
+    }
+    value.resize(config.value_size, ' ');
+}
+
+// --- Key choosers ---
+
+// YCSB's zipfian generator (Gray et al., "Quickly generating billion-record
+// synthetic databases"): O(1) per draw after an O(n) zeta precomputation.
+class Zipfian {
+public:
+    Zipfian(uint64_t items, double theta = 0.99) : items_(items), theta_(theta) {
+        zeta2_ = zeta(2);
+        zetan_ = zeta(items);
+        alpha_ = 1.0 / (1.0 - theta_);
+        eta_ = (1.0 - pow(2.0 / static_cast<double>(items_), 1.0 - theta_)) / (1.0 - zeta2_ / zetan_);
+    }
+
+    // Rank in [0, items): 0 is the most popular.
+    uint64_t next(mt19937_64& rng) const {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta_)) return 1;
+        auto rank = static_cast<uint64_t>(static_cast<double>(items_) * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return min(rank, items_ - 1);
+    }
+
+private:
+    double zeta(uint64_t n) const {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) sum += 1.0 / pow(static_cast<double>(i), theta_);
+        return sum;
+    }
+
+    uint64_t items_;
+    double theta_, zeta2_, zetan_, alpha_, eta_;
+};
+
+enum class Distribution { Uniform, Zipfian, Latest };
+
+Distribution parseDistribution(const string& name) {
+    if (name == "zipfian") return Distribution::Zipfian;
+    if (name == "latest") return Distribution::Latest;
+    return Distribution::Uniform;
+}
+
+// Picks the record number for the next read/update/scan.
+class KeyChooser {
+public:
+    KeyChooser(Distribution distribution, const Zipfian* zipfian, const atomic<uint64_t>* inserted)
+        : distribution_(distribution), zipfian_(zipfian), inserted_(inserted) {}
+
+    uint64_t next(mt19937_64& rng) const {
+        uint64_t count = inserted_->load(memory_order_relaxed);
+        switch (distribution_) {
+            case Distribution::Uniform:
+                return uniform_int_distribution<uint64_t>(0, count - 1)(rng);
+            case Distribution::Zipfian:
+                // Scrambled so the hot records are not all adjacent. The
+                // zipfian covers the preload; inserts stay cold.
+                return scramble(zipfian_->next(rng)) % count;
+            case Distribution::Latest: {
+                uint64_t back = zipfian_->next(rng);
+                return back < count ? count - 1 - back : 0;
+            }
+        }
+        return 0;
+    }
+
+private:
+    Distribution distribution_;
+    const Zipfian* zipfian_;
+    const atomic<uint64_t>* inserted_;
+};
+
+// --- Running one configuration ---
+
+struct Mix {
+    int read, update, insert, scan, rmw; // Percentages
+};
+
+Mix mixFor(char workload) {
+    switch (workload) {
+        case 'A': return {50, 50, 0, 0, 0};
+        case 'B': return {95, 5, 0, 0, 0};
+        case 'C': return {100, 0, 0, 0, 0};
+        case 'D': return {95, 0, 5, 0, 0};
+        case 'E': return {0, 0, 5, 95, 0};
+        case 'F': return {50, 0, 0, 0, 50};
+        case 'W': return {0, 100, 0, 0, 0};
+    }
+    return {100, 0, 0, 0, 0};
+}
+
+// Loads the records with config.loader; returns the seconds it took.
+double preload(KVStore& store, const BenchConfig& config) {
+    string value(config.value_size, 'v');
+    vector<string> keys(config.loader == "bulk" ? config.records : 1000);
+    vector<pair<string_view, string_view>> entries;
+    // Generated values are made before the clock starts, like the keys'
+    // records would be by a real loader
+    vector<string> values;
+    bool fill = config.values == "fill";
+    if (!fill) {
+        values.resize(config.records);
+        for (size_t r = 0; r < config.records; ++r) makeValue(config, r, 0, values[r]);
+    }
+    auto valueOf = [&](size_t r) -> string_view { return fill ? string_view(value) : string_view(values[r]); };
+    auto start = chrono::steady_clock::now();
+    if (config.loader == "bulk") {
+        // Key generation is part of the load for every loader
+        entries.reserve(config.records);
+        for (size_t r = 0; r < config.records; ++r) {
+            makeKey(r, config.key_size, keys[r]);
+            entries.emplace_back(keys[r], valueOf(r));
+        }
+        store.bulkLoad(entries);
+    } else if (config.loader == "put") {
+        for (size_t r = 0; r < config.records; ++r) {
+            makeKey(r, config.key_size, keys[0]);
+            store.put(keys[0], valueOf(r));
+        }
+    } else {
+        const size_t batch = keys.size();
+        for (size_t first = 0; first < config.records; first += batch) {
+            entries.clear();
+            size_t end = min(config.records, first + batch);
+            for (size_t r = first; r < end; ++r) {
+                makeKey(r, config.key_size, keys[r - first]);
+                entries.emplace_back(keys[r - first], valueOf(r));
+            }
+            store.multiPut(entries);
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// One read through the configured API. Each adds the value's last byte to
+// `checksum`, so every variant has to reach the value.
+bool readValue(KVStore& store, const string& api, const string& key, uint64_t& checksum) {
+    auto consume = [&](string_view value) {
+        if (!value.empty()) checksum += static_cast<unsigned char>(value.back());
+    };
+    if (api == "handle") {
+        ValueHandle value = store.getHandle(key);
+        if (value) consume(value.view());
+        return value.has_value();
+    }
+    if (api == "visit") return store.get(key, consume);
+    optional<string> value = store.get(key);
+    if (value) consume(*value);
+    return value.has_value();
+}
+
+RunResult runOne(const BenchConfig& config, char workload, const string& distribution_name, size_t budget,
+                 const string& eviction, size_t threads, const Zipfian& zipfian) {
+    StoreOptions options;
+    options.num_shards = config.shards;
+    options.memory_budget = budget;
+    options.eviction = parseEviction(eviction);
+    options.hash_index = config.index == "hash";
+    options.combine_writes = config.writes == "combine";
+    options.value_compression = parseCompression(config.compression);
+    KVStore store(options);
+    double load_seconds = preload(store, config);
+    TrieStats loaded = store.stats().trie;
+
+    atomic<uint64_t> inserted{config.records};
+    KeyChooser chooser(parseDistribution(distribution_name), &zipfian, &inserted);
+    Mix mix = mixFor(workload);
+    vector<LatencyHistogram> histograms(threads);
+    atomic<uint64_t> reads{0}, hits{0}, sink{0};
+    atomic<size_t> ready{0};
+    atomic<bool> go{false};
+
+    auto worker = [&](size_t t) {
+        mt19937_64 rng(config.seed * 7919 + t);
+        uniform_int_distribution<int> percent(0, 99);
+        uniform_int_distribution<size_t> scan_length(1, config.max_scan);
+        string key;
+        string value(config.value_size, static_cast<char>('a' + t % 26));
+        vector<pair<string, string>> batch;
+        size_t ops = config.operations / threads + (t < config.operations % threads ? 1 : 0);
+        LatencyHistogram& histogram = histograms[t];
+        uint64_t my_reads = 0, my_hits = 0;
+        uint64_t checksum = 0; // Keeps reads from being optimized away
+        // Generated values are made up front; writes cycle through them
+        vector<string> pool(config.values == "fill" ? 0 : min<size_t>(ops, 1024));
+        for (size_t j = 0; j < pool.size(); ++j) makeValue(config, config.records + j, t + 1, pool[j]);
+
+        ready.fetch_add(1);
+        while (!go.load(memory_order_acquire)) this_thread::yield();
+
+        for (size_t i = 0; i < ops; ++i) {
+            int roll = percent(rng);
+            // Pick the key before starting the clock
+            bool insert = roll >= mix.read + mix.update + mix.scan + mix.rmw;
+            uint64_t record = insert ? inserted.fetch_add(1, memory_order_relaxed) : chooser.next(rng);
+            makeKey(record, config.key_size, key);
+            if (!pool.empty()) value = pool[i % pool.size()];
+
+            auto start = chrono::steady_clock::now();
+            if (roll < mix.read) {
+                bool found = readValue(store, config.read_api, key, checksum);
+                my_reads++;
+                if (found) {
+                    my_hits++;
+                } else {
+                    store.put(key, value); // Cache-aside fill
+                }
+            } else if (roll < mix.read + mix.update) {
+                store.put(key, value);
+            } else if (roll < mix.read + mix.update + mix.scan) {
+                store.seek(key).next(batch, scan_length(rng));
+            } else if (roll < mix.read + mix.update + mix.scan + mix.rmw) {
+                auto current = store.get(key);
+                value[0] = current && !current->empty() ? static_cast<char>((*current)[0] + 1) : 'a';
+                store.put(key, value);
+            } else {
+                store.put(key, value);
+            }
+            auto elapsed = chrono::steady_clock::now() - start;
+            histogram.record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+        }
+        reads.fetch_add(my_reads);
+        sink.fetch_add(checksum, memory_order_relaxed);
+        hits.fetch_add(my_hits);
+    };
+
+    vector<thread> pool;
+    for (size_t t = 0; t < threads; ++t) pool.emplace_back(worker, t);
+    while (ready.load() < threads) this_thread::yield();
+    auto start = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    for (auto& th : pool) th.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    LatencyHistogram merged;
+    for (const auto& h : histograms) merged.merge(h);
+    RunResult result;
+    result.workload = workload;
+    result.distribution = distribution_name;
+    result.budget = budget;
+    result.eviction = budget > 0 ? eviction : "none";
+    result.threads = threads;
+    result.operations = config.operations;
+    result.seconds = seconds;
+    result.ops_per_sec = seconds > 0 ? static_cast<double>(config.operations) / seconds : 0;
+    result.p50_ns = merged.percentile(0.50);
+    result.p99_ns = merged.percentile(0.99);
+    result.p999_ns = merged.percentile(0.999);
+    result.max_ns = merged.maximum();
+    result.load_per_sec = load_seconds > 0 ? static_cast<double>(config.records) / load_seconds : 0;
+    result.memory_bytes = loaded.arena_in_use_bytes + loaded.index_bytes;
+    result.index_bytes = loaded.index_bytes;
+    result.hit_rate = reads.load() > 0 ? static_cast<double>(hits.load()) / static_cast<double>(reads.load()) : 1.0;
+    return result;
+}
+
+// --- Contended counters ---
+
+struct CounterResult {
+    string method; // "get+put" or "increment"
+    size_t threads;
+    double ops_per_sec;
+    uint64_t p50_ns, p99_ns;
+    uint64_t lost; // Increments missing from the final counts
+};
+
+// Threads bump uniformly chosen counters, config.operations times in all.
+// get+put reads under the shard's shared lock and writes under its
+// exclusive one, so two threads can read the same count and one update
+// vanishes; increment() reads and writes under a single exclusive lock.
+CounterResult runCounters(const BenchConfig& config, const string& method, size_t threads) {
+    StoreOptions options;
+    options.num_shards = config.shards;
+    options.combine_writes = config.writes == "combine";
+    KVStore store(options);
+    auto counterKey = [](size_t i) { return "counter:" + to_string(i); };
+    for (size_t i = 0; i < config.counters; ++i) store.put(counterKey(i), "0");
+
+    vector<LatencyHistogram> histograms(threads);
+    atomic<size_t> ready{0};
+    atomic<bool> go{false};
+    auto worker = [&](size_t t) {
+        mt19937_64 rng(config.seed * 7919 + t);
+        uniform_int_distribution<size_t> pick(0, config.counters - 1);
+        size_t ops = config.operations / threads + (t < config.operations % threads ? 1 : 0);
+        ready.fetch_add(1);
+        while (!go.load(memory_order_acquire)) this_thread::yield();
+        for (size_t i = 0; i < ops; ++i) {
+            string key = counterKey(pick(rng));
+            auto start = chrono::steady_clock::now();
+            if (method == "increment") {
+                store.increment(key);
+            } else {
+                optional<string> current = store.get(key);
+                store.put(key, to_string((current ? stoll(*current) : 0) + 1));
+            }
+            auto elapsed = chrono::steady_clock::now() - start;
+            histograms[t].record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+        }
+    };
+    vector<thread> pool;
+    for (size_t t = 0; t < threads; ++t) pool.emplace_back(worker, t);
+    while (ready.load() < threads) this_thread::yield();
+    auto start = chrono::steady_clock::now();
+    go.store(true, memory_order_release);
+    for (auto& th : pool) th.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t counted = 0;
+    for (size_t i = 0; i < config.counters; ++i) counted += stoull(store.get(counterKey(i)).value_or("0"));
+    LatencyHistogram merged;
+    for (const auto& h : histograms) merged.merge(h);
+    CounterResult result;
+    result.method = method;
+    result.threads = threads;
+    result.ops_per_sec = seconds > 0 ? static_cast<double>(config.operations) / seconds : 0;
+    result.p50_ns = merged.percentile(0.50);
+    result.p99_ns = merged.percentile(0.99);
+    result.lost = config.operations - counted;
+    return result;
+}
+
+void printCounters(const vector<CounterResult>& results) {
+    printf("%-10s %7s %14s %10s %10s %12s\n", "method", "threads", "ops/s", "p50 ns", "p99 ns", "lost");
+    for (const CounterResult& r : results) {
+        printf("%-10s %7zu %14.0f %10llu %10llu %12llu\n", r.method.c_str(), r.threads, r.ops_per_sec,
+               static_cast<unsigned long long>(r.p50_ns), static_cast<unsigned long long>(r.p99_ns),
+               static_cast<unsigned long long>(r.lost));
+    }
+}
+
+// --- JSON output ---
+
+void writeJson(ostream& out, const BenchConfig& config, const vector<RunResult>& results) {
+#if defined(__OPTIMIZE__)
+    const bool optimized = true;
+#else
+    const bool optimized = false;
+#endif
+    out << "{\n";
+    out << "  \"config\": {\"records\": " << config.records << ", \"operations\": " << config.operations
+        << ", \"key_size\": " << config.key_size << ", \"value_size\": " << config.value_size
+        << ", \"read_api\": \"" << config.read_api << "\", \"loader\": \"" << config.loader << "\""
+        << ", \"index\": \"" << config.index << "\", \"writes\": \"" << config.writes << "\""
+        << ", \"compression\": \"" << config.compression << "\", \"values\": \"" << config.values << "\""
+        << ", \"max_scan\": " << config.max_scan << ", \"shards\": " << config.shards
+        << ", \"seed\": " << config.seed << ", \"optimized\": " << (optimized ? "true" : "false")
+        << ", \"hardware_threads\": " << thread::hardware_concurrency() << "},\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const RunResult& r = results[i];
+        char line[640];
+        snprintf(line, sizeof(line),
+                 "    {\"workload\": \"%c\", \"distribution\": \"%s\", \"budget\": %zu, \"eviction\": \"%s\", "
+                 "\"threads\": %zu, \"operations\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+                 "\"hit_rate\": %.4f, \"load_per_sec\": %.1f, \"memory_bytes\": %zu, \"index_bytes\": %zu, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}%s\n",
+                 r.workload, r.distribution.c_str(), r.budget, r.eviction.c_str(), r.threads, r.operations,
+                 r.seconds, r.ops_per_sec, r.hit_rate, r.load_per_sec, r.memory_bytes, r.index_bytes,
+                 static_cast<unsigned long long>(r.p50_ns), static_cast<unsigned long long>(r.p99_ns),
+                 static_cast<unsigned long long>(r.p999_ns), static_cast<unsigned long long>(r.max_ns),
+                 i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+}
+
+// --- Reading a baseline back ---
+
+// Just enough of a JSON reader for the files writeJson produces (objects,
+// arrays, strings without escapes, numbers, booleans).
+struct JsonValue {
+    enum class Type { Null, Bool, Number, String, Array, Object } type = Type::Null;
+    double number = 0;
+    string text;
+    vector<JsonValue> items;
+    map<string, JsonValue> fields;
+
+    const JsonValue* get(const string& name) const {
+        auto it = fields.find(name);
+        return it == fields.end() ? nullptr : &it->second;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const string& text) : text_(text) {}
+
+    bool parse(JsonValue& value) {
+        return parseValue(value) && (skipSpace(), pos_ == text_.size());
+    }
+
+private:
+    void skipSpace() {
+        while (pos_ < text_.size() && isspace(static_cast<unsigned char>(text_[pos_]))) ++pos_;
+    }
+
+    bool parseValue(JsonValue& value) {
+        skipSpace();
+        if (pos_ >= text_.size()) return false;
+        char c = text_[pos_];
+        if (c == '{') return parseObject(value);
+        if (c == '[') return parseArray(value);
+        if (c == '"') {
+            value.type = JsonValue::Type::String;
+            return parseString(value.text);
+        }
+        if (text_.compare(pos_, 4, "true") == 0 || text_.compare(pos_, 5, "false") == 0) {
+            value.type = JsonValue::Type::Bool;
+            value.number = text_[pos_] == 't';
+            pos_ += text_[pos_] == 't' ? 4 : 5;
+            return true;
+        }
+        if (text_.compare(pos_, 4, "null") == 0) {
+            pos_ += 4;
+            return true;
+        }
+        size_t end = pos_;
+        while (end < text_.size() && (isdigit(static_cast<unsigned char>(text_[end])) ||
+                                      strchr("+-.eE", text_[end]))) {
+            ++end;
+        }
+        if (end == pos_) return false;
+        value.type = JsonValue::Type::Number;
+        value.number = strtod(text_.c_str() + pos_, nullptr);
+        pos_ = end;
+        return true;
+    }
+
+    bool parseString(string& out) {
+        size_t end = text_.find('"', pos_ + 1);
+        if (end == string::npos) return false;
+        out = text_.substr(pos_ + 1, end - pos_ - 1);
+        pos_ = end + 1;
+        return true;
+    }
+
+    bool parseArray(JsonValue& value) {
+        value.type = JsonValue::Type::Array;
+        ++pos_;
+        skipSpace();
+        if (pos_ < text_.size() && text_[pos_] == ']') return ++pos_, true;
+        while (true) {
+            value.items.emplace_back();
+            if (!parseValue(value.items.back())) return false;
+            skipSpace();
+            if (pos_ >= text_.size()) return false;
+            if (text_[pos_++] == ']') return true;
+            if (text_[pos_ - 1] != ',') return false;
+        }
+    }
+
+    bool parseObject(JsonValue& value) {
+        value.type = JsonValue::Type::Object;
+        ++pos_;
+        skipSpace();
+        if (pos_ < text_.size() && text_[pos_] == '}') return ++pos_, true;
+        while (true) {
+            skipSpace();
+            string name;
+            if (pos_ >= text_.size() || text_[pos_] != '"' || !parseString(name)) return false;
+            skipSpace();
+            if (pos_ >= text_.size() || text_[pos_++] != ':') return false;
+            if (!parseValue(value.fields[name])) return false;
+            skipSpace();
+            if (pos_ >= text_.size()) return false;
+            if (text_[pos_++] == '}') return true;
+            if (text_[pos_ - 1] != ',') return false;
+        }
+    }
+
+    const string& text_;
+    size_t pos_ = 0;
+};
+
+double numberField(const JsonValue& object, const string& name, double fallback) {
+    const JsonValue* field = object.get(name);
+    return field && field->type == JsonValue::Type::Number ? field->number : fallback;
+}
+
+// Loads a baseline and points `config` at exactly the runs it contains.
+bool loadBaseline(const string& path, BenchConfig& config, vector<RunResult>& baseline) {
+    ifstream in(path);
+    if (!in) {
+        cerr << "kv_bench: cannot read " << path << "\n";
+        return false;
+    }
+    stringstream buffer;
+    buffer << in.rdbuf();
+    string text = buffer.str();
+    JsonValue root;
+    const JsonValue* results = nullptr;
+    const JsonValue* settings = nullptr;
+    if (!JsonParser(text).parse(root) || !(results = root.get("results")) || !(settings = root.get("config"))) {
+        cerr << "kv_bench: " << path << " is not a kv_bench result file\n";
+        return false;
+    }
+
+    // Same data shape as the baseline, or the comparison means nothing.
+    config.records = static_cast<size_t>(numberField(*settings, "records", double(config.records)));
+    config.operations = static_cast<size_t>(numberField(*settings, "operations", double(config.operations)));
+    config.key_size = static_cast<size_t>(numberField(*settings, "key_size", double(config.key_size)));
+    config.value_size = static_cast<size_t>(numberField(*settings, "value_size", double(config.value_size)));
+    if (const JsonValue* read_api = settings->get("read_api")) config.read_api = read_api->text;
+    if (const JsonValue* loader = settings->get("loader")) config.loader = loader->text;
+    if (const JsonValue* index = settings->get("index")) config.index = index->text;
+    if (const JsonValue* writes = settings->get("writes")) config.writes = writes->text;
+    if (const JsonValue* compression = settings->get("compression")) config.compression = compression->text;
+    if (const JsonValue* values = settings->get("values")) config.values = values->text;
+    config.max_scan = static_cast<size_t>(numberField(*settings, "max_scan", double(config.max_scan)));
+    config.shards = static_cast<size_t>(numberField(*settings, "shards", double(config.shards)));
+    config.seed = static_cast<uint64_t>(numberField(*settings, "seed", double(config.seed)));
+
+    for (const JsonValue& item : results->items) {
+        const JsonValue* workload = item.get("workload");
+        const JsonValue* distribution = item.get("distribution");
+        if (!workload || workload->text.size() != 1 || !distribution) continue;
+        RunResult r{};
+        r.workload = workload->text[0];
+        r.distribution = distribution->text;
+        r.budget = static_cast<size_t>(numberField(item, "budget", 0));
+        const JsonValue* eviction = item.get("eviction");
+        r.eviction = eviction ? eviction->text : "none";
+        r.threads = static_cast<size_t>(numberField(item, "threads", 1));
+        r.operations = config.operations;
+        r.ops_per_sec = numberField(item, "ops_per_sec", 0);
+        r.hit_rate = numberField(item, "hit_rate", 1.0);
+        r.load_per_sec = numberField(item, "load_per_sec", 0.0);
+        r.memory_bytes = static_cast<size_t>(numberField(item, "memory_bytes", 0));
+        r.index_bytes = static_cast<size_t>(numberField(item, "index_bytes", 0));
+        r.p50_ns = static_cast<uint64_t>(numberField(item, "p50_ns", 0));
+        r.p99_ns = static_cast<uint64_t>(numberField(item, "p99_ns", 0));
+        r.p999_ns = static_cast<uint64_t>(numberField(item, "p999_ns", 0));
+        baseline.push_back(r);
+    }
+    return true;
+}
+
+// Prints a comparison table; returns how many runs regressed.
+size_t compareResults(const vector<RunResult>& baseline, const vector<RunResult>& current, double tolerance) {
+    size_t regressions = 0;
+    printf("%-3s %-8s %9s %-6s %7s %14s %14s %8s %10s %10s %8s\n", "wl", "dist", "budget", "evict", "threads",
+           "base ops/s", "ops/s", "delta", "base p99", "p99", "delta");
+    for (size_t i = 0; i < current.size(); ++i) {
+        const RunResult& b = baseline[i];
+        const RunResult& c = current[i];
+        double throughput = b.ops_per_sec > 0 ? c.ops_per_sec / b.ops_per_sec - 1.0 : 0;
+        double p99 = b.p99_ns > 0 ? static_cast<double>(c.p99_ns) / static_cast<double>(b.p99_ns) - 1.0 : 0;
+        bool regressed = throughput < -tolerance || p99 > tolerance;
+        regressions += regressed;
+        printf("%-3c %-8s %9zu %-6s %7zu %14.0f %14.0f %+7.1f%% %10llu %10llu %+7.1f%%%s\n", c.workload,
+               c.distribution.c_str(), c.budget, c.eviction.c_str(), c.threads, b.ops_per_sec, c.ops_per_sec, throughput * 100,
+               static_cast<unsigned long long>(b.p99_ns), static_cast<unsigned long long>(c.p99_ns), p99 * 100,
+               regressed ? "  REGRESSION" : "");
+    }
+    return regressions;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage();
+        return 2;
+    }
+
+    if (config.counters > 0) {
+        vector<CounterResult> results;
+        for (size_t threads : config.threads) {
+            for (const char* method : {"get+put", "increment"}) {
+                cerr << "kv_bench: " << config.counters << " counter(s), " << method << ", " << threads << " thread(s)\n";
+                results.push_back(runCounters(config, method, threads));
+            }
+        }
+        printCounters(results);
+        return 0;
+    }
+
+    vector<RunResult> baseline;
+    if (!config.compare.empty() && !loadBaseline(config.compare, config, baseline)) return 2;
+
+    // One zipfian covers every run; its zeta precomputation is O(records).
+    Zipfian zipfian(config.records);
+    vector<RunResult> results;
+    auto run = [&](char workload, const string& distribution, size_t budget, const string& eviction,
+                   size_t threads) {
+        cerr << "kv_bench: workload " << workload << ", " << distribution;
+        if (budget > 0) cerr << ", budget " << budget << " (" << eviction << ")";
+        cerr << ", " << threads << " thread(s)\n";
+        results.push_back(runOne(config, workload, distribution, budget, eviction, threads, zipfian));
+    };
+    if (!baseline.empty()) {
+        for (const RunResult& b : baseline) run(b.workload, b.distribution, b.budget, b.eviction, b.threads);
+    } else {
+        const vector<string> unbounded{"none"};
+        for (char workload : config.workloads) {
+            for (const string& distribution : config.distributions) {
+                for (size_t budget : config.budgets) {
+                    for (const string& eviction : budget > 0 ? config.evictions : unbounded) {
+                        for (size_t threads : config.threads) run(workload, distribution, budget, eviction, threads);
+                    }
+                }
+            }
+        }
+    }
+
+    if (!config.output.empty()) {
+        ofstream out(config.output);
+        writeJson(out, config, results);
+    } else if (baseline.empty()) {
+        writeJson(cout, config, results);
+    }
+
+    if (!baseline.empty()) {
+        size_t regressions = compareResults(baseline, results, config.tolerance);
+        printf("%zu of %zu runs regressed beyond %.0f%%\n", regressions, results.size(), config.tolerance * 100);
+        return regressions == 0 ? 0 : 1;
+    }
+    return 0;
+}
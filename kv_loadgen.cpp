@@ -0,0 +1,309 @@
+// kv_loadgen: drives kv_server (or any RESP server) over loopback.
+//
+// Each of --threads threads opens --connections connections and keeps
+// each one busy with batches of --pipeline requests: the whole batch is
+// written at once, then all of its replies are read. Requests are GET or
+// SET (--reads percent GET) over --keys uniformly chosen keys, which are
+// preloaded with MSET first so reads hit.
+//
+// Reports throughput and the latency of each request, taken as the round
+// trip of the batch it was sent in - what a pipelining client sees.
+
+#include "metrics.hpp"
+#include "resp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+using namespace std;
+
+namespace {
+
+struct LoadConfig {
+    string host = "127.0.0.1";
+    int port = 6379;
+    size_t threads = 4;
+    size_t connections = 4;   // Per thread
+    size_t pipeline = 16;     // Requests in flight per connection
+    size_t requests = 1000000; // In total, across all connections
+    size_t keys = 100000;
+    size_t value_size = 64;
+    unsigned reads = 90; // Percent GET; the rest SET
+    bool preload = true;
+};
+
+void printUsage() {
+    cout << "usage: kv_loadgen [options]\n"
+            "  --host ADDR         server address (default 127.0.0.1)\n"
+            "  --port N            server port (default 6379)\n"
+            "  --threads N         client threads (default 4)\n"
+            "  --connections N     connections per thread (default 4)\n"
+            "  --pipeline N        requests per batch (default 16)\n"
+            "  --requests N        total requests (default 1000000)\n"
+            "  --keys N            key space (default 100000)\n"
+            "  --value-size BYTES  SET payload (default 64)\n"
+            "  --reads PERCENT     share of GETs (default 90)\n"
+            "  --no-preload        skip loading the key space first\n";
+}
+
+bool parseArgs(int argc, char** argv, LoadConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            exit(0);
+        }
+        if (arg == "--no-preload") {
+            config.preload = false;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            cerr << "kv_loadgen: " << arg << " needs a value\n";
+            return false;
+        }
+        string value = argv[++i];
+        if (arg == "--host") config.host = value;
+        else if (arg == "--port") config.port = stoi(value);
+        else if (arg == "--threads") config.threads = max<size_t>(1, stoul(value));
+        else if (arg == "--connections") config.connections = max<size_t>(1, stoul(value));
+        else if (arg == "--pipeline") config.pipeline = max<size_t>(1, stoul(value));
+        else if (arg == "--requests") config.requests = stoul(value);
+        else if (arg == "--keys") config.keys = max<size_t>(1, stoul(value));
+        else if (arg == "--value-size") config.value_size = stoul(value);
+        else if (arg == "--reads") config.reads = min(100u, static_cast<unsigned>(stoul(value)));
+        else {
+            cerr << "kv_loadgen: unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int connectTo(const LoadConfig& config) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(config.host.c_str(), to_string(config.port).c_str(), &hints, &found) != 0) return -1;
+    int fd = -1;
+    for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    if (fd >= 0) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+    return fd;
+}
+
+string keyName(size_t i) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "key:%012zu", i);
+    return buffer;
+}
+
+// A blocking connection that sends a batch and collects its replies.
+class Client {
+public:
+    explicit Client(int fd) : fd_(fd) {}
+    ~Client() { close(fd_); }
+
+    bool send(const string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = write(fd_, data.data() + sent, data.size() - sent);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    // Reads `count` replies; `errors` counts the error replies among them.
+    bool receive(size_t count, size_t& errors) {
+        while (count > 0) {
+            size_t consumed = 0;
+            bool is_error = false;
+            RespStatus status = parseReply(string_view(buffer_).substr(start_), consumed, &is_error);
+            if (status == RespStatus::Error) return false;
+            if (status == RespStatus::Complete) {
+                start_ += consumed;
+                errors += is_error;
+                --count;
+                continue;
+            }
+            buffer_.erase(0, start_);
+            start_ = 0;
+            size_t used = buffer_.size();
+            buffer_.resize(used + 64 * 1024);
+            ssize_t n = read(fd_, buffer_.data() + used, buffer_.size() - used);
+            buffer_.resize(used + static_cast<size_t>(max<ssize_t>(n, 0)));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+        }
+        return true;
+    }
+
+private:
+    int fd_;
+    string buffer_;
+    size_t start_ = 0; // Replies before this are consumed
+};
+
+struct ThreadResult {
+    LatencyHistogram latency; // Nanoseconds
+    size_t completed = 0;
+    size_t errors = 0;
+    bool failed = false;
+};
+
+bool preload(const LoadConfig& config) {
+    int fd = connectTo(config);
+    if (fd < 0) return false;
+    Client client(fd);
+    const string value(config.value_size, 'v');
+    const size_t PER_MSET = 256;
+    string request;
+    size_t batches = 0;
+    size_t errors = 0;
+    vector<string> names;
+    vector<string_view> args;
+    for (size_t first = 0; first < config.keys; first += PER_MSET) {
+        size_t last = min(config.keys, first + PER_MSET);
+        names.clear();
+        for (size_t i = first; i < last; ++i) names.push_back(keyName(i));
+        args.assign(1, "MSET");
+        for (const string& name : names) {
+            args.push_back(name);
+            args.push_back(value);
+        }
+        appendRequest(request, args);
+        // A few MSETs in flight at once, like the measured phase.
+        if (++batches % 16 == 0 || last == config.keys) {
+            if (!client.send(request) || !client.receive(batches, errors)) return false;
+            request.clear();
+            batches = 0;
+        }
+    }
+    return errors == 0;
+}
+
+void runConnections(const LoadConfig& config, size_t quota, unsigned seed, ThreadResult& result) {
+    vector<unique_ptr<Client>> clients;
+    for (size_t i = 0; i < config.connections; ++i) {
+        int fd = connectTo(config);
+        if (fd < 0) {
+            result.failed = true;
+            return;
+        }
+        clients.push_back(make_unique<Client>(fd));
+    }
+    mt19937_64 rng(seed);
+    uniform_int_distribution<size_t> pick_key(0, config.keys - 1);
+    uniform_int_distribution<unsigned> pick_op(0, 99);
+    const string value(config.value_size, 'x');
+    vector<string> requests(clients.size());
+    vector<size_t> in_flight(clients.size());
+
+    // All connections send their batch, then all collect replies, so the
+    // server sees config.connections pipelines at once from this thread.
+    while (result.completed < quota) {
+        auto sent_at = chrono::steady_clock::now();
+        size_t batch_total = 0;
+        for (size_t c = 0; c < clients.size() && result.completed + batch_total < quota; ++c) {
+            string& request = requests[c];
+            request.clear();
+            size_t n = min(config.pipeline, quota - result.completed - batch_total);
+            for (size_t i = 0; i < n; ++i) {
+                string key = keyName(pick_key(rng));
+                if (pick_op(rng) < config.reads) appendRequest(request, {"GET", key});
+                else appendRequest(request, {"SET", key, value});
+            }
+            in_flight[c] = n;
+            batch_total += n;
+            if (!clients[c]->send(request)) {
+                result.failed = true;
+                return;
+            }
+        }
+        for (size_t c = 0; c < clients.size() && in_flight[c] > 0; ++c) {
+            if (!clients[c]->receive(in_flight[c], result.errors)) {
+                result.failed = true;
+                return;
+            }
+            uint64_t rtt = static_cast<uint64_t>(
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - sent_at).count());
+            for (size_t i = 0; i < in_flight[c]; ++i) result.latency.record(rtt);
+            in_flight[c] = 0;
+        }
+        result.completed += batch_total;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    LoadConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage();
+        return 2;
+    }
+    if (config.preload) {
+        cerr << "kv_loadgen: preloading " << config.keys << " keys\n";
+        if (!preload(config)) {
+            cerr << "kv_loadgen: preload against " << config.host << ":" << config.port << " failed\n";
+            return 1;
+        }
+    }
+
+    vector<ThreadResult> results(config.threads);
+    vector<thread> threads;
+    auto start = chrono::steady_clock::now();
+    for (size_t t = 0; t < config.threads; ++t) {
+        size_t quota = config.requests / config.threads + (t < config.requests % config.threads ? 1 : 0);
+        threads.emplace_back(runConnections, cref(config), quota, static_cast<unsigned>(t + 1), ref(results[t]));
+    }
+    for (auto& t : threads) t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    LatencyHistogram latency;
+    size_t completed = 0;
+    size_t errors = 0;
+    bool failed = false;
+    for (const ThreadResult& r : results) {
+        latency.merge(r.latency);
+        completed += r.completed;
+        errors += r.errors;
+        failed |= r.failed;
+    }
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    printf("requests     %zu in %.2f s (%zu connections, pipeline %zu, %u%% GET)\n", completed, seconds,
+           config.threads * config.connections, config.pipeline, config.reads);
+    printf("throughput   %.0f requests/s\n", completed / seconds);
+    printf("latency (us) p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", us(latency.percentile(0.50)),
+           us(latency.percentile(0.99)), us(latency.percentile(0.999)), us(latency.maximum()));
+    if (errors > 0) printf("errors       %zu\n", errors);
+    if (failed) {
+        cerr << "kv_loadgen: a connection failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,664 @@
+// kv_server: KVStore as a network service speaking a subset of RESP, so
+// redis-cli, client libraries and load tools such as redis-benchmark can
+// talk to it.
+//
+// One event loop per thread (by default one per core), each with its own
+// edge-triggered epoll instance and its own SO_REUSEPORT listening socket,
+// so the kernel spreads new connections across loops and a connection
+// stays on one loop for life: no locks or hand-offs between loops, only
+// the store's own.
+//
+// Requests are parsed straight out of the connection's receive buffer;
+// keys and values reach the store as string_views into it. Everything a
+// read turns up is executed before anything is sent, and the replies go
+// out together with writev - a pipeline of N commands costs one write
+// call, not N. Runs of pipelined GETs become one multiGet, which walks the
+// trie for all of them at once.
+//
+// Commands:
+//   PING [msg], ECHO msg, QUIT, SELECT 0, COMMAND, CONFIG (empty replies)
+//   GET key, SET key value [EX seconds | PX milliseconds], DEL key...,
+//   EXISTS key..., MGET key..., MSET key value [key value ...], DBSIZE
+//   Atomic: INCR key, DECR key, INCRBY key n, DECRBY key n, APPEND key
+//     value, SETNX key value, GETSET key value, and
+//     CAS key expected desired  - sets `key` if it holds `expected`: 1 or 0
+//   Ordered:
+//     RANK key              - number of keys before `key`
+//     NTH n                 - [key, value] of the nth key, or nil
+//     DELNTH n              - deletes the nth key: 1 or 0
+//     RANGE start count [REV]   - up to `count` pairs from the first key
+//                                 >= start (<= start with REV), flattened
+//     PREFIX prefix count [REV] - up to `count` pairs under `prefix`
+
+#include "kv_store.hpp"
+#include "resp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+using namespace std;
+
+namespace {
+
+// --- Configuration ---
+
+struct ServerConfig {
+    string bind = "0.0.0.0";
+    int port = 6379;
+    size_t threads = max(1u, thread::hardware_concurrency());
+    StoreOptions store;
+};
+
+void printUsage() {
+    cout << "usage: kv_server [options]\n"
+            "  --bind ADDR            listen address (default 0.0.0.0)\n"
+            "  --port N               listen port (default 6379)\n"
+            "  --threads N            event loops (default: one per core)\n"
+            "  --shards N             StoreOptions::num_shards (default 16)\n"
+            "  --wal FILE             write-ahead log (default: none)\n"
+            "  --snapshot FILE        snapshot file (default: none)\n"
+            "  --memory-budget BYTES  e.g. 512M (default: unbounded)\n"
+            "  --eviction POLICY      lru, clock or lfu (default lru)\n";
+}
+
+size_t parseBytes(const string& text) {
+    size_t end = 0;
+    size_t bytes = stoul(text, &end);
+    switch (end < text.size() ? toupper(static_cast<unsigned char>(text[end])) : 0) {
+        case 'K': return bytes << 10;
+        case 'M': return bytes << 20;
+        case 'G': return bytes << 30;
+    }
+    return bytes;
+}
+
+bool parseArgs(int argc, char** argv, ServerConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            exit(0);
+        }
+        if (i + 1 >= argc) {
+            cerr << "kv_server: " << arg << " needs a value\n";
+            return false;
+        }
+        string value = argv[++i];
+        if (arg == "--bind") {
+            config.bind = value;
+        } else if (arg == "--port") {
+            config.port = stoi(value);
+        } else if (arg == "--threads") {
+            config.threads = max<size_t>(1, stoul(value));
+        } else if (arg == "--shards") {
+            config.store.num_shards = max<size_t>(1, stoul(value));
+        } else if (arg == "--wal") {
+            config.store.wal_path = value;
+        } else if (arg == "--snapshot") {
+            config.store.snapshot_path = value;
+        } else if (arg == "--memory-budget") {
+            config.store.memory_budget = parseBytes(value);
+        } else if (arg == "--eviction") {
+            if (value == "lru") config.store.eviction = EvictionPolicy::Lru;
+            else if (value == "clock") config.store.eviction = EvictionPolicy::Clock;
+            else if (value == "lfu") config.store.eviction = EvictionPolicy::Lfu;
+            else {
+                cerr << "kv_server: unknown eviction policy '" << value << "'\n";
+                return false;
+            }
+        } else {
+            cerr << "kv_server: unknown option " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- Output ---
+
+// Replies waiting to be sent. Small replies are appended to the last
+// chunk; values of LARGE_VALUE bytes or more are moved in as chunks of
+// their own, so they are sent from the string the store returned instead
+// of being copied again. flush() hands all of it to one writev.
+class OutputQueue {
+public:
+    static constexpr size_t LARGE_VALUE = 4096;
+
+    string& tail() {
+        if (chunks_.empty() || chunks_.back().size() >= LARGE_VALUE) chunks_.emplace_back();
+        return chunks_.back();
+    }
+
+    void appendValue(string&& value) {
+        if (value.size() < LARGE_VALUE) {
+            appendBulk(tail(), value);
+            return;
+        }
+        appendBulkHeader(tail(), value.size());
+        chunks_.push_back(move(value));
+        chunks_.emplace_back("\r\n");
+    }
+
+    size_t pending() const {
+        size_t bytes = 0;
+        for (const string& chunk : chunks_) bytes += chunk.size();
+        return bytes - offset_;
+    }
+
+    bool empty() const { return chunks_.empty(); }
+
+    enum class Flush { Done, Blocked, Failed };
+
+    Flush flush(int fd) {
+        iovec iov[64];
+        while (!chunks_.empty()) {
+            size_t count = 0;
+            for (auto it = chunks_.begin(); it != chunks_.end() && count < size(iov); ++it, ++count) {
+                size_t skip = count == 0 ? offset_ : 0;
+                iov[count].iov_base = it->data() + skip;
+                iov[count].iov_len = it->size() - skip;
+            }
+            ssize_t written = writev(fd, iov, static_cast<int>(count));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return errno == EAGAIN || errno == EWOULDBLOCK ? Flush::Blocked : Flush::Failed;
+            }
+            consume(static_cast<size_t>(written));
+        }
+        return Flush::Done;
+    }
+
+private:
+    void consume(size_t bytes) {
+        while (bytes > 0) {
+            size_t left = chunks_.front().size() - offset_;
+            if (bytes < left) {
+                offset_ += bytes;
+                return;
+            }
+            bytes -= left;
+            offset_ = 0;
+            chunks_.pop_front();
+        }
+    }
+
+    deque<string> chunks_;
+    size_t offset_ = 0; // Already sent from chunks_.front()
+};
+
+// --- Connections and event loops ---
+
+struct Connection {
+    int fd;
+    string in;            // Receive buffer; requests are parsed in place
+    size_t in_len = 0;    // Bytes of `in` holding data
+    OutputQueue out;
+    bool read_paused = false; // Stopped reading until `out` drains
+    bool closing = false;     // Close once `out` is sent (QUIT, bad protocol)
+    bool closed = false;
+};
+
+bool equalsIgnoreCase(string_view a, const char* b) {
+    size_t n = strlen(b);
+    if (a.size() != n) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (toupper(static_cast<unsigned char>(a[i])) != b[i]) return false;
+    }
+    return true;
+}
+
+bool parseSize(string_view text, size_t& value) {
+    auto [ptr, ec] = from_chars(text.data(), text.data() + text.size(), value);
+    return ec == errc() && ptr == text.data() + text.size();
+}
+
+bool parseInteger(string_view text, int64_t& value) {
+    auto [ptr, ec] = from_chars(text.data(), text.data() + text.size(), value);
+    return ec == errc() && ptr == text.data() + text.size() && !text.empty();
+}
+
+class EventLoop {
+public:
+    EventLoop(KVStore& store, const ServerConfig& config) : store_(store) {
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        listen_ = openListener(config);
+        if (epoll_ < 0 || wake_ < 0 || listen_ < 0) throw system_error(errno, generic_category(), "kv_server");
+        watch(listen_, &listen_, EPOLLIN | EPOLLET);
+        watch(wake_, &wake_, EPOLLIN | EPOLLET);
+    }
+
+    ~EventLoop() {
+        for (auto& [fd, connection] : connections_) ::close(fd);
+        ::close(listen_);
+        ::close(wake_);
+        ::close(epoll_);
+    }
+
+    void run() {
+        epoll_event events[256];
+        while (!stopping_.load(memory_order_relaxed)) {
+            int ready = epoll_wait(epoll_, events, static_cast<int>(size(events)), -1);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (int i = 0; i < ready; ++i) {
+                void* tag = events[i].data.ptr;
+                if (tag == &listen_) {
+                    acceptAll();
+                } else if (tag != &wake_) {
+                    auto* connection = static_cast<Connection*>(tag);
+                    if (connection->closed) continue;
+                    if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                        close(*connection);
+                        continue;
+                    }
+                    if (events[i].events & EPOLLIN) onReadable(*connection);
+                    if ((events[i].events & EPOLLOUT) && !connection->closed) onWritable(*connection);
+                }
+            }
+            // Freed only now: later events of the same batch may name them.
+            dead_.clear();
+        }
+    }
+
+    // Safe from any thread.
+    void stop() {
+        stopping_.store(true, memory_order_relaxed);
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_, &one, sizeof(one));
+        (void)ignored;
+    }
+
+private:
+    // Most reply bytes one connection may have queued before the loop
+    // stops reading its requests (a client pipelining without reading).
+    static constexpr size_t MAX_PENDING_OUTPUT = 4 * 1024 * 1024;
+    static constexpr size_t READ_CHUNK = 16 * 1024;
+
+    static int openListener(const ServerConfig& config) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        // Every loop binds the same port; the kernel balances accepts.
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(config.port));
+        if (inet_pton(AF_INET, config.bind.c_str(), &address.sin_addr) != 1 ||
+            bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+            int error = errno;
+            ::close(fd);
+            errno = error;
+            return -1;
+        }
+        return fd;
+    }
+
+    void watch(int fd, void* tag, uint32_t events) {
+        epoll_event event{};
+        event.events = events;
+        event.data.ptr = tag;
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    void acceptAll() {
+        // Edge-triggered: drain the backlog, or the next edge never comes.
+        while (true) {
+            int fd = accept4(listen_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return; // EAGAIN, or out of descriptors until some close
+            }
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            auto connection = make_unique<Connection>();
+            connection->fd = fd;
+            watch(fd, connection.get(), EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+            connections_[fd] = move(connection);
+        }
+    }
+
+    void close(Connection& connection) {
+        if (connection.closed) return;
+        connection.closed = true;
+        epoll_ctl(epoll_, EPOLL_CTL_DEL, connection.fd, nullptr);
+        auto it = connections_.find(connection.fd);
+        dead_.push_back(move(it->second));
+        connections_.erase(it);
+        // The descriptor may be reused by an accept in this very batch.
+        ::close(connection.fd);
+    }
+
+    void onReadable(Connection& connection) {
+        while (!connection.closing) {
+            if (connection.out.pending() >= MAX_PENDING_OUTPUT) {
+                // Try to make room; if the client is not reading, neither
+                // do we, until EPOLLOUT says it caught up.
+                if (connection.out.flush(connection.fd) != OutputQueue::Flush::Done) {
+                    connection.read_paused = true;
+                    break;
+                }
+                // All sent without blocking, so no EPOLLOUT edge is coming:
+                // run the requests the cap left in the buffer now, or they
+                // wait for input that may never arrive.
+                process(connection);
+                continue;
+            }
+            if (connection.in.size() - connection.in_len < READ_CHUNK) {
+                connection.in.resize(max(connection.in.size() * 2, connection.in_len + READ_CHUNK));
+            }
+            ssize_t n = read(connection.fd, connection.in.data() + connection.in_len,
+                             connection.in.size() - connection.in_len);
+            if (n > 0) {
+                connection.in_len += static_cast<size_t>(n);
+                process(connection);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            close(connection); // Peer closed, or a read error
+            return;
+        }
+        flush(connection);
+    }
+
+    void onWritable(Connection& connection) {
+        if (!flush(connection) || !connection.read_paused) return;
+        connection.read_paused = false;
+        process(connection); // Requests that arrived while paused
+        onReadable(connection);
+    }
+
+    // Sends what is queued. Returns false if the connection went away or
+    // output is still pending.
+    bool flush(Connection& connection) {
+        if (connection.closed) return false;
+        OutputQueue::Flush result = connection.out.flush(connection.fd);
+        if (result == OutputQueue::Flush::Failed || (result == OutputQueue::Flush::Done && connection.closing)) {
+            close(connection);
+            return false;
+        }
+        return result == OutputQueue::Flush::Done;
+    }
+
+    // Executes every complete request in the receive buffer, then moves
+    // what is left of a partial one to the front.
+    void process(Connection& connection) {
+        string_view data(connection.in.data(), connection.in_len);
+        size_t parsed = 0;
+        while (!connection.closing && connection.out.pending() < MAX_PENDING_OUTPUT) {
+            size_t consumed = 0;
+            RespStatus status = parseRequest(data.substr(parsed), args_, consumed);
+            if (status == RespStatus::Incomplete) break;
+            if (status == RespStatus::Error) {
+                flushGets(connection);
+                appendError(connection.out.tail(), "ERR Protocol error");
+                connection.closing = true;
+                break;
+            }
+            parsed += consumed;
+            if (args_.empty()) continue;
+            if (args_.size() == 2 && equalsIgnoreCase(args_[0], "GET")) {
+                gets_.push_back(args_[1]); // Answered together, in order
+                continue;
+            }
+            flushGets(connection);
+            execute(connection, args_);
+        }
+        // Keys in gets_ point into the buffer: answer them before moving it.
+        flushGets(connection);
+        if (parsed > 0) {
+            memmove(connection.in.data(), connection.in.data() + parsed, connection.in_len - parsed);
+            connection.in_len -= parsed;
+        }
+    }
+
+    void flushGets(Connection& connection) {
+        if (gets_.empty()) return;
+        if (gets_.size() == 1) {
+            optional<string> value = store_.get(gets_[0]);
+            if (value) connection.out.appendValue(move(*value));
+            else appendNull(connection.out.tail());
+        } else {
+            store_.multiGet(gets_, values_);
+            for (optional<string>& value : values_) {
+                if (value) connection.out.appendValue(move(*value));
+                else appendNull(connection.out.tail());
+            }
+        }
+        gets_.clear();
+    }
+
+    void execute(Connection& connection, const vector<string_view>& args) {
+        string_view name = args[0];
+        size_t argc = args.size();
+        string& out = connection.out.tail();
+        auto arity = [&](bool ok) {
+            if (!ok) {
+                string message = "ERR wrong number of arguments for '";
+                for (char c : name) message.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+                appendError(out, message + "' command");
+            }
+            return ok;
+        };
+
+        if (equalsIgnoreCase(name, "GET")) {
+            if (!arity(argc == 2)) return;
+            optional<string> value = store_.get(args[1]);
+            if (value) connection.out.appendValue(move(*value));
+            else appendNull(out);
+        } else if (equalsIgnoreCase(name, "SET")) {
+            if (!arity(argc == 3 || argc == 5)) return;
+            if (argc == 5) {
+                size_t amount = 0;
+                bool seconds = equalsIgnoreCase(args[3], "EX");
+                if ((!seconds && !equalsIgnoreCase(args[3], "PX")) || !parseSize(args[4], amount) || amount == 0) {
+                    appendError(out, "ERR syntax error");
+                    return;
+                }
+                // Out of range once in milliseconds, or as a deadline from now
+                auto now = chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch());
+                if (amount > static_cast<size_t>(seconds ? INT64_MAX / 1000 : INT64_MAX) ||
+                    static_cast<int64_t>(seconds ? amount * 1000 : amount) > INT64_MAX - now.count()) {
+                    appendError(out, "ERR invalid expire time in 'set' command");
+                    return;
+                }
+                store_.put(args[1], args[2], chrono::milliseconds(seconds ? amount * 1000 : amount));
+            } else {
+                store_.put(args[1], args[2]);
+            }
+            appendSimple(out, "OK");
+        } else if (equalsIgnoreCase(name, "DEL")) {
+            if (!arity(argc >= 2)) return;
+            if (argc == 2) {
+                appendInteger(out, store_.del(args[1]) ? 1 : 0);
+            } else {
+                keys_.assign(args.begin() + 1, args.end());
+                appendInteger(out, static_cast<long long>(store_.multiDel(keys_)));
+            }
+        } else if (equalsIgnoreCase(name, "MGET") || equalsIgnoreCase(name, "EXISTS")) {
+            if (!arity(argc >= 2)) return;
+            keys_.assign(args.begin() + 1, args.end());
+            store_.multiGet(keys_, values_);
+            if (equalsIgnoreCase(name, "EXISTS")) {
+                appendInteger(out, count_if(values_.begin(), values_.end(), [](const auto& v) { return v.has_value(); }));
+                return;
+            }
+            appendArrayHeader(out, values_.size());
+            for (optional<string>& value : values_) {
+                if (value) connection.out.appendValue(move(*value));
+                else appendNull(connection.out.tail());
+            }
+        } else if (equalsIgnoreCase(name, "MSET")) {
+            if (!arity(argc >= 3 && argc % 2 == 1)) return;
+            entries_.clear();
+            for (size_t i = 1; i < argc; i += 2) entries_.emplace_back(args[i], args[i + 1]);
+            store_.multiPut(entries_);
+            appendSimple(out, "OK");
+        } else if (equalsIgnoreCase(name, "INCR") || equalsIgnoreCase(name, "DECR") ||
+                   equalsIgnoreCase(name, "INCRBY") || equalsIgnoreCase(name, "DECRBY")) {
+            bool by = name.size() == 6;
+            if (!arity(argc == (by ? 3 : 2))) return;
+            int64_t delta = 1;
+            if (by && !parseInteger(args[2], delta)) {
+                appendError(out, "ERR value is not an integer or out of range");
+                return;
+            }
+            bool down = name[0] == 'D' || name[0] == 'd';
+            optional<int64_t> result = down ? store_.decrement(args[1], delta) : store_.increment(args[1], delta);
+            if (result) appendInteger(out, *result);
+            else appendError(out, "ERR value is not an integer or out of range");
+        } else if (equalsIgnoreCase(name, "APPEND")) {
+            if (!arity(argc == 3)) return;
+            appendInteger(out, static_cast<long long>(store_.append(args[1], args[2])));
+        } else if (equalsIgnoreCase(name, "SETNX")) {
+            if (!arity(argc == 3)) return;
+            appendInteger(out, store_.putIfAbsent(args[1], args[2]) ? 1 : 0);
+        } else if (equalsIgnoreCase(name, "GETSET")) {
+            if (!arity(argc == 3)) return;
+            optional<string> old = store_.getAndSet(args[1], args[2]);
+            if (old) connection.out.appendValue(move(*old));
+            else appendNull(out);
+        } else if (equalsIgnoreCase(name, "CAS")) {
+            if (!arity(argc == 4)) return;
+            appendInteger(out, store_.compareAndSwap(args[1], args[2], args[3]) ? 1 : 0);
+        } else if (equalsIgnoreCase(name, "DBSIZE")) {
+            appendInteger(out, static_cast<long long>(store_.size()));
+        } else if (equalsIgnoreCase(name, "RANK")) {
+            if (!arity(argc == 2)) return;
+            appendInteger(out, static_cast<long long>(store_.rank(args[1])));
+        } else if (equalsIgnoreCase(name, "NTH") || equalsIgnoreCase(name, "DELNTH")) {
+            if (!arity(argc == 2)) return;
+            size_t n = 0;
+            if (!parseSize(args[1], n)) {
+                appendError(out, "ERR value is not an integer or out of range");
+            } else if (equalsIgnoreCase(name, "DELNTH")) {
+                appendInteger(out, store_.del(n) ? 1 : 0);
+            } else if (auto entry = store_.get(n)) {
+                appendArrayHeader(out, 2);
+                appendBulk(out, entry->first);
+                connection.out.appendValue(move(entry->second));
+            } else {
+                appendNullArray(out);
+            }
+        } else if (equalsIgnoreCase(name, "RANGE") || equalsIgnoreCase(name, "PREFIX")) {
+            if (!arity(argc == 3 || argc == 4)) return;
+            size_t count = 0;
+            if (!parseSize(args[2], count) || (argc == 4 && !equalsIgnoreCase(args[3], "REV"))) {
+                appendError(out, "ERR syntax error");
+                return;
+            }
+            ScanDirection direction = argc == 4 ? ScanDirection::Backward : ScanDirection::Forward;
+            KVStore::Cursor cursor = equalsIgnoreCase(name, "RANGE") ? store_.seek(args[1], direction)
+                                                                     : store_.scanPrefix(args[1], direction);
+            cursor.next(pairs_, count);
+            appendArrayHeader(out, pairs_.size() * 2);
+            for (auto& [key, value] : pairs_) {
+                appendBulk(connection.out.tail(), key);
+                connection.out.appendValue(move(value));
+            }
+        } else if (equalsIgnoreCase(name, "PING")) {
+            if (argc > 1) appendBulk(out, args[1]);
+            else appendSimple(out, "PONG");
+        } else if (equalsIgnoreCase(name, "ECHO")) {
+            if (!arity(argc == 2)) return;
+            appendBulk(out, args[1]);
+        } else if (equalsIgnoreCase(name, "QUIT")) {
+            appendSimple(out, "OK");
+            connection.closing = true;
+        } else if (equalsIgnoreCase(name, "SELECT")) {
+            if (argc == 2 && args[1] == "0") appendSimple(out, "OK");
+            else appendError(out, "ERR DB index is out of range");
+        } else if (equalsIgnoreCase(name, "COMMAND") || equalsIgnoreCase(name, "CONFIG")) {
+            // Clients probe these on connect; an empty answer satisfies them.
+            appendArrayHeader(out, 0);
+        } else {
+            string message = "ERR unknown command '";
+            message.append(name.substr(0, 64));
+            appendError(out, message + "'");
+        }
+    }
+
+    KVStore& store_;
+    int epoll_ = -1;
+    int listen_ = -1;
+    int wake_ = -1;
+    atomic<bool> stopping_{false};
+    unordered_map<int, unique_ptr<Connection>> connections_;
+    vector<unique_ptr<Connection>> dead_; // Closed during the current batch
+
+    // Scratch space reused across requests
+    vector<string_view> args_;
+    vector<string_view> gets_;
+    vector<string_view> keys_;
+    vector<optional<string>> values_;
+    vector<pair<string_view, string_view>> entries_;
+    vector<pair<string, string>> pairs_;
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    ServerConfig config;
+    if (!parseArgs(argc, argv, config)) {
+        printUsage();
+        return 2;
+    }
+
+    // Shutdown signals are taken synchronously by main (sigwait below);
+    // blocked before any thread starts, so every thread inherits the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    KVStore store(config.store);
+    vector<unique_ptr<EventLoop>> loops;
+    try {
+        for (size_t i = 0; i < config.threads; ++i) loops.push_back(make_unique<EventLoop>(store, config));
+    } catch (const system_error& error) {
+        cerr << "kv_server: cannot listen on " << config.bind << ":" << config.port << ": "
+             << error.code().message() << "\n";
+        return 1;
+    }
+    vector<thread> threads;
+    for (auto& loop : loops) threads.emplace_back(&EventLoop::run, loop.get());
+    cerr << "kv_server: listening on " << config.bind << ":" << config.port << " with " << config.threads
+         << " event loop(s)\n";
+
+    int received = 0;
+    sigwait(&signals, &received);
+    cerr << "kv_server: shutting down\n";
+    for (auto& loop : loops) loop->stop();
+    for (auto& t : threads) t.join();
+    store.sync();
+    return 0;
+}
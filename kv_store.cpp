@@ -1,58 +1,1131 @@
 #include "kv_store.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <exception>
 #include <mutex>
 #include <shared_mutex>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <thread>
 using namespace std;
 
+namespace {
+
+// Sorts `run` by key, equal keys staying in their given order. Most
+// comparisons settle on eight key bytes cached beside each entry - taken
+// past the prefix all the keys share - instead of chasing into the keys.
+void sortByKey(vector<pair<string_view, string_view>>& run) {
+    if (run.size() < 2) return;
+    size_t shared = run[0].first.size();
+    for (const auto& entry : run) {
+        string_view key = entry.first.substr(0, shared);
+        shared = static_cast<size_t>(mismatch(key.begin(), key.end(), run[0].first.begin()).first - key.begin());
+    }
+
+    struct Keyed {
+        uint64_t prefix; // Big-endian, so it compares like the key bytes
+        size_t index;
+    };
+    vector<Keyed> keyed(run.size());
+    for (size_t i = 0; i < run.size(); ++i) {
+        string_view rest = run[i].first.substr(shared);
+        unsigned char bytes[8] = {};
+        memcpy(bytes, rest.data(), min<size_t>(rest.size(), 8));
+        uint64_t prefix = 0;
+        for (unsigned char byte : bytes) prefix = prefix << 8 | byte;
+        keyed[i] = {prefix, i};
+    }
+    sort(keyed.begin(), keyed.end(), [&](const Keyed& a, const Keyed& b) {
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        int order = run[a.index].first.compare(run[b.index].first);
+        return order != 0 ? order < 0 : a.index < b.index;
+    });
+    vector<pair<string_view, string_view>> sorted;
+    sorted.reserve(run.size());
+    for (const Keyed& k : keyed) sorted.push_back(run[k.index]);
+    run.swap(sorted);
+}
+
+// increment()/decrement() on `current`: the new value, formatted into
+// `buffer` (24 bytes), or nullopt if `current` is not a decimal int64 or
+// the result would overflow. (Subtracting rather than adding the negation
+// keeps INT64_MIN a valid delta.)
+optional<string_view> addDecimal(optional<string_view> current, int64_t delta, bool subtract, char* buffer,
+                                 optional<int64_t>& result) {
+    int64_t number = 0;
+    if (current) {
+        const char* last = current->data() + current->size();
+        auto [ptr, ec] = from_chars(current->data(), last, number);
+        if (current->empty() || ec != errc() || ptr != last) return nullopt;
+    }
+    bool overflow = subtract ? __builtin_sub_overflow(number, delta, &number)
+                             : __builtin_add_overflow(number, delta, &number);
+    if (overflow) return nullopt;
+    result = number;
+    char* end = to_chars(buffer, buffer + 24, number).ptr;
+    return string_view(buffer, static_cast<size_t>(end - buffer));
+}
+
+} // namespace
+
+KVStore::KVStore(StoreOptions options) {
+    size_t count = options.num_shards == 0 ? 1 : options.num_shards;
+    shards_.reserve(count);
+    uint64_t now_tick = nowMillis() / EXPIRY_TICK_MS;
+    if (options.memory_budget > 0) {
+        eviction_ = options.eviction;
+        eviction_samples_ = options.eviction_samples;
+    }
+    hash_index_ = options.hash_index && options.memory_budget == 0;
+    combine_writes_ = options.combine_writes;
+    if (options.value_compression != ValueCompression::None) {
+        codec_ = make_unique<ValueCodec>(options.value_compression);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        shards_.push_back(make_unique<Shard>(now_tick));
+        shards_.back()->trie.setValueCodec(codec_.get());
+        if (eviction_ != EvictionPolicy::None) shards_.back()->trie.setEvictionPolicy(eviction_, eviction_samples_);
+        if (hash_index_) shards_.back()->trie.enableHashIndex();
+    }
+    if (options.memory_budget > 0) shard_budget_ = max<size_t>(1, options.memory_budget / count);
+
+    // The snapshot goes underneath first; the log then replays what
+    // changed after it was written.
+    snapshot_path_ = options.snapshot_path;
+    if (!snapshot_path_.empty()) {
+        base_ = SnapshotFile::open(snapshot_path_);
+        if (base_) layered_.store(true, memory_order_release);
+    }
+    if (!options.wal_path.empty()) {
+        recover(options.wal_path);
+        wal_ = make_unique<WriteAheadLog>(options.wal_path, options.fsync, options.fsync_interval);
+        sync_writes_ = options.sync_writes;
+    }
+    // The log may hold more than the budget allows (or the budget shrank
+    // since); trim now, logged, before anyone reads.
+    if (shard_budget_ > 0) {
+        for (auto& shard : shards_) evictOverBudget(*shard, SIZE_MAX);
+    }
+    if (base_) merger_ = thread(&KVStore::mergeSnapshot, this);
+    // Recovered keys may already have deadlines waiting
+    for (auto& shard : shards_) {
+        if (shard->expiry.size() > 0) {
+            ensureExpiry();
+            break;
+        }
+    }
+}
+
+KVStore::~KVStore() {
+    stop_merge_.store(true, memory_order_relaxed);
+    if (merger_.joinable()) merger_.join();
+    {
+        lock_guard lock(expiry_mutex_);
+        stop_expiry_.store(true, memory_order_relaxed);
+    }
+    expiry_wake_.notify_all();
+    if (expirer_.joinable()) expirer_.join();
+}
+
+uint64_t KVStore::nowMillis() {
+    return static_cast<uint64_t>(
+        chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count());
+}
+
+bool KVStore::applyPut(Shard& shard, string_view key, string_view value, uint64_t expires_at) {
+    uint64_t old_expires_at = 0;
+    bool existed = shard.trie.put(key, value, expires_at, &old_expires_at) && !expired(old_expires_at);
+    if (layered_.load(memory_order_relaxed)) {
+        // The key may only exist in the snapshot so far
+        string k(key);
+        uint64_t base_expires_at = 0;
+        bool in_base = !shard.base_deleted.erase(k) && base_->contains(key, &base_expires_at) &&
+                       !expired(base_expires_at);
+        existed = existed || in_base;
+    }
+    // Round up, so the key's tick never comes before its deadline
+    if (expires_at != 0) shard.expiry.schedule(string(key), (expires_at + EXPIRY_TICK_MS - 1) / EXPIRY_TICK_MS);
+    return existed;
+}
+
+void KVStore::evictOverBudget(Shard& shard, size_t max_keys) {
+    if (shard_budget_ == 0) return;
+    for (size_t n = 0; n < max_keys && shard.trie.memoryUsage() > shard_budget_; ++n) {
+        optional<string> victim = shard.trie.evictionVictim();
+        if (!victim) break;
+        applyDel(shard, *victim);
+        // Logged, or the key would come back on the next restart. Nobody
+        // waits for it to be durable: losing it only brings the key back.
+        logWrite(EventType::DEL, *victim);
+        notify(EventType::EVICT, *victim);
+    }
+}
+
+bool KVStore::applyDel(Shard& shard, string_view key) {
+    uint64_t old_expires_at = 0;
+    bool removed = shard.trie.remove(key, &old_expires_at) && !expired(old_expires_at);
+    if (layered_.load(memory_order_relaxed)) {
+        string k(key);
+        uint64_t base_expires_at = 0;
+        if (!shard.base_deleted.count(k) && base_->contains(key, &base_expires_at)) {
+            shard.base_deleted.insert(move(k));
+            removed = removed || !expired(base_expires_at);
+        }
+    }
+    return removed;
+}
+
+optional<string> KVStore::getLayered(Shard& shard, string_view key) {
+    ReadLock lock(shard.rwlock, metrics_);
+    uint64_t expires_at = 0;
+    optional<string> value = shard.trie.get(key, &expires_at);
+    if (!value && layered_.load(memory_order_relaxed) && !shard.base_deleted.count(string(key))) {
+        value = base_->get(key, &expires_at);
+    }
+    if (value && expired(expires_at)) return nullopt;
+    return value;
+}
+
+void KVStore::mergeSnapshot() {
+    // Walk the snapshot in order, a chunk at a time, and copy each entry
+    // into its shard unless the key was written or deleted since. Shard
+    // locks are held per chunk only, so writers interleave with the merge.
+    constexpr size_t CHUNK = 4096;
+    SnapshotFile::Iterator it = base_->begin();
+    vector<string> keys;
+    vector<string_view> values;
+    vector<uint64_t> deadlines;
+    vector<size_t> order, starts;
+    bool any_deadline = false;
+    while (it.valid() && !stop_merge_.load(memory_order_relaxed)) {
+        keys.clear();
+        values.clear();
+        deadlines.clear();
+        for (; it.valid() && keys.size() < CHUNK; it.next()) {
+            if (expired(it.expiresAt())) continue; // Gone already; never merged
+            keys.emplace_back(it.key());
+            values.push_back(it.value());
+            deadlines.push_back(it.expiresAt());
+            any_deadline = any_deadline || it.expiresAt() != 0;
+        }
+        groupByShard(keys.size(), [&](size_t i) { return string_view(keys[i]); }, order, starts);
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            if (starts[s] == starts[s + 1]) continue;
+            Shard& shard = *shards_[s];
+            WriteLock lock(shard.rwlock, metrics_);
+            for (size_t j = starts[s]; j < starts[s + 1]; ++j) {
+                const string& key = keys[order[j]];
+                if (shard.base_deleted.count(key) || shard.trie.contains(key)) continue;
+                uint64_t expires_at = deadlines[order[j]];
+                shard.trie.put(key, values[order[j]], expires_at);
+                if (expires_at != 0) shard.expiry.schedule(key, (expires_at + EXPIRY_TICK_MS - 1) / EXPIRY_TICK_MS);
+            }
+            evictOverBudget(shard, (starts[s + 1] - starts[s]) * EVICTION_BATCH);
+        }
+    }
+    if (stop_merge_.load(memory_order_relaxed)) return;
+    if (any_deadline) ensureExpiry();
+
+    // Everything is in the tries now. Flip back to lock-free point reads
+    // with every shard locked, so no reader is still inside the snapshot.
+    {
+        vector<WriteLock> locks = lockAllExclusive();
+        layered_.store(false, memory_order_release);
+        for (auto& shard : shards_) unordered_set<string>().swap(shard->base_deleted);
+        base_.reset();
+    }
+    lock_guard lock(merge_mutex_);
+    merge_done_.notify_all();
+}
+
+void KVStore::waitForSnapshotMerge() {
+    if (!layered_.load(memory_order_acquire)) return;
+    unique_lock lock(merge_mutex_);
+    merge_done_.wait(lock, [&] { return !layered_.load(memory_order_acquire); });
+}
+
+void KVStore::saveSnapshot() {
+    if (snapshot_path_.empty()) throw invalid_argument("saveSnapshot: no snapshot_path configured");
+    waitForSnapshotMerge();
+
+    // Shared locks on every shard keep writers - and so log appends - out
+    // for the duration, so the snapshot is one point in time and the log
+    // holds nothing it does not cover when it is emptied.
+    vector<ReadLock> locks = lockAllShared();
+
+    vector<Trie::Iterator> iterators;
+    iterators.reserve(shards_.size());
+    for (auto& shard : shards_) iterators.push_back(shard->trie.begin());
+    auto later = [&](size_t a, size_t b) { return iterators[a].key() > iterators[b].key(); };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heads(later);
+    for (size_t i = 0; i < iterators.size(); ++i) {
+        if (iterators[i].valid()) heads.push(i);
+    }
+
+    SnapshotFile::Writer writer(snapshot_path_);
+    uint64_t now = nowMillis();
+    while (!heads.empty()) {
+        size_t i = heads.top();
+        heads.pop();
+        uint64_t expires_at = iterators[i].expiresAt();
+        if (expires_at == 0 || expires_at > now) writer.add(iterators[i].key(), iterators[i].value(), expires_at);
+        iterators[i].next();
+        if (iterators[i].valid()) heads.push(i);
+    }
+    writer.finish();
+    if (wal_) wal_->reset();
+}
+
+void KVStore::recover(const string& path) {
+    LogContents log = WriteAheadLog::load(path);
+    const vector<LogRecord>& records = log.records;
+    if (records.empty()) return;
+
+    // A key's records all land in one shard, and the grouping is stable,
+    // so replaying each shard's run in order reproduces the final state.
+    // Shards are independent tries, so their runs replay in parallel with
+    // no locking (the store is not shared yet).
+    vector<size_t> order, starts;
+    groupByShard(records.size(), [&](size_t i) { return records[i].key; }, order, starts);
+
+    // Expired keys are not logged when reaped; a PUT whose deadline has
+    // passed replays as the delete it became.
+    uint64_t now = nowMillis();
+    auto replay = [&](size_t first, size_t step) {
+        for (size_t s = first; s < shards_.size(); s += step) {
+            Shard& shard = *shards_[s];
+            for (size_t j = starts[s]; j < starts[s + 1]; ++j) {
+                const LogRecord& record = records[order[j]];
+                if (record.type == EventType::PUT && (record.expires_at == 0 || record.expires_at > now)) {
+                    applyPut(shard, record.key, record.value, record.expires_at);
+                } else {
+                    applyDel(shard, record.key);
+                }
+            }
+        }
+    };
+    size_t workers = min<size_t>(shards_.size(), max(1u, thread::hardware_concurrency()));
+    vector<thread> threads;
+    for (size_t t = 1; t < workers; ++t) threads.emplace_back(replay, t, workers);
+    replay(0, workers);
+    for (auto& t : threads) t.join();
+}
+
+uint64_t KVStore::logWrite(EventType type, string_view key, string_view value, uint64_t expires_at) {
+    if (!wal_) return 0;
+    // Encoding (and checksumming) happens here, outside the log's mutex.
+    thread_local string record;
+    record.clear();
+    WriteAheadLog::encode(record, type, key, value, expires_at);
+    return wal_->append(record);
+}
+
+void KVStore::awaitDurable(uint64_t lsn) {
+    if (sync_writes_ && lsn != 0) wal_->waitDurable(lsn);
+}
+
+void KVStore::sync() {
+    if (wal_) wal_->sync();
+}
+
+size_t KVStore::shardIndex(string_view key) const {
+    return hash<string_view>{}(key) % shards_.size();
+}
+
+KVStore::Shard& KVStore::shardFor(string_view key) {
+    return *shards_[shardIndex(key)];
+}
+
+vector<KVStore::ReadLock> KVStore::lockAllShared() {
+    vector<ReadLock> locks;
+    locks.reserve(shards_.size());
+    for (auto& shard : shards_) locks.emplace_back(shard->rwlock, metrics_);
+    return locks;
+}
+
+vector<KVStore::WriteLock> KVStore::lockAllExclusive() {
+    vector<WriteLock> locks;
+    locks.reserve(shards_.size());
+    for (auto& shard : shards_) locks.emplace_back(shard->rwlock, metrics_);
+    return locks;
+}
+
+template <typename KeyAt>
+void KVStore::groupByShard(size_t count, KeyAt key_at, vector<size_t>& order, vector<size_t>& starts) const {
+    // Counting sort on the shard index: stable, and linear in the batch.
+    vector<size_t> shard_of(count);
+    starts.assign(shards_.size() + 1, 0);
+    for (size_t i = 0; i < count; ++i) {
+        shard_of[i] = shardIndex(key_at(i));
+        starts[shard_of[i] + 1]++;
+    }
+    for (size_t s = 0; s < shards_.size(); ++s) starts[s + 1] += starts[s];
+    vector<size_t> fill(starts.begin(), starts.end() - 1);
+    order.resize(count);
+    for (size_t i = 0; i < count; ++i) order[fill[shard_of[i]]++] = i;
+}
+
 bool KVStore::put(string_view key, string_view value) {
-    // Acquire an exclusive (unique) lock for writing
-    unique_lock lock(mutex_);
-    bool result = trie_.put(key, value);
-    
-    // Notify observers about the PUT event before releasing the lock [RAII]
-    notify(EventType::PUT, key);
+    return putValue(key, value, 0);
+}
+
+bool KVStore::put(string_view key, string_view value, chrono::milliseconds ttl) {
+    // A non-positive TTL gives a key that is expired on arrival
+    uint64_t now = nowMillis();
+    uint64_t expires_at = ttl.count() > 0 ? now + static_cast<uint64_t>(ttl.count()) : now;
+    ensureExpiry();
+    return putValue(key, value, expires_at);
+}
+
+bool KVStore::putValue(string_view key, string_view value, uint64_t expires_at) {
+    OpTimer timer(metrics_, StoreOp::Put);
+    Shard& shard = shardFor(key);
+    if (combine_writes_) {
+        PendingWrite write{key, value, expires_at};
+        if (submitWrite(shard, write)) return write.result;
+    }
+    bool result;
+    uint64_t lsn;
+    {
+        // Acquire an exclusive (unique) lock for writing, on this shard only
+        WriteLock lock(shard.rwlock, metrics_);
+        result = applyPut(shard, key, value, expires_at);
+        lsn = logWrite(EventType::PUT, key, value, expires_at);
+
+        // Queue the event before releasing the lock [RAII], so events for a
+        // key are queued in the order they were applied. Observers run
+        // later, on the dispatcher thread.
+        notify(EventType::PUT, key, value);
+        // After the PUT event: the new key itself may be the victim
+        evictOverBudget(shard, EVICTION_BATCH);
+    }
+    awaitDurable(lsn);
+    return result;
+}
+
+bool KVStore::submitWrite(Shard& shard, PendingWrite& write) {
+    bool applied = shard.combiner.apply(write, [&](vector<PendingWrite*>& batch) { combineWrites(shard, batch); });
+    if (!applied) return false;
+    if (write.error) rethrow_exception(write.error);
+    awaitDurable(write.lsn);
+    return true;
+}
+
+void KVStore::combineWrites(Shard& shard, vector<PendingWrite*>& batch) {
+    // A failure (the log gone bad, memory exhausted) is handed to every
+    // writer in the batch, as each would have got it applying its own write
+    try {
+        // Writes to one key become adjacent, still in batch order
+        stable_sort(batch.begin(), batch.end(),
+                    [](const PendingWrite* a, const PendingWrite* b) { return a->key < b->key; });
+        thread_local string records;
+        records.clear();
+        vector<StoreEvent> events;
+        bool observed = events_.hasObservers();
+        size_t keys = 0;
+        uint64_t lsn = 0;
+        {
+            WriteLock lock(shard.rwlock, metrics_);
+            for (size_t i = 0; i < batch.size(); ++keys) {
+                size_t end = i + 1;
+                while (end < batch.size() && batch[end]->key == batch[i]->key) ++end;
+                // Only the key's last write is applied; each write still gets
+                // the result it would have had applied in turn.
+                const PendingWrite& last = *batch[end - 1];
+                bool existed = last.is_del ? applyDel(shard, last.key)
+                                           : applyPut(shard, last.key, last.value, last.expires_at);
+                bool exists = existed;
+                for (size_t j = i; j < end; ++j) {
+                    batch[j]->result = exists;
+                    exists = !batch[j]->is_del && !expired(batch[j]->expires_at);
+                }
+                if (wal_ && !last.is_del) {
+                    WriteAheadLog::encode(records, EventType::PUT, last.key, last.value, last.expires_at);
+                } else if (wal_ && existed) {
+                    WriteAheadLog::encode(records, EventType::DEL, last.key, string_view());
+                }
+                if (observed) {
+                    events.push_back(StoreEvent{last.is_del ? EventType::DEL : EventType::PUT, string(last.key),
+                                                string(last.is_del ? string_view() : last.value)});
+                }
+                i = end;
+            }
+            if (!records.empty()) lsn = wal_->append(records);
+            if (!events.empty()) notify(move(events));
+            evictOverBudget(shard, keys * EVICTION_BATCH);
+        }
+        for (PendingWrite* write : batch) write->lsn = lsn;
+    } catch (...) {
+        exception_ptr error = current_exception();
+        for (PendingWrite* write : batch) write->error = error;
+    }
+}
+
+template <typename Fn>
+bool KVStore::updateValue(string_view key, Fn&& decide) {
+    OpTimer timer(metrics_, StoreOp::Update);
+    Shard& shard = shardFor(key);
+    string stored;              // What went in, for the log and observers
+    uint64_t expires_at = 0;    // ... and its deadline
+    uint64_t trie_deadline = 0; // The deadline the trie had, scheduled already
+    bool written;
+    uint64_t lsn = 0;
+    {
+        WriteLock lock(shard.rwlock, metrics_);
+        bool layered = layered_.load(memory_order_relaxed);
+        optional<string> base_value;
+        written = shard.trie.update(key, [&](optional<string_view> current, uint64_t& deadline) {
+            trie_deadline = current ? deadline : 0;
+            if (current && expired(deadline)) current.reset();
+            if (!current && layered && !shard.base_deleted.count(string(key))) {
+                // The key may only exist in the snapshot so far
+                base_value = base_->get(key, &deadline);
+                if (base_value && !expired(deadline)) current = *base_value;
+            }
+            if (!current) deadline = 0;
+            optional<string_view> value = decide(current, deadline);
+            if (value) {
+                stored.assign(*value);
+                expires_at = deadline;
+            }
+            return value;
+        });
+        if (written) {
+            if (layered) shard.base_deleted.erase(string(key));
+            if (expires_at != 0 && expires_at != trie_deadline) {
+                shard.expiry.schedule(string(key), (expires_at + EXPIRY_TICK_MS - 1) / EXPIRY_TICK_MS);
+            }
+            lsn = logWrite(EventType::PUT, key, stored, expires_at);
+            notify(EventType::PUT, key, stored);
+            evictOverBudget(shard, EVICTION_BATCH);
+        }
+    }
+    awaitDurable(lsn);
+    return written;
+}
+
+bool KVStore::compareAndSwap(string_view key, string_view expected, string_view desired) {
+    return updateValue(key, [&](optional<string_view> current, uint64_t& expires_at) -> optional<string_view> {
+        if (!current || *current != expected) return nullopt;
+        expires_at = 0;
+        return desired;
+    });
+}
+
+bool KVStore::putIfAbsent(string_view key, string_view value) {
+    return updateValue(key, [&](optional<string_view> current, uint64_t& expires_at) -> optional<string_view> {
+        if (current) return nullopt;
+        expires_at = 0;
+        return value;
+    });
+}
+
+optional<string> KVStore::getAndSet(string_view key, string_view value) {
+    optional<string> old;
+    updateValue(key, [&](optional<string_view> current, uint64_t& expires_at) -> optional<string_view> {
+        if (current) old.emplace(*current);
+        expires_at = 0;
+        return value;
+    });
+    return old;
+}
+
+optional<int64_t> KVStore::increment(string_view key, int64_t delta) {
+    optional<int64_t> result;
+    char buffer[24];
+    updateValue(key, [&](optional<string_view> current, uint64_t&) {
+        return addDecimal(current, delta, false, buffer, result);
+    });
+    return result;
+}
+
+optional<int64_t> KVStore::decrement(string_view key, int64_t delta) {
+    optional<int64_t> result;
+    char buffer[24];
+    updateValue(key, [&](optional<string_view> current, uint64_t&) {
+        return addDecimal(current, delta, true, buffer, result);
+    });
     return result;
 }
 
+size_t KVStore::append(string_view key, string_view suffix) {
+    string value;
+    updateValue(key, [&](optional<string_view> current, uint64_t&) -> optional<string_view> {
+        if (current) value.assign(*current);
+        value.append(suffix);
+        return value;
+    });
+    return value.size();
+}
+
 optional<string> KVStore::get(string_view key) {
-    // Acquire a shared lock for reading, allowing other readers
-    shared_lock lock(mutex_);
-    return trie_.get(key);
+    // No lock: Trie::get validates node versions optimistically and runs
+    // alongside the shard's writer without touching shared cache lines.
+    OpTimer timer(metrics_, StoreOp::Get);
+    Shard& shard = shardFor(key);
+    if (layered_.load(memory_order_acquire)) return getLayered(shard, key);
+    // Lazy expiry: a key past its deadline reads as absent straight away,
+    // whether or not the expiry thread has removed it yet.
+    uint64_t expires_at = 0;
+    optional<string> value = shard.trie.get(key, &expires_at);
+    if (value && expired(expires_at)) return nullopt;
+    return value;
+}
+
+ValueHandle KVStore::getHandle(string_view key) {
+    OpTimer timer(metrics_, StoreOp::Get);
+    Shard& shard = shardFor(key);
+    if (layered_.load(memory_order_acquire)) {
+        // A snapshot-file value is copied; the file is unmapped after the merge
+        optional<string> value = getLayered(shard, key);
+        return value ? ValueHandle(move(*value)) : ValueHandle();
+    }
+    uint64_t expires_at = 0;
+    ValueHandle value = shard.trie.getHandle(key, &expires_at);
+    if (value && expired(expires_at)) return ValueHandle();
+    return value;
 }
 
 bool KVStore::del(string_view key) {
-    unique_lock lock(mutex_);
-    bool result = trie_.remove(key);
+    OpTimer timer(metrics_, StoreOp::Del);
+    Shard& shard = shardFor(key);
+    if (combine_writes_) {
+        PendingWrite write{key, string_view(), 0, true};
+        if (submitWrite(shard, write)) return write.result;
+    }
+    bool result;
+    uint64_t lsn = 0;
+    {
+        WriteLock lock(shard.rwlock, metrics_);
+        result = applyDel(shard, key);
+        if (result) lsn = logWrite(EventType::DEL, key);
 
-    // Notify observers about the DEL event before releasing the lock
-    notify(EventType::DEL, key);
+        // Queue the DEL event before releasing the lock
+        notify(EventType::DEL, key);
+    }
+    awaitDurable(lsn);
     return result;
 }
 
+void KVStore::multiGet(const vector<string_view>& keys, vector<optional<string>>& out) {
+    OpTimer timer(metrics_, StoreOp::MultiGet);
+    out.resize(keys.size());
+    if (layered_.load(memory_order_acquire)) {
+        // The pipelined lookup only knows the tries
+        for (size_t i = 0; i < keys.size(); ++i) out[i] = getLayered(shardFor(keys[i]), keys[i]);
+        return;
+    }
+    vector<size_t> order, starts;
+    groupByShard(keys.size(), [&](size_t i) { return keys[i]; }, order, starts);
+
+    // Reads are lock-free, so a shard's run goes straight into its trie's
+    // pipelined lookup. The caller's optionals are swapped in and back out
+    // so the lookups write into their existing buffers.
+    vector<string_view> run_keys;
+    vector<optional<string>> run_out;
+    vector<uint64_t> run_deadlines;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+        size_t begin = starts[s], end = starts[s + 1];
+        if (begin == end) continue;
+        run_keys.clear();
+        run_out.resize(end - begin);
+        run_deadlines.resize(end - begin);
+        for (size_t j = begin; j < end; ++j) {
+            run_keys.push_back(keys[order[j]]);
+            run_out[j - begin].swap(out[order[j]]);
+        }
+        shards_[s]->trie.multiGet(run_keys.data(), run_keys.size(), run_out.data(), run_deadlines.data());
+        for (size_t j = begin; j < end; ++j) {
+            if (run_out[j - begin] && expired(run_deadlines[j - begin])) run_out[j - begin].reset();
+            run_out[j - begin].swap(out[order[j]]);
+        }
+    }
+}
+
+size_t KVStore::multiPut(const vector<pair<string_view, string_view>>& entries) {
+    OpTimer timer(metrics_, StoreOp::MultiPut);
+    vector<size_t> order, starts;
+    groupByShard(entries.size(), [&](size_t i) { return entries[i].first; }, order, starts);
+
+    size_t overwritten = 0;
+    uint64_t lsn = 0;
+    string records; // The run's log records, appended in one go
+    for (size_t s = 0; s < shards_.size(); ++s) {
+        if (starts[s] == starts[s + 1]) continue;
+        Shard& shard = *shards_[s];
+        records.clear();
+        // One exclusive acquisition for the shard's whole run
+        WriteLock lock(shard.rwlock, metrics_);
+        for (size_t j = starts[s]; j < starts[s + 1]; ++j) {
+            const auto& [key, value] = entries[order[j]];
+            overwritten += applyPut(shard, key, value);
+            if (wal_) WriteAheadLog::encode(records, EventType::PUT, key, value);
+            notify(EventType::PUT, key, value);
+        }
+        if (wal_) lsn = wal_->append(records);
+        evictOverBudget(shard, (starts[s + 1] - starts[s]) * EVICTION_BATCH);
+    }
+    awaitDurable(lsn);
+    return overwritten;
+}
+
+size_t KVStore::bulkLoad(const vector<pair<string_view, string_view>>& entries) {
+    // The old contents must all be in the tries to be replaced
+    waitForSnapshotMerge();
+    vector<size_t> order, starts;
+    groupByShard(entries.size(), [&](size_t i) { return entries[i].first; }, order, starts);
+
+    // Off to the side, in parallel: sort and deduplicate each shard's run,
+    // build its trie, and encode its log records.
+    vector<vector<pair<string_view, string_view>>> runs(shards_.size());
+    vector<unique_ptr<Trie>> built(shards_.size());
+    vector<string> records(shards_.size());
+    auto build = [&](size_t first, size_t step) {
+        for (size_t s = first; s < shards_.size(); s += step) {
+            auto& run = runs[s];
+            run.reserve(starts[s + 1] - starts[s]);
+            for (size_t j = starts[s]; j < starts[s + 1]; ++j) run.push_back(entries[order[j]]);
+            // Of equal keys, the one given last stays last and wins below
+            auto by_key = [](const auto& a, const auto& b) { return a.first < b.first; };
+            if (!is_sorted(run.begin(), run.end(), by_key)) sortByKey(run);
+            size_t kept = 0;
+            for (size_t i = 0; i < run.size(); ++i) {
+                if (i + 1 < run.size() && run[i + 1].first == run[i].first) continue;
+                run[kept++] = run[i];
+            }
+            run.resize(kept);
+
+            built[s] = make_unique<Trie>();
+            built[s]->setValueCodec(codec_.get());
+            if (eviction_ != EvictionPolicy::None) built[s]->setEvictionPolicy(eviction_, eviction_samples_);
+            if (hash_index_) built[s]->enableHashIndex();
+            built[s]->build(run.data(), run.size());
+            if (wal_) {
+                for (const auto& [key, value] : run) WriteAheadLog::encode(records[s], EventType::PUT, key, value);
+            }
+        }
+    };
+    size_t workers = min<size_t>(shards_.size(), max(1u, thread::hardware_concurrency()));
+    vector<thread> threads;
+    for (size_t t = 1; t < workers; ++t) threads.emplace_back(build, t, workers);
+    build(0, workers);
+    for (auto& t : threads) t.join();
+
+    size_t loaded = 0;
+    uint64_t lsn = 0;
+    {
+        vector<WriteLock> locks = lockAllExclusive();
+        string deletes;
+        for (size_t s = 0; s < shards_.size(); ++s) {
+            Shard& shard = *shards_[s];
+            if (wal_ || events_.hasObservers()) {
+                deletes.clear();
+                for (Trie::Iterator it = shard.trie.begin(); it.valid(); it.next()) {
+                    if (wal_) WriteAheadLog::encode(deletes, EventType::DEL, it.key(), string_view());
+                    notify(EventType::DEL, it.key());
+                }
+                for (const auto& [key, value] : runs[s]) notify(EventType::PUT, key, value);
+                if (wal_) {
+                    wal_->append(deletes);
+                    lsn = wal_->append(records[s]);
+                }
+            }
+            shard.trie.replaceWith(*built[s]);
+            shard.expiry = TimingWheel(nowMillis() / EXPIRY_TICK_MS); // Nothing loaded expires
+            loaded += runs[s].size();
+            evictOverBudget(shard, SIZE_MAX);
+        }
+    }
+    awaitDurable(lsn);
+    return loaded;
+}
+
+size_t KVStore::multiDel(const vector<string_view>& keys) {
+    OpTimer timer(metrics_, StoreOp::MultiDel);
+    vector<size_t> order, starts;
+    groupByShard(keys.size(), [&](size_t i) { return keys[i]; }, order, starts);
+
+    size_t deleted = 0;
+    uint64_t lsn = 0;
+    string records;
+    for (size_t s = 0; s < shards_.size(); ++s) {
+        if (starts[s] == starts[s + 1]) continue;
+        Shard& shard = *shards_[s];
+        records.clear();
+        WriteLock lock(shard.rwlock, metrics_);
+        for (size_t j = starts[s]; j < starts[s + 1]; ++j) {
+            string_view key = keys[order[j]];
+            bool removed = applyDel(shard, key);
+            deleted += removed;
+            if (removed && wal_) WriteAheadLog::encode(records, EventType::DEL, key, string_view());
+            notify(EventType::DEL, key);
+        }
+        if (!records.empty()) lsn = wal_->append(records);
+    }
+    awaitDurable(lsn);
+    return deleted;
+}
+
 optional<pair<string, string>> KVStore::get(size_t n) {
-    shared_lock lock(mutex_);
-    return trie_.getNth(n);
+    OpTimer timer(metrics_, StoreOp::GetNth);
+    waitForSnapshotMerge();
+    vector<ReadLock> locks = lockAllShared();
+
+    Shard* owner = nullptr;
+    return selectNth(n, &owner);
 }
 
 bool KVStore::del(size_t n) {
-    unique_lock lock(mutex_);
-    return trie_.removeNth(n);
+    OpTimer timer(metrics_, StoreOp::DelNth);
+    waitForSnapshotMerge();
+    vector<WriteLock> locks = lockAllExclusive();
+
+    Shard* owner = nullptr;
+    auto entry = selectNth(n, &owner);
+    if (!entry) return false;
+    bool result = owner->trie.remove(entry->first);
+    uint64_t lsn = logWrite(EventType::DEL, entry->first);
+    // Queued before the locks go, like del(key)
+    notify(EventType::DEL, entry->first);
+    for (auto& lock : locks) lock.unlock();
+    awaitDurable(lsn);
+    return result;
+}
+
+size_t KVStore::size() {
+    OpTimer timer(metrics_, StoreOp::Size);
+    waitForSnapshotMerge();
+    vector<ReadLock> locks = lockAllShared();
+
+    size_t total = 0;
+    for (auto& shard : shards_) total += shard->trie.size();
+    return total;
+}
+
+size_t KVStore::rank(string_view key) {
+    OpTimer timer(metrics_, StoreOp::Rank);
+    waitForSnapshotMerge();
+    vector<ReadLock> locks = lockAllShared();
+
+    // Every key lives in exactly one shard, so global rank is the sum.
+    size_t total = 0;
+    for (auto& shard : shards_) total += shard->trie.rank(key);
+    return total;
+}
+
+optional<pair<string, string>> KVStore::selectNth(size_t n, Shard** owner) const {
+    vector<const Trie*> tries;
+    tries.reserve(shards_.size());
+    for (auto& shard : shards_) tries.push_back(&shard->trie);
+    size_t index = 0;
+    auto entry = selectAcross(tries, n, &index);
+    *owner = shards_[index].get();
+    return entry;
+}
+
+template <typename Views>
+optional<pair<string, string>> KVStore::selectAcross(const Views& views, size_t n, size_t* owner) {
+    // Each shard keeps a window [lo, hi) of its ranks that may still hold
+    // the answer. Probe the middle of the widest window, rank that key in
+    // every other shard, and cut all windows on the side the answer is not.
+    // This needs O(shards * log(keys)) rank/select calls instead of walking
+    // n keys through a merge.
+    size_t count = views.size();
+    vector<size_t> lo(count, 0), hi(count);
+    size_t total = 0;
+    for (size_t s = 0; s < count; ++s) {
+        hi[s] = views[s]->size();
+        total += hi[s];
+    }
+    if (n >= total) return nullopt;
+
+    vector<size_t> ranks(count);
+    while (true) {
+        size_t widest = 0, open = 0, below = 0;
+        for (size_t s = 0; s < count; ++s) {
+            below += lo[s];
+            if (hi[s] > lo[s]) open++;
+            if (hi[s] - lo[s] > hi[widest] - lo[widest]) widest = s;
+        }
+        if (open == 1) {
+            // Only one shard left: everything below its window is counted
+            *owner = widest;
+            return views[widest]->getNth(lo[widest] + (n - below));
+        }
+
+        size_t mid = lo[widest] + (hi[widest] - lo[widest]) / 2;
+        auto probe = views[widest]->getNth(mid);
+        size_t global_rank = 0;
+        for (size_t s = 0; s < count; ++s) {
+            ranks[s] = s == widest ? mid : views[s]->rank(probe->first);
+            global_rank += ranks[s];
+        }
+
+        if (global_rank == n) {
+            *owner = widest;
+            return probe;
+        }
+        if (global_rank < n) {
+            for (size_t s = 0; s < count; ++s) lo[s] = max(lo[s], ranks[s]);
+            lo[widest] = mid + 1;
+        } else {
+            for (size_t s = 0; s < count; ++s) hi[s] = min(hi[s], ranks[s]);
+        }
+    }
+}
+
+// --- Cursors ---
+
+KVStore::Cursor KVStore::seek(string_view key, ScanDirection direction) {
+    Cursor cursor(this, direction);
+    cursor.position_ = key;
+    cursor.has_position_ = true;
+    return cursor;
+}
+
+KVStore::Cursor KVStore::seekRank(size_t n, ScanDirection direction) {
+    Cursor cursor(this, direction);
+    auto entry = get(n);
+    if (!entry) {
+        cursor.done_ = true;
+        return cursor;
+    }
+    cursor.position_ = move(entry->first);
+    cursor.has_position_ = true;
+    return cursor;
+}
+
+KVStore::Cursor KVStore::scanPrefix(string_view prefix, ScanDirection direction) {
+    Cursor cursor(this, direction);
+    cursor.prefix_ = prefix;
+    if (direction == ScanDirection::Forward) {
+        cursor.position_ = prefix;
+        cursor.has_position_ = true;
+        return cursor;
+    }
+    // Going backward, start just below the smallest key past the prefix:
+    // drop trailing 0xFF bytes and bump the last remaining one.
+    string successor(prefix);
+    while (!successor.empty() && static_cast<uint8_t>(successor.back()) == 0xFF) successor.pop_back();
+    if (!successor.empty()) {
+        successor.back() = static_cast<char>(static_cast<uint8_t>(successor.back()) + 1);
+        cursor.position_ = move(successor);
+        cursor.has_position_ = true;
+        cursor.inclusive_ = false;
+    }
+    return cursor;
+}
+
+bool KVStore::Cursor::next(vector<pair<string, string>>& out, size_t max_items) {
+    return store_->fillBatch(*this, out, max_items);
+}
+
+bool KVStore::fillBatch(Cursor& cursor, vector<pair<string, string>>& out, size_t max_items) {
+    OpTimer timer(metrics_, StoreOp::Scan);
+    out.clear();
+    if (cursor.done_ || max_items == 0) return false;
+    if (cursor.snapshot_) {
+        vector<const Trie::Snapshot*> views;
+        views.reserve(cursor.snapshot_->shards_.size());
+        for (const auto& pinned : cursor.snapshot_->shards_) views.push_back(&pinned);
+        return mergeBatch(cursor, views, out, max_items);
+    }
+    waitForSnapshotMerge();
+
+    vector<ReadLock> locks = lockAllShared();
+    vector<const Trie*> views;
+    views.reserve(shards_.size());
+    for (auto& shard : shards_) views.push_back(&shard->trie);
+    return mergeBatch(cursor, views, out, max_items);
+}
+
+template <typename Views>
+bool KVStore::mergeBatch(Cursor& cursor, const Views& views, vector<pair<string, string>>& out, size_t max_items) {
+    // One iterator per shard, merged through a heap. Only the entries that
+    // make it into this batch are ever copied.
+    bool forward = cursor.direction_ == ScanDirection::Forward;
+    vector<Trie::Iterator> iterators;
+    iterators.reserve(views.size());
+    for (const auto* view : views) {
+        iterators.push_back(cursor.has_position_ ? view->seek(cursor.position_, forward)
+                                                 : view->begin(forward));
+        Trie::Iterator& it = iterators.back();
+        if (!cursor.inclusive_ && it.valid() && it.key() == cursor.position_) it.next();
+    }
+
+    auto later = [&](size_t a, size_t b) {
+        return forward ? iterators[a].key() > iterators[b].key() : iterators[a].key() < iterators[b].key();
+    };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heads(later);
+    for (size_t i = 0; i < iterators.size(); ++i) {
+        if (iterators[i].valid()) heads.push(i);
+    }
+
+    string_view prefix = cursor.prefix_;
+    uint64_t now = nowMillis();
+    while (out.size() < max_items && !heads.empty()) {
+        size_t i = heads.top();
+        heads.pop();
+        string_view key = iterators[i].key();
+        if (key.substr(0, prefix.size()) != prefix) {
+            // Keys are ordered, so the first one outside the prefix ends it
+            cursor.done_ = true;
+            break;
+        }
+        uint64_t expires_at = iterators[i].expiresAt();
+        if (expires_at == 0 || expires_at > now) out.emplace_back(key, iterators[i].value());
+        iterators[i].next();
+        if (iterators[i].valid()) heads.push(i);
+    }
+    if (heads.empty()) cursor.done_ = true;
+
+    if (!out.empty()) {
+        cursor.position_ = out.back().first;
+        cursor.has_position_ = true;
+        cursor.inclusive_ = false;
+    }
+    return !out.empty();
+}
+
+// --- Snapshots ---
+
+KVStore::Snapshot KVStore::snapshot() {
+    // The tries must agree on one instant, so every shard is pinned under
+    // its lock at once. Pinning is O(1), so writers wait only that long.
+    waitForSnapshotMerge();
+    Snapshot snapshot(this);
+    snapshot.shards_.reserve(shards_.size());
+    vector<ReadLock> locks = lockAllShared();
+    for (auto& shard : shards_) snapshot.shards_.push_back(shard->trie.pin());
+    return snapshot;
+}
+
+optional<string> KVStore::Snapshot::get(string_view key) const {
+    uint64_t expires_at = 0;
+    optional<string> value = shards_[store_->shardIndex(key)].get(key, &expires_at);
+    if (value && expired(expires_at)) return nullopt;
+    return value;
+}
+
+void KVStore::Snapshot::multiGet(const vector<string_view>& keys, vector<optional<string>>& out) const {
+    out.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) out[i] = get(keys[i]);
+}
+
+optional<pair<string, string>> KVStore::Snapshot::get(size_t n) const {
+    vector<const Trie::Snapshot*> views;
+    views.reserve(shards_.size());
+    for (const auto& pinned : shards_) views.push_back(&pinned);
+    size_t owner = 0;
+    return selectAcross(views, n, &owner);
+}
+
+size_t KVStore::Snapshot::size() const {
+    size_t total = 0;
+    for (const auto& pinned : shards_) total += pinned.size();
+    return total;
+}
+
+size_t KVStore::Snapshot::rank(string_view key) const {
+    size_t total = 0;
+    for (const auto& pinned : shards_) total += pinned.rank(key);
+    return total;
+}
+
+KVStore::Cursor KVStore::Snapshot::seek(string_view key, ScanDirection direction) const {
+    Cursor cursor = store_->seek(key, direction);
+    cursor.snapshot_ = this;
+    return cursor;
+}
+
+KVStore::Cursor KVStore::Snapshot::seekRank(size_t n, ScanDirection direction) const {
+    Cursor cursor(store_, direction);
+    cursor.snapshot_ = this;
+    auto entry = get(n);
+    if (!entry) {
+        cursor.done_ = true;
+        return cursor;
+    }
+    cursor.position_ = move(entry->first);
+    cursor.has_position_ = true;
+    return cursor;
+}
+
+KVStore::Cursor KVStore::Snapshot::scanPrefix(string_view prefix, ScanDirection direction) const {
+    Cursor cursor = store_->scanPrefix(prefix, direction);
+    cursor.snapshot_ = this;
+    return cursor;
 }
 
-void KVStore::attach(StoreObserver* observer) {
-    // No lock needed here if attach is only called during setup
-    // before multiple threads are running. For a fully dynamic system,
-    // this would also need a unique_lock.
-    observers_.push_back(observer);
+// --- Expiry ---
+
+void KVStore::ensureExpiry() {
+    call_once(expiry_once_, [this] { expirer_ = thread(&KVStore::expireLoop, this); });
+}
+
+void KVStore::expireLoop() {
+    vector<TimingWheel::Entry> due;
+    unique_lock lock(expiry_mutex_);
+    while (!stop_expiry_.load(memory_order_relaxed)) {
+        expiry_wake_.wait_for(lock, chrono::milliseconds(EXPIRY_TICK_MS));
+        if (stop_expiry_.load(memory_order_relaxed)) break;
+        lock.unlock();
+        uint64_t now = nowMillis();
+        for (auto& shard : shards_) reapShard(*shard, now, due);
+        lock.lock();
+    }
 }
 
-void KVStore::notify(EventType type, string_view key) {
-    // This is the polymorphic call.
-    // The code iterates through a vector of `StoreObserver*`, but the objects
-    // can be `ConsoleObserver`, `FileObserver`, or any other future observer type.
-    // `observer->onEvent(...)` calls the correct implementation for each object.
-    for (StoreObserver* observer : observers_) {
-        if (observer) {
-            observer->onEvent(type, key);
+void KVStore::reapShard(Shard& shard, uint64_t now, vector<TimingWheel::Entry>& due) {
+    // The lock is dropped between batches, so a wave of expiries delays
+    // the shard's writers by one short batch at a time, never all of it.
+    bool more = true;
+    while (more && !stop_expiry_.load(memory_order_relaxed)) {
+        due.clear();
+        WriteLock lock(shard.rwlock, metrics_);
+        more = shard.expiry.advance(now / EXPIRY_TICK_MS, due, EXPIRY_BATCH);
+        for (const TimingWheel::Entry& entry : due) {
+            // The wheel keeps stale entries: skip keys deleted or rewritten
+            // (with a later deadline, or none) since this one was filed.
+            uint64_t expires_at = 0;
+            if (!shard.trie.contains(entry.key, &expires_at) || expires_at == 0 || expires_at > now) continue;
+            applyDel(shard, entry.key);
+            notify(EventType::EXPIRE, entry.key);
         }
     }
-}
\ No newline at end of file
+}
+
+StoreStats KVStore::stats() {
+    StoreStats stats;
+    metrics_.collect(stats);
+    for (auto& shard : shards_) {
+        shared_lock lock(shard->rwlock); // Unmetered: not the caller's workload
+        stats.trie += shard->trie.stats();
+    }
+    return stats;
+}
+
+void KVStore::attach(StoreObserver* observer, ObserverOptions options) {
+    events_.attach(observer, options);
+}
+
+bool KVStore::detach(StoreObserver* observer) {
+    return events_.detach(observer);
+}
+
+void KVStore::flushEvents() {
+    events_.flush();
+}
+
+void KVStore::notify(EventType type, string_view key, string_view value) {
+    // Only a copy into each observer's lock-free queue happens here; a slow
+    // observer can no longer stall this shard's writers (unless it asked
+    // for Backpressure::Block and its queue is full).
+    events_.publish(type, key, value);
+}
+
+void KVStore::notify(vector<StoreEvent>&& events) {
+    events_.publish(move(events));
+}
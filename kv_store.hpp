@@ -1,12 +1,25 @@
 #pragma once
 
 #include "trie.hpp"
-#include "store_observer.hpp"
+#include "event_dispatcher.hpp"
+#include "wal.hpp"
+#include "snapshot.hpp"
+#include "metrics.hpp"
+#include "timing_wheel.hpp"
+#include "flat_combiner.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <unordered_set>
+#include <chrono>
 #include <string>
 #include <string_view>
 #include <shared_mutex>
 #include <optional>
-#include <vector> //to hold observers
+#include <vector>
+#include <memory>
+#include <mutex>
 using namespace std;
 
 //string_view:
@@ -18,43 +31,477 @@ using namespace std;
 //Index values are never negative. size_t is unsigned
 //size_t won’t overflow as quickly as int.
 
+// Construction-time settings for a KVStore.
+struct StoreOptions {
+    // Number of independent shards. Each shard owns its own Trie and lock,
+    // so writers to different shards never contend with each other.
+    size_t num_shards = 16;
+
+    // Write-ahead log file. With a path, every write is logged and the log
+    // is replayed on construction; empty means nothing survives a restart.
+    string wal_path;
+    FsyncPolicy fsync = FsyncPolicy::EveryBatch;
+    chrono::milliseconds fsync_interval{10}; // For FsyncPolicy::Interval
+
+    // Whether put/del (and their batch versions) return only once their
+    // records are durable. Otherwise they return as soon as the write is
+    // applied and the log catches up in the background.
+    bool sync_writes = false;
+
+    // Snapshot file. If it exists it is mapped on construction and serves
+    // reads right away while a background thread merges it into memory;
+    // saveSnapshot() writes it. The write-ahead log then only has to hold
+    // what changed since the snapshot.
+    string snapshot_path;
+
+    // Memory budget in bytes for the shard tries (nodes, long labels and
+    // values), 0 for none. Each shard gets an equal share; a write that
+    // pushes its shard past it evicts keys picked by `eviction`. Evictions
+    // are logged like deletes and reported as EventType::EVICT.
+    size_t memory_budget = 0;
+    EvictionPolicy eviction = EvictionPolicy::Lru;
+    size_t eviction_samples = 5; // Keys looked at per victim (Lru, Lfu)
+
+    // Adds a hash index to every shard trie, so point reads (get, getHandle,
+    // multiGet) probe a hash table instead of walking the tree, at the cost
+    // of an entry per key (see Trie::enableHashIndex). Ignored with a
+    // memory budget, whose eviction policies need the tree's access marks.
+    bool hash_index = false;
+
+    // Routes put() and del() through a per-shard flat combiner: writers
+    // publish their writes and one of them applies every pending write of
+    // the shard under a single lock acquisition, with one log append and
+    // one notify for the batch. Writes to the same key within a batch are
+    // merged - only the last is applied, logged and reported to observers.
+    // Pays off when many threads write to few shards (hot keys); a lone
+    // writer only pays for the slot hand-off.
+    bool combine_writes = false;
+
+    // Stores values in compact encodings (see ValueCodec and
+    // Trie::setValueCodec): with Lz, decimal integers of 17 to 20 characters
+    // take 8 bytes and values of ValueCodec::MIN_COMPRESS_BYTES or more
+    // are LZ-compressed when that saves an eighth; Dictionary also trains
+    // a dictionary on the first values written, which is what makes short
+    // records with a common shape (JSON with the same fields) compress.
+    // Reads decode, so they cost more the larger the value.
+    ValueCompression value_compression = ValueCompression::None;
+};
+
+// Direction of an ordered scan.
+enum class ScanDirection { Forward, Backward };
+
 class KVStore {
 public:
-    KVStore() = default;
+    class Snapshot;
+
+    // A position in the global key order, used for paging through ranges.
+    // Between batches it holds no locks and no node pointers - only the last
+    // key it returned - so it stays valid across concurrent writes and sees
+    // them on its next batch. A cursor opened on a Snapshot reads that
+    // snapshot instead, and must not outlive it.
+    class Cursor {
+    public:
+        // Replaces the contents of `out` with up to `max_items` entries that
+        // follow the previous batch. Returns false once nothing is left.
+        bool next(vector<pair<string, string>>& out, size_t max_items);
+
+    private:
+        friend class KVStore;
+        Cursor(KVStore* store, ScanDirection direction) : store_(store), direction_(direction) {}
+
+        KVStore* store_;
+        const Snapshot* snapshot_ = nullptr; // Null: reads the live store
+        ScanDirection direction_;
+        string prefix_;        // Scan stops at the first key outside this prefix
+        string position_;      // Where the next batch starts
+        bool has_position_ = false; // Otherwise start at the first/last key
+        bool inclusive_ = true;     // Whether a key equal to position_ is returned
+        bool done_ = false;
+    };
+
+    // A consistent read-only view of the whole store at one point in time,
+    // with the store's full read API. Creating one pins every shard's trie
+    // (O(1) per shard, whatever the number of keys); reading it takes no
+    // locks, and writers never wait for it. Old versions are reclaimed once
+    // no snapshot holds them. Must not outlive the store.
+    class Snapshot {
+    public:
+        optional<string> get(string_view key) const;
+        void multiGet(const vector<string_view>& keys, vector<optional<string>>& out) const;
+        optional<pair<string, string>> get(size_t n) const;
+        size_t size() const;
+        size_t rank(string_view key) const;
+        Cursor seek(string_view key, ScanDirection direction = ScanDirection::Forward) const;
+        Cursor seekRank(size_t n, ScanDirection direction = ScanDirection::Forward) const;
+        Cursor scanPrefix(string_view prefix, ScanDirection direction = ScanDirection::Forward) const;
+
+    private:
+        friend class KVStore;
+        explicit Snapshot(KVStore* store) : store_(store) {}
+
+        KVStore* store_;
+        vector<Trie::Snapshot> shards_; // Indexed like the store's shards
+    };
+
+    explicit KVStore(StoreOptions options = StoreOptions());
+
+    // Stops a snapshot merge that is still running.
+    ~KVStore();
 
     // Sets a key-value pair. Returns true if an existing key was overwritten.
+    // Clears any TTL the key had.
     bool put(string_view key, string_view value);
 
+    // Sets a key that expires `ttl` from now. Once expired it reads as
+    // absent (get, multiGet, cursors); a background thread then removes it
+    // within about a timing-wheel tick and notifies observers with
+    // EventType::EXPIRE. Until that removal it still counts in size(),
+    // rank() and get(n). Deadlines are wall-clock, so they keep running
+    // across restarts through the log and snapshots.
+    bool put(string_view key, string_view value, chrono::milliseconds ttl);
+
     // Gets a value by its key. Returns an empty optional if not found.
     optional<string> get(string_view key);
+
+    // Gets a value without copying it: the handle points at the stored
+    // bytes and keeps them alive, unchanged, after later writes to the key
+    // (see ValueHandle). Empty if not found. Must not outlive the store.
+    ValueHandle getHandle(string_view key);
+
+    // Calls fn(string_view) on the value of `key` in place, with no copy
+    // and no count taken, and returns whether the key was found. The view
+    // is only valid during the call; fn should be brief and not write to
+    // the store.
+    template <typename Fn>
+    bool get(string_view key, Fn&& fn);
     
     // Deletes a key. Returns true if the key existed and was deleted.
     bool del(string_view key);
 
+    // Atomic read-modify-write. Each reads and writes the key under one
+    // shard lock, in one walk of the shard's trie, so concurrent calls on
+    // a key never lose an update (unlike get() followed by put()). Expired
+    // keys count as absent. A write is logged and reported to observers as
+    // a PUT of the resulting value. increment(), decrement() and append()
+    // keep the key's TTL; the others clear it, like put().
+    //
+    // Sets `key` to `desired` if its value is `expected`. Returns whether it did.
+    bool compareAndSwap(string_view key, string_view expected, string_view desired);
+
+    // Sets `key` only if it is absent. Returns whether it did.
+    bool putIfAbsent(string_view key, string_view value);
+
+    // Sets `key` and returns the value it had, if any.
+    optional<string> getAndSet(string_view key, string_view value);
+
+    // Adds `delta` to the key's value, read as a decimal 64-bit integer (an
+    // absent key counts as 0), and returns the result. Returns nullopt and
+    // leaves the key alone if the value is not such an integer or the
+    // result would overflow.
+    optional<int64_t> increment(string_view key, int64_t delta = 1);
+    optional<int64_t> decrement(string_view key, int64_t delta = 1);
+
+    // Appends `suffix` to the key's value (an absent key counts as empty)
+    // and returns the new length.
+    size_t append(string_view key, string_view suffix);
+
+    // Batch versions of get/put/del. Keys are grouped by shard, so each
+    // shard is visited (and, for writes, locked) once per call.
+    //
+    // multiGet fills `out` position-for-position with `keys`, assigning
+    // into the caller's strings so their buffers get reused.
+    void multiGet(const vector<string_view>& keys, vector<optional<string>>& out);
+
+    // Returns how many of the keys already existed (and were overwritten).
+    size_t multiPut(const vector<pair<string_view, string_view>>& entries);
+
+    // Returns how many of the keys existed and were deleted.
+    size_t multiDel(const vector<string_view>& keys);
+
+    // Replaces the whole contents of the store with `entries` (keys in any
+    // order; of a repeated key the last value wins). Each shard's run is
+    // sorted if it is not already, and its trie is built bottom-up in one
+    // pass - shards in parallel, with no locks held - and then every shard
+    // is switched over under one acquisition of all the locks, so ordered
+    // reads and snapshots see all of the old contents or all of the new.
+    // Loaded keys have no TTL. The log and observers see the old keys
+    // deleted and the new ones put. Returns the number of keys loaded.
+    size_t bulkLoad(const vector<pair<string_view, string_view>>& entries);
+
     // Gets the Nth key-value pair lexicographically.
     optional<pair<string, string>> get(size_t n);
 
     // Deletes the Nth key-value pair lexicographically.
     bool del(size_t n);
 
-    // Attaches an observer to listen for store events.
-    void attach(StoreObserver* observer);
+    // Number of keys in the store.
+    size_t size();
+
+    // Number of keys lexicographically smaller than `key`.
+    size_t rank(string_view key);
+
+    // Cursor at the first key >= `key` (forward) or the last key <= `key`
+    // (backward).
+    Cursor seek(string_view key, ScanDirection direction = ScanDirection::Forward);
+
+    // Cursor at the Nth key lexicographically.
+    Cursor seekRank(size_t n, ScanDirection direction = ScanDirection::Forward);
+
+    // Cursor over the keys starting with `prefix`, from its first key
+    // (forward) or its last key (backward).
+    Cursor scanPrefix(string_view prefix, ScanDirection direction = ScanDirection::Forward);
+
+    // Attaches an observer to listen for store events. Events are delivered
+    // asynchronously, in batches, on a dispatcher thread of its own.
+    void attach(StoreObserver* observer, ObserverOptions options = ObserverOptions());
+
+    // Detaches an observer after delivering the events already published to
+    // it. Afterwards it is never called again and may be destroyed.
+    bool detach(StoreObserver* observer);
+
+    // Waits until every event so far has reached every observer.
+    void flushEvents();
+
+    // Makes every write so far durable, whatever the fsync policy. No-op
+    // without a write-ahead log.
+    void sync();
+
+    // Writes a point-in-time snapshot of the whole store to snapshot_path
+    // and then empties the write-ahead log, which the snapshot now covers.
+    // Writers wait while it runs. Throws invalid_argument without a
+    // snapshot_path, system_error on I/O failure.
+    void saveSnapshot();
+
+    // Blocks until the snapshot opened at construction is fully merged into
+    // memory. Until then point reads and writes work normally, but the
+    // ordered operations (get(n), del(n), size, rank, cursors) wait for the
+    // merge, since they need every key in the shard tries.
+    void waitForSnapshotMerge();
+
+    // Pins the current state of every shard. See Snapshot.
+    Snapshot snapshot();
+
+    size_t shardCount() const { return shards_.size(); }
+
+    // Per-operation latency percentiles, shard lock wait vs hold times
+    // (merged over every thread that used the store) and the tries' node
+    // and memory figures. Locks each shard briefly in turn, so it is not one
+    // atomic cut. Latencies and counters are zero when built without
+    // KV_METRICS; see StoreStats::enabled.
+    StoreStats stats();
 
 private:
-    // Notifies all attached observers of an event.
-    void notify(EventType type, string_view key);
+    // A put() or del() handed to a shard's combiner. Key and value point
+    // into the caller's arguments, which outlive the hand-off; the
+    // combiner fills in the results.
+    struct PendingWrite {
+        string_view key;
+        string_view value;
+        uint64_t expires_at = 0;
+        bool is_del = false;
+        bool result = false; // What put() or del() returns
+        uint64_t lsn = 0;    // To wait for, after the combiner is done
+        exception_ptr error = nullptr; // What applying the batch threw, if it did
+    };
+
+    // One slice of the key space. Aligned to a cache line so the locks of
+    // neighbouring shards do not share (and bounce) the same line.
+    struct alignas(64) Shard {
+        Trie trie;
+
+        // Writers take it exclusively; ordered reads take it shared. Point
+        // reads skip it entirely (see Trie's optimistic lock coupling),
+        // except while a snapshot is layered underneath.
+        mutable shared_mutex rwlock;
+
+        // While layered: keys of the snapshot deleted since it was opened,
+        // so they are not read through to it or merged back in.
+        unordered_set<string> base_deleted;
+
+        // Deadlines of the shard's expiring keys, under `rwlock`.
+        TimingWheel expiry;
+
+        // With StoreOptions::combine_writes, how put() and del() get in.
+        FlatCombiner<PendingWrite> combiner;
+
+        explicit Shard(uint64_t now_tick) : expiry(now_tick) {}
+    };
+
+    // Expiry: wheel resolution, and how much wheel work (keys reaped plus
+    // ticks passed) one exclusive shard lock hold may do.
+    static constexpr uint64_t EXPIRY_TICK_MS = 10;
+    static constexpr size_t EXPIRY_BATCH = 256;
+
+    // Most keys one write may evict, so a write that lands far over budget
+    // (after a large value, say) spreads the catching up over later ones.
+    static constexpr size_t EVICTION_BATCH = 8;
+
+    // Wall-clock milliseconds since the Unix epoch; the unit of deadlines.
+    static uint64_t nowMillis();
+
+    // Whether a deadline (0: none) has passed. Reads the clock only for
+    // keys that have one.
+    static bool expired(uint64_t expires_at) { return expires_at != 0 && expires_at <= nowMillis(); }
+
+    // Shard locks that feed the wait/hold histograms.
+    using ReadLock = MeteredLock<shared_lock<shared_mutex>>;
+    using WriteLock = MeteredLock<unique_lock<shared_mutex>>;
+
+    // Ordered operations span every shard. Locks are always taken in shard
+    // order so two ordered operations can never deadlock each other.
+    vector<ReadLock> lockAllShared();
+    vector<WriteLock> lockAllExclusive();
+
+    // Routes a key to its shard by hash.
+    size_t shardIndex(string_view key) const;
+    Shard& shardFor(string_view key);
+
+    // Orders positions 0..count-1 so that keys of the same shard are
+    // adjacent; `starts[s]` is where shard s's run begins (size shards+1).
+    template <typename KeyAt>
+    void groupByShard(size_t count, KeyAt key_at, vector<size_t>& order, vector<size_t>& starts) const;
+
+    // Finds the globally Nth key by selecting across the shards with their
+    // rank/select operations. Caller must hold every shard lock. Returns the
+    // owning shard.
+    optional<pair<string, string>> selectNth(size_t n, Shard** owner) const;
+
+    // The select algorithm behind selectNth, over any per-shard views with
+    // size/rank/getNth (live tries or pinned snapshots).
+    template <typename Views>
+    static optional<pair<string, string>> selectAcross(const Views& views, size_t n, size_t* owner);
+
+    // Merges per-shard iterators (from live tries or pinned snapshots) into
+    // the cursor's next batch.
+    template <typename Views>
+    static bool mergeBatch(Cursor& cursor, const Views& views, vector<pair<string, string>>& out, size_t max_items);
+
+    // Fills a cursor's next batch by k-way merging per-shard iterators.
+    bool fillBatch(Cursor& cursor, vector<pair<string, string>>& out, size_t max_items);
 
-    Trie trie_;
+    // Replays the write-ahead log at `path` into the shards, one thread per
+    // group of shards.
+    void recover(const string& path);
 
-    // A reader-writer lock for high concurrency on reads
-    mutable shared_mutex mutex_; 
+    // Apply a write to a shard, accounting for the snapshot layer and for
+    // expired values (which count as absent). Caller holds the shard lock
+    // exclusively. A deadline is also filed in the shard's timing wheel.
+    bool applyPut(Shard& shard, string_view key, string_view value, uint64_t expires_at = 0);
+    bool applyDel(Shard& shard, string_view key);
 
-    // A list of pointers to observers. We use base class pointers
-    // to hold any object of a derived observer type (polymorphism).
-    vector<StoreObserver*> observers_;
+    // Evicts up to `max_keys` keys while the shard is over its budget.
+    // Caller holds the shard lock exclusively.
+    void evictOverBudget(Shard& shard, size_t max_keys);
+
+    // Both put() overloads; expires_at is 0 for no TTL.
+    bool putValue(string_view key, string_view value, uint64_t expires_at);
+
+    // With combine_writes: hands `write` to the shard's combiner and waits
+    // for it (and for durability). Returns false if no combiner slot was
+    // free, leaving the write to the caller.
+    bool submitWrite(Shard& shard, PendingWrite& write);
+
+    // Combiner side: applies a batch of writes under one exclusive lock,
+    // only the last write of each key, with one log append and one notify.
+    void combineWrites(Shard& shard, vector<PendingWrite*>& batch);
+
+    // The core of the read-modify-write operations: under the shard lock,
+    // decide(current, expires_at) sees the key's live value (nullopt if it
+    // is absent or expired) and returns the value to store, with
+    // `expires_at` set to its deadline, or nullopt to change nothing.
+    // Returns whether a value was stored. Defined in kv_store.cpp, the
+    // only place it is used.
+    template <typename Fn>
+    bool updateValue(string_view key, Fn&& decide);
+
+    // Starts the expiry thread the first time a deadline exists.
+    void ensureExpiry();
+
+    // Expiry thread body: every tick, reaps each shard's due keys.
+    void expireLoop();
+
+    // Removes the keys of `shard` whose deadline is at or before `now`, in
+    // batches of EXPIRY_BATCH under separate lock holds.
+    void reapShard(Shard& shard, uint64_t now, vector<TimingWheel::Entry>& due);
+
+    // Point read while a snapshot is layered: the trie, then the snapshot
+    // unless the key was deleted. Takes the shard lock shared.
+    optional<string> getLayered(Shard& shard, string_view key);
+
+    // Background thread body: copies the snapshot into the shard tries,
+    // then drops it.
+    void mergeSnapshot();
+
+    // Appends a record to the write-ahead log. Called under the shard lock,
+    // so a key's records are logged in the order they were applied.
+    // Returns the LSN to wait for, or 0 without a log.
+    uint64_t logWrite(EventType type, string_view key, string_view value = string_view(), uint64_t expires_at = 0);
+
+    // With sync_writes, waits for `lsn` to be durable. Called after the
+    // shard lock is released so other writers can join the same fsync.
+    void awaitDurable(uint64_t lsn);
+
+    // Queues an event for all attached observers.
+    void notify(EventType type, string_view key, string_view value = string_view());
+    void notify(vector<StoreEvent>&& events);
+
+    unique_ptr<ValueCodec> codec_; // Null without value_compression; outlives the shards
+    vector<unique_ptr<Shard>> shards_;
+
+    size_t shard_budget_ = 0; // Bytes per shard trie, 0 for unbounded
+    EvictionPolicy eviction_ = EvictionPolicy::None; // As set on every shard trie
+    size_t eviction_samples_ = 0;
+    bool hash_index_ = false; // Also as set on every shard trie
+    bool combine_writes_ = false;
+
+    unique_ptr<WriteAheadLog> wal_; // Null without a wal_path
+    bool sync_writes_ = false;
+
+    string snapshot_path_;
+    // The snapshot being merged, layered under the shard tries. `layered_`
+    // only changes with every shard lock held exclusively, so under any
+    // shard lock it is stable and `base_` is alive while it is set.
+    unique_ptr<SnapshotFile> base_;
+    atomic<bool> layered_{false};
+    atomic<bool> stop_merge_{false};
+    mutex merge_mutex_;
+    condition_variable merge_done_;
+    thread merger_;
+
+    // Observers are held by the dispatcher as StoreObserver* (polymorphism)
+    // and called on its threads, never under a shard lock.
+    EventDispatcher events_;
+
+    // Per-thread latency histograms behind stats().
+    StoreMetrics metrics_;
+
+    // Expiry thread, started by ensureExpiry()
+    once_flag expiry_once_;
+    atomic<bool> stop_expiry_{false};
+    mutex expiry_mutex_;
+    condition_variable expiry_wake_;
+    thread expirer_;
 
 };
 
+template <typename Fn>
+bool KVStore::get(string_view key, Fn&& fn) {
+    OpTimer timer(metrics_, StoreOp::Get);
+    Shard& shard = shardFor(key);
+    if (layered_.load(memory_order_acquire)) {
+        optional<string> value = getLayered(shard, key);
+        if (value) fn(string_view(*value));
+        return value.has_value();
+    }
+    bool found = false;
+    shard.trie.visit(key, [&](string_view value, uint64_t expires_at) {
+        if (expired(expires_at)) return;
+        found = true;
+        fn(value);
+    });
+    return found;
+}
+
 /*
 ==================================================
                 OOPs Concepts
@@ -89,7 +536,7 @@ OOP has 4 major pillars: Abstraction, Encapsulation, Inheritance, and Polymorphi
 - Goal:
     Protect data, enforce controlled access.
 - Example (KVStore):
-    i.   Private section: Trie + shared_mutex.
+    i.   Private section: sharded Tries + shared_mutexes.
     ii.  Only public functions (put/get/del) can touch
          these internals.
     iii. Ensures users cannot bypass locks or corrupt
@@ -10,21 +10,29 @@ using namespace std;
 // --- Concrete Observer Implementations ---
 
 // 1. ConsoleObserver: Prints events to the standard output.
+// It handles one event at a time through the default onEvents().
 class ConsoleObserver : public StoreObserver {
 public:
-    void onEvent(EventType type, string_view key) override {
-        switch (type) {
+    void onEvent(const StoreEvent& event) override {
+        switch (event.type) {
             case EventType::PUT:
-                cout << "[Console] PUT: Key '" << key << "' was added or updated." << endl;
+                cout << "[Console] PUT: Key '" << event.key << "' was set to '" << event.value << "'.\n";
                 break;
             case EventType::DEL:
-                cout << "[Console] DEL: Key '" << key << "' was deleted." << endl;
+                cout << "[Console] DEL: Key '" << event.key << "' was deleted.\n";
+                break;
+            case EventType::EXPIRE:
+                cout << "[Console] EXPIRE: Key '" << event.key << "' expired.\n";
+                break;
+            case EventType::EVICT:
+                cout << "[Console] EVICT: Key '" << event.key << "' was evicted.\n";
                 break;
         }
     }
 };
 
 // 2. FileObserver: Writes events to a log file.
+// It takes whole batches so the file is flushed once per batch, not per event.
 class FileObserver : public StoreObserver {
 public:
     FileObserver(const string& filename) {
@@ -43,17 +51,26 @@ public:
         }
     }
 
-    void onEvent(EventType type, string_view key) override {
+    void onEvents(const vector<StoreEvent>& events) override {
         if (!log_file_.is_open()) return;
 
-        switch (type) {
-            case EventType::PUT:
-                log_file_ << "[File] PUT: Key '" << key << "' was added or updated." << endl;
-                break;
-            case EventType::DEL:
-                log_file_ << "[File] DEL: Key '" << key << "' was deleted." << endl;
-                break;
+        for (const StoreEvent& event : events) {
+            switch (event.type) {
+                case EventType::PUT:
+                    log_file_ << "[File] PUT: Key '" << event.key << "' was set to '" << event.value << "'.\n";
+                    break;
+                case EventType::DEL:
+                    log_file_ << "[File] DEL: Key '" << event.key << "' was deleted.\n";
+                    break;
+                case EventType::EXPIRE:
+                    log_file_ << "[File] EXPIRE: Key '" << event.key << "' expired.\n";
+                    break;
+                case EventType::EVICT:
+                    log_file_ << "[File] EVICT: Key '" << event.key << "' was evicted.\n";
+                    break;
+            }
         }
+        log_file_.flush();
     }
 
 private:
@@ -73,8 +90,10 @@ int main() {
     // Attach the observers to the store.
     // The KVStore holds them as StoreObserver* pointers. It doesn't know
     // their concrete types, only that they fulfill the StoreObserver "contract".
-    store.attach(console_logger);
-    store.attach(file_logger);
+    // The file log must not lose events, so it blocks writers if it ever
+    // falls that far behind; the console is best-effort and drops instead.
+    store.attach(console_logger, ObserverOptions{Backpressure::Drop});
+    store.attach(file_logger, ObserverOptions{Backpressure::Block});
 
     cout << "--- Performing operations ---" << endl;
 
@@ -125,11 +144,34 @@ int main() {
     cout << "All tests passed!\n";
     cout << "--- Operations finished ---" << endl << endl;
 
+    // Observers run on their own threads; let them catch up before printing
+    // the summary, so their output does not interleave with it.
+    store.flushEvents();
+
+    // What the store measured about itself along the way
+    StoreStats stats = store.stats();
+    if (stats.enabled) {
+        for (StoreOp op : {StoreOp::Get, StoreOp::Put, StoreOp::Del}) {
+            const LatencyStats& latency = stats.op(op);
+            cout << storeOpName(op) << ": " << latency.count << " calls, p50 " << latency.p50_ns
+                 << " ns, p99 " << latency.p99_ns << " ns\n";
+        }
+        cout << "Exclusive lock: waited p99 " << stats.exclusive_lock_wait.p99_ns << " ns, held p99 "
+             << stats.exclusive_lock_hold.p99_ns << " ns\n";
+        cout << "Trie: " << stats.trie.nodes << " nodes (" << stats.trie.node_bytes << " bytes), "
+             << stats.trie.splits << " splits\n";
+    }
+    // Arena sizes are tracked even with the counters compiled out
+    cout << "Arenas: " << stats.trie.arena_reserved_bytes << " bytes reserved\n\n";
+
     // --- Cleanup ---
     // It is crucial to delete the objects to prevent memory leaks.
     // Because StoreObserver has a virtual destructor, deleting the
     // base class pointers will correctly call the destructors for
     // ConsoleObserver and FileObserver, allowing FileObserver to close its file.
+    // They are detached first so no dispatcher thread can still call them.
+    store.detach(console_logger);
+    store.detach(file_logger);
     delete console_logger;
     delete file_logger;
     
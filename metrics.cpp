@@ -0,0 +1,170 @@
+#include "metrics.hpp"
+#include <chrono>
+#include <cmath>
+using namespace std;
+
+namespace {
+
+// Where the tick rate is measured from; taken at load time so that by the
+// time anyone asks for stats the calibration window is usually long over.
+struct TickOrigin {
+    uint64_t ticks;
+    chrono::steady_clock::time_point time;
+};
+const TickOrigin origin{readTicks(), chrono::steady_clock::now()};
+
+atomic<uint64_t> next_store_id{1};
+
+#if KV_ENABLE_METRICS
+// Only stats() with metrics compiled in has histograms to summarize
+LatencyStats summarize(const LatencyHistogram& histogram, double scale) {
+    LatencyStats stats;
+    stats.count = histogram.count();
+    if (stats.count == 0) return stats;
+    auto ns = [&](uint64_t ticks) { return static_cast<uint64_t>(llround(static_cast<double>(ticks) * scale)); };
+    stats.mean_ns = histogram.mean() * scale;
+    stats.p50_ns = ns(histogram.percentile(0.50));
+    stats.p90_ns = ns(histogram.percentile(0.90));
+    stats.p99_ns = ns(histogram.percentile(0.99));
+    stats.p999_ns = ns(histogram.percentile(0.999));
+    stats.max_ns = ns(histogram.maximum());
+    return stats;
+}
+#endif
+
+} // namespace
+
+// --- LatencyHistogram ---
+
+LatencyHistogram& LatencyHistogram::operator=(const LatencyHistogram& other) {
+    if (this != &other) {
+        for (auto& c : counts_) c.store(0, memory_order_relaxed);
+        total_.store(0, memory_order_relaxed);
+        sum_.store(0, memory_order_relaxed);
+        max_.store(0, memory_order_relaxed);
+        merge(other);
+    }
+    return *this;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKETS; ++i) bump(counts_[i], other.counts_[i].load(memory_order_relaxed));
+    bump(total_, other.total_.load(memory_order_relaxed));
+    bump(sum_, other.sum_.load(memory_order_relaxed));
+    uint64_t other_max = other.max_.load(memory_order_relaxed);
+    if (other_max > max_.load(memory_order_relaxed)) max_.store(other_max, memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+    // Sum the buckets rather than trusting total_: a concurrent recorder
+    // may have bumped one but not yet the other.
+    uint64_t total = 0;
+    for (const auto& c : counts_) total += c.load(memory_order_relaxed);
+    if (total == 0) return 0;
+    uint64_t target = max<uint64_t>(1, static_cast<uint64_t>(ceil(q * static_cast<double>(total))));
+    uint64_t maximum = max_.load(memory_order_relaxed);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts_[i].load(memory_order_relaxed);
+        if (seen >= target) return min(bucketTop(i), maximum);
+    }
+    return maximum;
+}
+
+double LatencyHistogram::mean() const {
+    uint64_t total = count();
+    return total == 0 ? 0.0 : static_cast<double>(sum_.load(memory_order_relaxed)) / static_cast<double>(total);
+}
+
+uint64_t LatencyHistogram::bucketTop(size_t bucket) {
+    if (bucket < SUB) return bucket;
+    size_t shift = bucket / SUB - 1;
+    uint64_t base = (SUB | (bucket % SUB)) << shift;
+    return base + ((uint64_t(1) << shift) - 1);
+}
+
+// --- Clock ---
+
+double nanosPerTick() {
+#if defined(__x86_64__) || defined(__i386__)
+    constexpr auto MIN_WINDOW = chrono::milliseconds(10);
+    auto elapsed = chrono::steady_clock::now() - origin.time;
+    if (elapsed < MIN_WINDOW) {
+        this_thread::sleep_for(MIN_WINDOW - elapsed);
+    }
+    uint64_t ticks = readTicks();
+    auto now = chrono::steady_clock::now();
+    double ns = static_cast<double>(chrono::duration_cast<chrono::nanoseconds>(now - origin.time).count());
+    return ticks > origin.ticks ? ns / static_cast<double>(ticks - origin.ticks) : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+// --- Names and sums ---
+
+const char* storeOpName(StoreOp op) {
+    static const char* const names[STORE_OP_COUNT] = {"get",      "put",      "del",    "multiGet",
+                                                      "multiPut", "multiDel", "getNth", "delNth",
+                                                      "size",     "rank",     "scan",   "update"};
+    return names[static_cast<size_t>(op)];
+}
+
+TrieStats& TrieStats::operator+=(const TrieStats& other) {
+    nodes += other.nodes;
+    node_bytes += other.node_bytes;
+    key_bytes += other.key_bytes;
+    value_bytes += other.value_bytes;
+    arena_in_use_bytes += other.arena_in_use_bytes;
+    arena_reserved_bytes += other.arena_reserved_bytes;
+    index_bytes += other.index_bytes;
+    integer_values += other.integer_values;
+    compressed_values += other.compressed_values;
+    compression_saved_bytes += other.compression_saved_bytes;
+    nodes_allocated += other.nodes_allocated;
+    splits += other.splits;
+    grows += other.grows;
+    shrinks += other.shrinks;
+    path_copies += other.path_copies;
+    return *this;
+}
+
+// --- StoreMetrics ---
+
+StoreMetrics::StoreMetrics() : id_(next_store_id.fetch_add(1, memory_order_relaxed)) {}
+
+ThreadMetrics& StoreMetrics::slotFor(thread::id thread) {
+    // A thread id is only reused once its thread has exited, so handing
+    // the slot on keeps it single-writer.
+    lock_guard lock(mutex_);
+    auto& slot = slots_[thread];
+    if (!slot) slot = make_unique<ThreadMetrics>();
+    return *slot;
+}
+
+void StoreMetrics::collect(StoreStats& stats) const {
+#if KV_ENABLE_METRICS
+    // Large (tens of KB), so merged on the heap rather than the stack.
+    auto merged = make_unique<ThreadMetrics>();
+    {
+        lock_guard lock(mutex_);
+        for (const auto& [thread, slot] : slots_) {
+            for (size_t i = 0; i < STORE_OP_COUNT; ++i) merged->ops[i].merge(slot->ops[i]);
+            for (size_t m = 0; m < 2; ++m) {
+                merged->lock_wait[m].merge(slot->lock_wait[m]);
+                merged->lock_hold[m].merge(slot->lock_hold[m]);
+            }
+        }
+    }
+    double scale = nanosPerTick();
+    for (size_t i = 0; i < STORE_OP_COUNT; ++i) stats.ops[i] = summarize(merged->ops[i], scale);
+    constexpr size_t SHARED = static_cast<size_t>(LockMode::Shared);
+    constexpr size_t EXCLUSIVE = static_cast<size_t>(LockMode::Exclusive);
+    stats.shared_lock_wait = summarize(merged->lock_wait[SHARED], scale);
+    stats.shared_lock_hold = summarize(merged->lock_hold[SHARED], scale);
+    stats.exclusive_lock_wait = summarize(merged->lock_wait[EXCLUSIVE], scale);
+    stats.exclusive_lock_hold = summarize(merged->lock_hold[EXCLUSIVE], scale);
+#else
+    (void)stats;
+#endif
+}
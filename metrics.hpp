@@ -0,0 +1,266 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+using namespace std;
+
+// Compile-time switch for the store's instrumentation (CMake option
+// KV_METRICS). With 0, timers, metered locks and counters compile to
+// nothing; stats() still works but only reports arena sizes.
+#ifndef KV_ENABLE_METRICS
+#define KV_ENABLE_METRICS 1
+#endif
+
+#if KV_ENABLE_METRICS
+#define KV_METRIC(statement) do { statement; } while (0)
+#else
+#define KV_METRIC(statement) do { } while (0)
+#endif
+
+// Log-linear (HDR-style) histogram: each power of two is split into 32
+// linear steps, so any recorded value is off by at most ~3%, and recording
+// is a few plain stores. Values are unitless (ns, ticks, ...).
+//
+// One thread records at a time; any thread may read or merge it meanwhile
+// and sees a slightly stale but never torn view.
+class LatencyHistogram {
+public:
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram& other) { merge(other); }
+    LatencyHistogram& operator=(const LatencyHistogram& other);
+
+    void record(uint64_t value) {
+        bump(counts_[bucketOf(value)], 1);
+        bump(total_, 1);
+        bump(sum_, value);
+        if (value > max_.load(memory_order_relaxed)) max_.store(value, memory_order_relaxed);
+    }
+
+    // Adds `other`'s samples to this one (which must not be recording).
+    void merge(const LatencyHistogram& other);
+
+    // Upper bound of the bucket holding the q-quantile.
+    uint64_t percentile(double q) const;
+
+    uint64_t count() const { return total_.load(memory_order_relaxed); }
+    uint64_t maximum() const { return max_.load(memory_order_relaxed); }
+    double mean() const;
+
+private:
+    static constexpr int SUB_BITS = 5;
+    static constexpr size_t SUB = size_t(1) << SUB_BITS;
+    static constexpr int MAX_MSB = 43; // Larger values share the top bucket
+    static constexpr size_t BUCKETS = (MAX_MSB - SUB_BITS + 2) * SUB;
+
+    // Single writer: a load and a store, no locked read-modify-write.
+    static void bump(atomic<uint64_t>& counter, uint64_t by) {
+        counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+    }
+
+    static size_t bucketOf(uint64_t v) {
+        if (v < SUB) return static_cast<size_t>(v);
+        int msb = 63 - __builtin_clzll(v);
+        if (msb > MAX_MSB) return BUCKETS - 1;
+        int shift = msb - SUB_BITS;
+        return static_cast<size_t>(shift + 1) * SUB + static_cast<size_t>((v >> shift) & (SUB - 1));
+    }
+
+    static uint64_t bucketTop(size_t bucket);
+
+    array<atomic<uint64_t>, BUCKETS> counts_{};
+    atomic<uint64_t> total_{0};
+    atomic<uint64_t> sum_{0};
+    atomic<uint64_t> max_{0};
+};
+
+// Cheap timestamp for the instrumentation: the TSC on x86, otherwise
+// steady_clock nanoseconds. nanosPerTick() converts; it is calibrated
+// against steady_clock over the life of the process (at least 10 ms, so
+// its first caller may wait that long).
+inline uint64_t readTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+double nanosPerTick();
+
+// The timed KVStore operations.
+enum class StoreOp { Get, Put, Del, MultiGet, MultiPut, MultiDel, GetNth, DelNth, Size, Rank, Scan, Update };
+constexpr size_t STORE_OP_COUNT = 12;
+const char* storeOpName(StoreOp op);
+
+enum class LockMode { Shared, Exclusive };
+
+// Summary of one histogram, in nanoseconds.
+struct LatencyStats {
+    uint64_t count = 0;
+    double mean_ns = 0;
+    uint64_t p50_ns = 0, p90_ns = 0, p99_ns = 0, p999_ns = 0, max_ns = 0;
+};
+
+// Structure and memory of one Trie (or, summed, of every shard). Live
+// figures describe the current tree; node/key/value bytes exclude memory
+// retired but not yet recycled, which the arena figures include.
+struct TrieStats {
+    uint64_t nodes = 0;            // Live nodes, all layouts
+    uint64_t node_bytes = 0;       // Their size, inline labels and values included
+    uint64_t key_bytes = 0;        // Out-of-line edge labels
+    uint64_t value_bytes = 0;      // Out-of-line value blocks
+    uint64_t arena_in_use_bytes = 0;
+    uint64_t arena_reserved_bytes = 0;
+    uint64_t index_bytes = 0;      // Hash index tables and entries, if enabled
+    uint64_t integer_values = 0;   // Values packed as 8-byte integers
+    uint64_t compressed_values = 0;       // Value blocks held compressed
+    uint64_t compression_saved_bytes = 0; // Their raw minus stored size
+
+    // Events since construction
+    uint64_t nodes_allocated = 0;
+    uint64_t splits = 0;      // Prefix splits on insert
+    uint64_t grows = 0;       // Node replaced by the next larger layout
+    uint64_t shrinks = 0;     // ... by the next smaller one
+    uint64_t path_copies = 0; // Nodes copied because a snapshot pinned them
+
+    TrieStats& operator+=(const TrieStats& other);
+};
+
+// Merged view returned by KVStore::stats().
+struct StoreStats {
+    bool enabled = KV_ENABLE_METRICS; // False: built with KV_METRICS=OFF, latencies and counters are zero
+
+    array<LatencyStats, STORE_OP_COUNT> ops; // Indexed by StoreOp
+    const LatencyStats& op(StoreOp which) const { return ops[static_cast<size_t>(which)]; }
+
+    // Shard locks: time spent waiting to acquire them vs holding them.
+    LatencyStats shared_lock_wait, shared_lock_hold;
+    LatencyStats exclusive_lock_wait, exclusive_lock_hold;
+
+    TrieStats trie; // Summed over the shards
+};
+
+// One thread's histograms for one store. Only that thread records into
+// them, so the hot path never shares a cache line with another thread.
+struct ThreadMetrics {
+    array<LatencyHistogram, STORE_OP_COUNT> ops;
+    array<LatencyHistogram, 2> lock_wait; // Indexed by LockMode
+    array<LatencyHistogram, 2> lock_hold;
+};
+
+// Per-store registry of ThreadMetrics. Slots live as long as the store, so
+// stats() can merge the histograms of threads that have since exited.
+class StoreMetrics {
+public:
+    StoreMetrics();
+
+    StoreMetrics(const StoreMetrics&) = delete;
+    StoreMetrics& operator=(const StoreMetrics&) = delete;
+
+    // The calling thread's slot. A one-entry thread-local cache makes this
+    // a compare in the common case; ids are never reused, so the cache
+    // cannot match a later store at the same address.
+    ThreadMetrics& local() {
+        struct Cache {
+            uint64_t owner = 0;
+            ThreadMetrics* slot = nullptr;
+        };
+        thread_local Cache cache;
+        if (cache.owner != id_) {
+            cache.slot = &slotFor(this_thread::get_id());
+            cache.owner = id_;
+        }
+        return *cache.slot;
+    }
+
+    // Fills the latency fields of `stats` with every thread's histograms.
+    void collect(StoreStats& stats) const;
+
+private:
+    ThreadMetrics& slotFor(thread::id thread);
+
+    uint64_t id_;
+    mutable mutex mutex_;
+    unordered_map<thread::id, unique_ptr<ThreadMetrics>> slots_;
+};
+
+#if KV_ENABLE_METRICS
+
+// Times one store operation, from construction to destruction.
+class OpTimer {
+public:
+    OpTimer(StoreMetrics& metrics, StoreOp op) : metrics_(metrics), op_(op), start_(readTicks()) {}
+    ~OpTimer() { metrics_.local().ops[static_cast<size_t>(op_)].record(readTicks() - start_); }
+
+    OpTimer(const OpTimer&) = delete;
+    OpTimer& operator=(const OpTimer&) = delete;
+
+private:
+    StoreMetrics& metrics_;
+    StoreOp op_;
+    uint64_t start_;
+};
+
+// A unique_lock or shared_lock that records how long acquiring it waited
+// and, once released, how long it was held.
+template <typename Lock>
+class MeteredLock : public Lock {
+public:
+    template <typename Mutex>
+    MeteredLock(Mutex& mutex, StoreMetrics& metrics) : Lock(mutex, defer_lock), metrics_(&metrics) {
+        uint64_t start = readTicks();
+        Lock::lock();
+        acquired_ = readTicks();
+        metrics.local().lock_wait[MODE].record(acquired_ - start);
+    }
+
+    MeteredLock(MeteredLock&& other) noexcept
+        : Lock(move(other)), metrics_(other.metrics_), acquired_(other.acquired_) {}
+
+    ~MeteredLock() {
+        if (this->owns_lock()) unlock();
+    }
+
+    void unlock() {
+        uint64_t held = readTicks() - acquired_;
+        Lock::unlock();
+        metrics_->local().lock_hold[MODE].record(held);
+    }
+
+private:
+    static constexpr size_t MODE = static_cast<size_t>(
+        is_same_v<Lock, shared_lock<typename Lock::mutex_type>> ? LockMode::Shared : LockMode::Exclusive);
+
+    StoreMetrics* metrics_;
+    uint64_t acquired_ = 0;
+};
+
+#else
+
+class OpTimer {
+public:
+    OpTimer(StoreMetrics&, StoreOp) {}
+};
+
+template <typename Lock>
+class MeteredLock : public Lock {
+public:
+    template <typename Mutex>
+    MeteredLock(Mutex& mutex, StoreMetrics&) : Lock(mutex) {}
+};
+
+#endif
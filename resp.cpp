@@ -0,0 +1,158 @@
+#include "resp.hpp"
+#include <charconv>
+using namespace std;
+
+namespace {
+
+// Inline commands have no length prefix; a line longer than this without
+// its newline is not a request worth waiting for.
+constexpr size_t MAX_INLINE = 64 * 1024;
+
+// Reads the CRLF-terminated decimal at data[pos...] and moves past it.
+RespStatus readInteger(string_view data, size_t& pos, long long& value) {
+    size_t end = data.find("\r\n", pos);
+    if (end == string_view::npos) {
+        // A 64-bit number and its sign fit in 20 characters
+        return data.size() - pos > 21 ? RespStatus::Error : RespStatus::Incomplete;
+    }
+    const char* first = data.data() + pos;
+    const char* last = data.data() + end;
+    auto [ptr, ec] = from_chars(first, last, value);
+    if (ec != errc() || ptr != last || first == last) return RespStatus::Error;
+    pos = end + 2;
+    return RespStatus::Complete;
+}
+
+RespStatus parseInline(string_view data, vector<string_view>& args, size_t& consumed) {
+    size_t newline = data.find('\n');
+    if (newline == string_view::npos) {
+        return data.size() > MAX_INLINE ? RespStatus::Error : RespStatus::Incomplete;
+    }
+    string_view line = data.substr(0, newline);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+    size_t pos = 0;
+    while (pos < line.size()) {
+        size_t start = line.find_first_not_of(" \t", pos);
+        if (start == string_view::npos) break;
+        size_t end = line.find_first_of(" \t", start);
+        if (end == string_view::npos) end = line.size();
+        args.push_back(line.substr(start, end - start));
+        pos = end;
+    }
+    consumed = newline + 1;
+    return RespStatus::Complete;
+}
+
+RespStatus skipReply(string_view data, size_t& pos, bool* is_error, int depth) {
+    if (pos >= data.size()) return RespStatus::Incomplete;
+    char type = data[pos++];
+    switch (type) {
+        case '+':
+        case '-':
+        case ':': {
+            size_t end = data.find("\r\n", pos);
+            if (end == string_view::npos) return RespStatus::Incomplete;
+            if (type == '-' && depth == 0 && is_error) *is_error = true;
+            pos = end + 2;
+            return RespStatus::Complete;
+        }
+        case '$': {
+            long long length = 0;
+            RespStatus status = readInteger(data, pos, length);
+            if (status != RespStatus::Complete || length < 0) return status;
+            if (data.size() - pos < static_cast<size_t>(length) + 2) return RespStatus::Incomplete;
+            pos += static_cast<size_t>(length) + 2;
+            return RespStatus::Complete;
+        }
+        case '*': {
+            long long count = 0;
+            RespStatus status = readInteger(data, pos, count);
+            for (long long i = 0; status == RespStatus::Complete && i < count; ++i) {
+                status = skipReply(data, pos, is_error, depth + 1);
+            }
+            return status;
+        }
+    }
+    return RespStatus::Error;
+}
+
+void appendNumber(string& out, char type, long long value) {
+    char buffer[24];
+    buffer[0] = type;
+    char* end = to_chars(buffer + 1, buffer + sizeof(buffer) - 2, value).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    out.append(buffer, static_cast<size_t>(end - buffer));
+}
+
+} // namespace
+
+RespStatus parseRequest(string_view data, vector<string_view>& args, size_t& consumed) {
+    args.clear();
+    if (data.empty()) return RespStatus::Incomplete;
+    if (data[0] != '*') return parseInline(data, args, consumed);
+
+    // Re-parsed from the top while incomplete; fine for requests that fit
+    // a few receive buffers, which is nearly all of them.
+    size_t pos = 1;
+    long long count = 0;
+    RespStatus status = readInteger(data, pos, count);
+    if (status != RespStatus::Complete) return status;
+    if (count > static_cast<long long>(RESP_MAX_ARGS)) return RespStatus::Error;
+    for (long long i = 0; i < count; ++i) {
+        if (pos >= data.size()) return RespStatus::Incomplete;
+        if (data[pos++] != '$') return RespStatus::Error;
+        long long length = 0;
+        status = readInteger(data, pos, length);
+        if (status != RespStatus::Complete) return status;
+        if (length < 0 || static_cast<size_t>(length) > RESP_MAX_BULK) return RespStatus::Error;
+        size_t len = static_cast<size_t>(length);
+        if (data.size() - pos < len + 2) return RespStatus::Incomplete;
+        if (data[pos + len] != '\r' || data[pos + len + 1] != '\n') return RespStatus::Error;
+        args.push_back(data.substr(pos, len));
+        pos += len + 2;
+    }
+    consumed = pos;
+    return RespStatus::Complete;
+}
+
+RespStatus parseReply(string_view data, size_t& consumed, bool* is_error) {
+    if (is_error) *is_error = false;
+    size_t pos = 0;
+    RespStatus status = skipReply(data, pos, is_error, 0);
+    if (status == RespStatus::Complete) consumed = pos;
+    return status;
+}
+
+void appendSimple(string& out, string_view text) {
+    out.push_back('+');
+    out.append(text);
+    out.append("\r\n");
+}
+
+void appendError(string& out, string_view message) {
+    out.push_back('-');
+    out.append(message);
+    out.append("\r\n");
+}
+
+void appendInteger(string& out, long long value) { appendNumber(out, ':', value); }
+
+void appendBulk(string& out, string_view value) {
+    appendBulkHeader(out, value.size());
+    out.append(value);
+    out.append("\r\n");
+}
+
+void appendNull(string& out) { out.append("$-1\r\n"); }
+
+void appendNullArray(string& out) { out.append("*-1\r\n"); }
+
+void appendArrayHeader(string& out, size_t count) { appendNumber(out, '*', static_cast<long long>(count)); }
+
+void appendBulkHeader(string& out, size_t length) { appendNumber(out, '$', static_cast<long long>(length)); }
+
+void appendRequest(string& out, const vector<string_view>& args) {
+    appendArrayHeader(out, args.size());
+    for (string_view arg : args) appendBulk(out, arg);
+}
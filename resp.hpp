@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// RESP (the Redis serialization protocol), as much of it as kv_server and
+// kv_loadgen need: parsing requests and replies out of a receive buffer,
+// and appending replies to a send buffer.
+//
+// Requests are arrays of bulk strings (what every client library sends) or
+// inline commands (a space-separated line, as typed into telnet).
+
+enum class RespStatus {
+    Complete,   // One whole message parsed; `consumed` says how long it was
+    Incomplete, // Needs more bytes; nothing was consumed
+    Error,      // Not RESP; the connection cannot be resynchronized
+};
+
+// Parses the request at the start of `data`. The arguments point into
+// `data` itself - no copies - so they stay valid until the caller reuses
+// that part of its buffer. A blank inline line parses with no arguments.
+RespStatus parseRequest(string_view data, vector<string_view>& args, size_t& consumed);
+
+// Skips over the reply at the start of `data` (nested arrays included).
+// `is_error` is set for an error reply ("-...").
+RespStatus parseReply(string_view data, size_t& consumed, bool* is_error = nullptr);
+
+// Reply encoders. Each appends one complete RESP value to `out`.
+void appendSimple(string& out, string_view text);      // +OK
+void appendError(string& out, string_view message);    // -ERR ...
+void appendInteger(string& out, long long value);      // :42
+void appendBulk(string& out, string_view value);       // $5 hello
+void appendNull(string& out);                          // $-1, a missing value
+void appendNullArray(string& out);                     // *-1
+void appendArrayHeader(string& out, size_t count);     // *count, elements follow
+void appendBulkHeader(string& out, size_t length);     // $length, then the bytes and CRLF
+
+// Builds a request in array form, e.g. {"SET", key, value}.
+void appendRequest(string& out, const vector<string_view>& args);
+
+// Largest request accepted (one bulk string or a whole inline line).
+constexpr size_t RESP_MAX_BULK = 512 * 1024 * 1024;
+constexpr size_t RESP_MAX_ARGS = 1024 * 1024;
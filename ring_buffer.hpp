@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+using namespace std;
+
+// Bounded multi-producer / multi-consumer ring buffer (Vyukov's design).
+//
+// Every cell carries a sequence number that says whose turn it is: a
+// producer may fill cell i when its sequence equals the enqueue position,
+// a consumer may empty it when it equals that position + 1. Claiming a
+// position is a single CAS, so producers never wait on each other and a
+// stalled consumer can only make pushes fail, not block them.
+template <typename T>
+class MpmcRing {
+public:
+    // Capacity is rounded up to a power of two.
+    explicit MpmcRing(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        cells_ = make_unique<Cell[]>(size);
+        for (size_t i = 0; i < size; ++i) {
+            cells_[i].sequence.store(i, memory_order_relaxed);
+        }
+        mask_ = size - 1;
+    }
+
+    MpmcRing(const MpmcRing&) = delete;
+    MpmcRing& operator=(const MpmcRing&) = delete;
+
+    // Returns false (leaving `item` untouched) if the ring is full.
+    bool tryPush(T&& item) {
+        size_t pos = enqueue_pos_.load(memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    cell.item = move(item);
+                    cell.sequence.store(pos + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false; // The consumer has not freed this lap's cell yet
+            } else {
+                pos = enqueue_pos_.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Returns false if the ring is empty.
+    bool tryPop(T& item) {
+        size_t pos = dequeue_pos_.load(memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            size_t seq = cell.sequence.load(memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    item = move(cell.item);
+                    cell.sequence.store(pos + mask_ + 1, memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(memory_order_relaxed);
+            }
+        }
+    }
+
+    // Whether the next pop would find nothing. Only a hint while producers
+    // are active.
+    bool empty() const {
+        size_t pos = dequeue_pos_.load(memory_order_acquire);
+        return cells_[pos & mask_].sequence.load(memory_order_acquire) != pos + 1;
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell {
+        atomic<size_t> sequence;
+        T item;
+    };
+
+    unique_ptr<Cell[]> cells_;
+    size_t mask_ = 0;
+    // Producers and consumers each hammer their own index; keep them on
+    // separate cache lines.
+    alignas(64) atomic<size_t> enqueue_pos_{0};
+    alignas(64) atomic<size_t> dequeue_pos_{0};
+};
@@ -0,0 +1,293 @@
+#include "snapshot.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+namespace {
+
+constexpr char MAGIC[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '2'};
+constexpr char MAGIC_V1[8] = {'K', 'V', 'S', 'N', 'A', 'P', '0', '1'}; // No deadlines
+constexpr size_t FOOTER_BYTES = 3 * 8 + sizeof(MAGIC);
+constexpr size_t BLOCK_BYTES = 4096;        // Target size of a data block
+constexpr size_t WRITE_BUFFER = 1 << 20;    // Bytes collected per write()
+
+void putVarint(string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+// Returns false if the varint runs past `end`.
+bool getVarint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+void putU64(string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+uint64_t getU64(const char* in) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+    return v;
+}
+
+// Decodes the entry at `p` on top of `key` (which holds the previous key
+// of the block). Returns false at the end of the block or on a malformed
+// entry.
+bool decodeEntry(const char*& p, const char* end, bool has_deadline, string& key, string_view& value,
+                 uint64_t& expires_at) {
+    uint64_t shared, unshared, value_size;
+    expires_at = 0;
+    if (p >= end || !getVarint(p, end, shared) || !getVarint(p, end, unshared) ||
+        !getVarint(p, end, value_size) || (has_deadline && !getVarint(p, end, expires_at))) {
+        return false;
+    }
+    if (shared > key.size() || unshared > static_cast<uint64_t>(end - p) ||
+        value_size > static_cast<uint64_t>(end - p) - unshared) {
+        return false;
+    }
+    key.resize(shared);
+    key.append(p, unshared);
+    p += unshared;
+    value = string_view(p, value_size);
+    p += value_size;
+    return true;
+}
+
+[[noreturn]] void throwErrno(int error, const char* what) {
+    throw system_error(error, generic_category(), what);
+}
+
+} // namespace
+
+SnapshotFile::Writer::Writer(const string& path) : path_(path), temp_path_(path + ".tmp") {
+    fd_ = ::open(temp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) throwErrno(errno, "create snapshot");
+    buffer_.append(MAGIC, sizeof(MAGIC));
+}
+
+SnapshotFile::Writer::~Writer() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        ::unlink(temp_path_.c_str());
+    }
+}
+
+void SnapshotFile::Writer::add(string_view key, string_view value, uint64_t expires_at) {
+    uint64_t here = offset_ + buffer_.size();
+    size_t shared = 0;
+    if (block_open_ && here - block_start_ < BLOCK_BYTES) {
+        size_t limit = min(key.size(), last_key_.size());
+        while (shared < limit && key[shared] == last_key_[shared]) ++shared;
+    } else {
+        // Start a new block; its first key is stored whole and indexed.
+        block_open_ = true;
+        block_start_ = here;
+        ++blocks_;
+        putU64(index_, here);
+        putVarint(index_, key.size());
+        index_.append(key);
+    }
+    putVarint(buffer_, shared);
+    putVarint(buffer_, key.size() - shared);
+    putVarint(buffer_, value.size());
+    putVarint(buffer_, expires_at);
+    buffer_.append(key.substr(shared));
+    buffer_.append(value);
+    last_key_.assign(key);
+    ++entries_;
+    if (buffer_.size() >= WRITE_BUFFER) flushBuffer();
+}
+
+void SnapshotFile::Writer::flushBuffer() {
+    const char* data = buffer_.data();
+    size_t size = buffer_.size();
+    while (size > 0) {
+        ssize_t n = ::write(fd_, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            throwErrno(errno, "write snapshot");
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    offset_ += buffer_.size();
+    buffer_.clear();
+}
+
+void SnapshotFile::Writer::finish() {
+    uint64_t index_offset = offset_ + buffer_.size();
+    buffer_.append(index_);
+    putU64(buffer_, index_offset);
+    putU64(buffer_, blocks_);
+    putU64(buffer_, entries_);
+    buffer_.append(MAGIC, sizeof(MAGIC));
+    flushBuffer();
+
+    if (::fsync(fd_) != 0) throwErrno(errno, "sync snapshot");
+    ::close(fd_);
+    fd_ = -1;
+    if (::rename(temp_path_.c_str(), path_.c_str()) != 0) {
+        int error = errno;
+        ::unlink(temp_path_.c_str());
+        throwErrno(error, "rename snapshot");
+    }
+
+    // The rename itself must reach the disk too.
+    size_t slash = path_.find_last_of('/');
+    string dir = slash == string::npos ? "." : path_.substr(0, slash == 0 ? 1 : slash);
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+}
+
+unique_ptr<SnapshotFile> SnapshotFile::open(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return nullptr;
+        throwErrno(errno, "open snapshot");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int error = errno;
+        ::close(fd);
+        throwErrno(error, "stat snapshot");
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size < sizeof(MAGIC) + FOOTER_BYTES) {
+        ::close(fd);
+        throw runtime_error("snapshot " + path + " is truncated");
+    }
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    ::close(fd); // The mapping keeps the file alive
+    if (mapping == MAP_FAILED) throwErrno(error, "map snapshot");
+
+    unique_ptr<SnapshotFile> file(new SnapshotFile());
+    file->data_ = static_cast<const char*>(mapping);
+    file->size_ = size;
+
+    const char* footer = file->data_ + size - FOOTER_BYTES;
+    const char* magic = memcmp(file->data_, MAGIC_V1, sizeof(MAGIC_V1)) == 0 ? MAGIC_V1 : MAGIC;
+    if (memcmp(file->data_, magic, sizeof(MAGIC)) != 0 || memcmp(footer + 24, magic, sizeof(MAGIC)) != 0) {
+        throw runtime_error("snapshot " + path + " is not a complete snapshot");
+    }
+    file->has_deadlines_ = magic == MAGIC;
+    file->index_offset_ = getU64(footer);
+    uint64_t blocks = getU64(footer + 8);
+    file->entries_ = getU64(footer + 16);
+    if (file->index_offset_ < sizeof(MAGIC) || file->index_offset_ > size - FOOTER_BYTES) {
+        throw runtime_error("snapshot " + path + " has a corrupt footer");
+    }
+
+    // Only the index is read now; blocks are paged in on demand.
+    const char* p = file->data_ + file->index_offset_;
+    const char* end = footer;
+    // Each entry takes at least its 8-byte offset: a larger count is not
+    // to be trusted with a reservation
+    if (blocks > static_cast<uint64_t>(end - p) / 8) {
+        throw runtime_error("snapshot " + path + " has a corrupt index");
+    }
+    file->block_offsets_.reserve(blocks);
+    file->first_keys_.reserve(blocks);
+    for (uint64_t b = 0; b < blocks; ++b) {
+        uint64_t key_size;
+        if (end - p < 8) throw runtime_error("snapshot " + path + " has a corrupt index");
+        uint64_t offset = getU64(p);
+        p += 8;
+        if (!getVarint(p, end, key_size) || key_size > static_cast<uint64_t>(end - p) ||
+            offset < sizeof(MAGIC) || offset >= file->index_offset_) {
+            throw runtime_error("snapshot " + path + " has a corrupt index");
+        }
+        file->block_offsets_.push_back(offset);
+        file->first_keys_.emplace_back(p, key_size);
+        p += key_size;
+    }
+    return file;
+}
+
+SnapshotFile::~SnapshotFile() {
+    if (data_) ::munmap(const_cast<char*>(data_), size_);
+}
+
+const char* SnapshotFile::blockBegin(size_t b) const {
+    return data_ + block_offsets_[b];
+}
+
+const char* SnapshotFile::blockEnd(size_t b) const {
+    return data_ + (b + 1 < block_offsets_.size() ? block_offsets_[b + 1] : index_offset_);
+}
+
+bool SnapshotFile::find(string_view key, string_view* value, uint64_t* expires_at) const {
+    // The last block whose first key is <= key is the only candidate.
+    auto it = upper_bound(first_keys_.begin(), first_keys_.end(), key);
+    if (it == first_keys_.begin()) return false;
+    size_t b = static_cast<size_t>(it - first_keys_.begin()) - 1;
+
+    thread_local string current;
+    current.clear();
+    const char* p = blockBegin(b);
+    const char* end = blockEnd(b);
+    string_view entry_value;
+    uint64_t entry_expires_at;
+    while (decodeEntry(p, end, has_deadlines_, current, entry_value, entry_expires_at)) {
+        int cmp = string_view(current).compare(key);
+        if (cmp == 0) {
+            if (value) *value = entry_value;
+            if (expires_at) *expires_at = entry_expires_at;
+            return true;
+        }
+        if (cmp > 0) break; // Sorted: it is not here
+    }
+    return false;
+}
+
+optional<string> SnapshotFile::get(string_view key, uint64_t* expires_at) const {
+    string_view value;
+    if (!find(key, &value, expires_at)) return nullopt;
+    return string(value);
+}
+
+bool SnapshotFile::contains(string_view key, uint64_t* expires_at) const {
+    return find(key, nullptr, expires_at);
+}
+
+SnapshotFile::Iterator::Iterator(const SnapshotFile* file) : file_(file) {
+    if (!file->block_offsets_.empty()) {
+        pos_ = file->blockBegin(0);
+        end_ = file->blockEnd(0);
+    }
+    next();
+}
+
+void SnapshotFile::Iterator::next() {
+    while (block_ < file_->block_offsets_.size()) {
+        if (decodeEntry(pos_, end_, file_->has_deadlines_, key_, value_, expires_at_)) {
+            valid_ = true;
+            return;
+        }
+        if (++block_ == file_->block_offsets_.size()) break;
+        pos_ = file_->blockBegin(block_);
+        end_ = file_->blockEnd(block_);
+        key_.clear();
+    }
+    valid_ = false;
+}
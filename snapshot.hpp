@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// Read-only, sorted key-value file that is served straight from an mmap.
+//
+// Layout (integers are little-endian, lengths are varints):
+//   header  "KVSNAP02"
+//   blocks  entries in key order, ~4 KB per block:
+//             varint shared | varint unshared | varint value length |
+//             varint deadline (0: none) | unshared key bytes | value bytes
+//           `shared` is how many leading bytes the key has in common with
+//           the previous key of the block; the first entry of every block
+//           stores its key whole, so a block decodes on its own.
+//   index   per block: u64 offset | varint first-key length | first key
+//   footer  u64 index offset | u64 block count | u64 entry count | "KVSNAP02"
+//
+// Version 1 files ("KVSNAP01", entries without the deadline) still open.
+//
+// Opening maps the file and parses only the block index, so the cost is
+// independent of the number of entries; pages are faulted in by the
+// lookups that touch them. A lookup binary-searches the index and decodes
+// one block.
+class SnapshotFile {
+public:
+    // Streams sorted entries into a new snapshot. The file is written under
+    // a temporary name and renamed over `path` by finish(), so a crash
+    // leaves either the old snapshot or the new one, never half of one.
+    class Writer {
+    public:
+        // Throws system_error if the temporary file cannot be created.
+        explicit Writer(const string& path);
+        // Abandons the file if finish() was not reached.
+        ~Writer();
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        // Keys must arrive in strictly increasing order. `expires_at` is
+        // the key's deadline, 0 for none.
+        void add(string_view key, string_view value, uint64_t expires_at = 0);
+
+        // Writes the index, syncs, and atomically replaces `path`.
+        void finish();
+
+    private:
+        void flushBuffer();
+
+        string path_;
+        string temp_path_;
+        int fd_ = -1;
+        string buffer_;       // Pending bytes not yet written
+        uint64_t offset_ = 0; // File offset of buffer_[0]
+        string index_;
+        uint64_t blocks_ = 0;
+        uint64_t entries_ = 0;
+        uint64_t block_start_ = 0; // File offset where the current block began
+        string last_key_;
+        bool block_open_ = false;
+    };
+
+    // Maps the snapshot at `path`. Returns null if there is no such file;
+    // throws runtime_error if it is not a complete snapshot.
+    static unique_ptr<SnapshotFile> open(const string& path);
+
+    ~SnapshotFile();
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    // Point lookups, decoding at most one block. With `expires_at`, the
+    // entry's deadline is stored there.
+    optional<string> get(string_view key, uint64_t* expires_at = nullptr) const;
+    bool contains(string_view key, uint64_t* expires_at = nullptr) const;
+
+    // Number of entries.
+    size_t size() const { return entries_; }
+
+    // Forward iterator over all entries in key order. Values point into the
+    // mapping and stay valid as long as the SnapshotFile does.
+    class Iterator {
+    public:
+        bool valid() const { return valid_; }
+        string_view key() const { return key_; }
+        string_view value() const { return value_; }
+        uint64_t expiresAt() const { return expires_at_; }
+        void next();
+
+    private:
+        friend class SnapshotFile;
+        explicit Iterator(const SnapshotFile* file);
+
+        const SnapshotFile* file_;
+        size_t block_ = 0;
+        const char* pos_ = nullptr;  // Next entry in the current block
+        const char* end_ = nullptr;  // End of the current block
+        string key_;
+        string_view value_;
+        uint64_t expires_at_ = 0;
+        bool valid_ = false;
+    };
+
+    Iterator begin() const { return Iterator(this); }
+
+private:
+    SnapshotFile() = default;
+
+    // Finds `key` in the one block that may hold it.
+    bool find(string_view key, string_view* value, uint64_t* expires_at) const;
+
+    // Bounds of block `b` in the mapping.
+    const char* blockBegin(size_t b) const;
+    const char* blockEnd(size_t b) const;
+
+    const char* data_ = nullptr; // The whole file, mapped read-only
+    size_t size_ = 0;
+    size_t entries_ = 0;
+    size_t index_offset_ = 0;
+    bool has_deadlines_ = true; // False for version 1 files
+    vector<uint64_t> block_offsets_;
+    vector<string_view> first_keys_; // Point into the mapping
+};
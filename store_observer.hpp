@@ -1,17 +1,58 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
 #include <string_view>
+#include <vector>
 
 // An enum to represent the type of event that occurred in the store.
-enum class EventType { PUT, DEL };
+// EXPIRE is a key removed because its TTL ran out; EVICT is one dropped to
+// keep the store within its memory budget.
+enum class EventType { PUT, DEL, EXPIRE, EVICT };
+
+// One change to the store, as delivered to observers. Events are copied out
+// of the write path, so they own their key and value.
+struct StoreEvent {
+    EventType type;
+    std::string key;
+    std::string value; // The new value for PUT; empty for DEL and EXPIRE
+};
+
+// What happens when an observer falls behind and its queue fills up.
+enum class Backpressure {
+    Block,    // Writers wait for room: nothing is lost, but a slow observer slows writes
+    Drop,     // New events are discarded and reported through onDropped()
+    Coalesce, // Overflow keeps only the latest event per key
+};
+
+// Per-observer delivery settings, chosen when the observer is attached.
+struct ObserverOptions {
+    Backpressure backpressure = Backpressure::Block;
+    std::size_t queue_capacity = 4096; // Events buffered before backpressure applies
+    std::size_t max_batch = 256;       // Most events handed to one onEvents() call
+};
 
 // Abstract base class for all store observers.
-// This defines the interface that all concrete observers MUST implement.
+//
+// Observers are called on a background dispatcher thread, never while the
+// store holds a lock, and never concurrently with themselves. Events for
+// the same key arrive in the order they were applied.
 class StoreObserver {
 public:
-    // The pure virtual function that concrete classes must override.
-    // It's called when an event occurs in the KVStore.
-    virtual void onEvent(EventType type, std::string_view key) = 0;
+    // Receives a batch of events in order. The default forwards each one to
+    // onEvent(); override this instead to handle a whole batch at once
+    // (e.g. with a single flush).
+    virtual void onEvents(const std::vector<StoreEvent>& events) {
+        for (const StoreEvent& event : events) {
+            onEvent(event);
+        }
+    }
+
+    // Receives a single event.
+    virtual void onEvent(const StoreEvent& event) { (void)event; }
+
+    // Called when the Drop policy has discarded events since the last call.
+    virtual void onDropped(std::size_t count) { (void)count; }
 
     // A virtual destructor is CRITICAL for base classes in a polymorphic hierarchy.
     // When a derived class object is deleted through a base class pointer,
@@ -25,21 +66,20 @@ public:
 
     1. Abstract Class (StoreObserver):
        - StoreObserver acts like an "interface".
-       - It has no implementation of its own (onEvent is a pure virtual function).
-       - It defines a strict contract: any class that inherits from StoreObserver
-         must provide an implementation for onEvent().
+       - Its callbacks have do-nothing defaults, so a concrete observer
+         overrides just the ones it cares about (onEvent or onEvents).
 
     2. Inheritance (ConsoleObserver, FileObserver):
        - ConsoleObserver and FileObserver inherit from StoreObserver.
-       - They fulfill the contract by providing their own implementation of onEvent():
+       - They fulfill the contract by providing their own implementation of onEvents():
            * ConsoleObserver -> prints to the console.
            * FileObserver    -> writes to a file.
 
-    3. Polymorphism (in KVStore::notify):
-       - KVStore stores a list of StoreObserver* (vector<StoreObserver*>).
-       - When notify() is called, it loops through the observers and calls:
-            observer->onEvent(...)
-       - The C++ runtime decides which actual onEvent() to invoke
+    3. Polymorphism (in EventDispatcher):
+       - The dispatcher holds each attached observer as a StoreObserver*.
+       - When a batch of events is ready, it calls:
+            observer->onEvents(...)
+       - The C++ runtime decides which actual onEvents() to invoke
          based on the true type of the object (ConsoleObserver or FileObserver).
        - This avoids using if/else type-checking, keeping KVStore simple.
 
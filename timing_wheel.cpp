@@ -0,0 +1,77 @@
+#include "timing_wheel.hpp"
+#include <utility>
+using namespace std;
+
+void TimingWheel::schedule(string key, uint64_t tick) {
+    size_++;
+    Entry entry{move(key), tick};
+    if (tick > current_) {
+        place(move(entry));
+        return;
+    }
+    // Already due: hand it out on the next advance()
+    if (pending_.empty()) pending_.emplace_back();
+    pending_.back().push_back(move(entry));
+}
+
+void TimingWheel::place(Entry&& entry) {
+    // The lowest level whose span covers the distance. Slots are indexed by
+    // the deadline's own bits, so the slot is reached (and cascaded) at the
+    // start of the deadline's block on that level - after current_, and
+    // less than one rotation away.
+    uint64_t delta = entry.tick - current_;
+    for (int level = 0; level < LEVELS; ++level) {
+        if (delta < (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+            size_t slot = static_cast<size_t>(entry.tick >> (SLOT_BITS * level)) & (SLOTS - 1);
+            slots_[level][slot].push_back(move(entry));
+            return;
+        }
+    }
+    overflow_.push_back(move(entry));
+}
+
+bool TimingWheel::advance(uint64_t now_tick, vector<Entry>& due, size_t budget) {
+    auto take = [&](vector<Entry>& slot) {
+        if (slot.empty()) return;
+        pending_.emplace_back();
+        pending_.back().swap(slot);
+    };
+
+    while (budget > 0) {
+        if (!pending_.empty()) {
+            // Finish the current tick before moving on: each taken entry is
+            // either due or re-filed closer to its deadline.
+            vector<Entry>& batch = pending_.back();
+            if (batch.empty()) {
+                pending_.pop_back();
+                continue;
+            }
+            Entry entry = move(batch.back());
+            batch.pop_back();
+            budget--;
+            if (entry.tick <= current_) {
+                size_--;
+                due.push_back(move(entry));
+            } else {
+                place(move(entry));
+            }
+            continue;
+        }
+        if (current_ >= now_tick) return false;
+        if (size_ == 0) {
+            current_ = now_tick; // Nothing to cascade on the way
+            return false;
+        }
+
+        ++current_;
+        budget--;
+        constexpr uint64_t TOP_SPAN = uint64_t(1) << (SLOT_BITS * LEVELS);
+        if ((current_ & (TOP_SPAN - 1)) == 0) take(overflow_);
+        for (int level = LEVELS - 1; level >= 1; --level) {
+            uint64_t span = uint64_t(1) << (SLOT_BITS * level);
+            if ((current_ & (span - 1)) == 0) take(slots_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+        }
+        take(slots_[0][current_ & (SLOTS - 1)]);
+    }
+    return !pending_.empty() || (size_ > 0 && current_ < now_tick);
+}
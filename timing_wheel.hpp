@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Hierarchical timing wheel of key deadlines, in abstract ticks.
+//
+// Four levels of 64 slots: level 0 holds deadlines less than 64 ticks away,
+// one slot per tick; each level above covers 64 times the span of the one
+// below, and its slots are cascaded down when the wheel reaches them.
+// Deadlines beyond the top level wait in an overflow list. Scheduling is
+// O(1); advancing is O(1) amortized per entry (each cascades at most once
+// per level).
+//
+// advance() does a bounded amount of work per call and resumes where it
+// left off, so a caller holding a lock can drain a huge expiry wave in
+// short steps. Entries are never removed early: the caller checks each due
+// entry against the key's current deadline and ignores stale ones.
+//
+// Not thread-safe; KVStore guards each shard's wheel with the shard lock.
+class TimingWheel {
+public:
+    struct Entry {
+        string key;
+        uint64_t tick; // Due once the wheel reaches this tick
+    };
+
+    explicit TimingWheel(uint64_t now_tick) : current_(now_tick) {}
+
+    void schedule(string key, uint64_t tick);
+
+    // Moves entries due at or before `now_tick` into `due`, doing at most
+    // `budget` units of work (one per entry touched or tick passed).
+    // Returns true if it stopped on the budget with more to do.
+    bool advance(uint64_t now_tick, vector<Entry>& due, size_t budget);
+
+    // Entries waiting, stale ones included.
+    size_t size() const { return size_; }
+
+private:
+    static constexpr int LEVELS = 4;
+    static constexpr int SLOT_BITS = 6;
+    static constexpr size_t SLOTS = size_t(1) << SLOT_BITS;
+
+    // Files an entry relative to current_ (which it must be after).
+    void place(Entry&& entry);
+
+    array<array<vector<Entry>, SLOTS>, LEVELS> slots_;
+    vector<Entry> overflow_;
+    // Slots taken out at the current tick and not yet re-filed
+    vector<vector<Entry>> pending_;
+    uint64_t current_; // Every tick up to here has been taken out
+    size_t size_ = 0;
+};
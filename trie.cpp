@@ -1,10 +1,106 @@
 #include "trie.hpp"
+#include "epoch.hpp"
 #include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <new>
+#include <thread>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 using namespace std;
 
-Trie::Trie() : root_(make_unique<TrieNode>("")) {}
+namespace {
 
-size_t Trie::findMismatch(string_view s1, string_view s2) const {
+// LFU marks: a logarithmic access counter in the low byte, and in the high
+// byte the decay period it was last brought up to date in.
+constexpr uint32_t LFU_INIT = 5;          // Where a new key starts, so it is not evicted first
+constexpr uint32_t LFU_LOG_FACTOR = 10;   // Larger: slower climb towards 255
+constexpr uint32_t LFU_DECAY_TICKS = 256; // Access clock ticks per decrement
+
+uint32_t lfuCount(uint16_t mark, uint32_t clock) {
+    uint32_t elapsed = (clock / LFU_DECAY_TICKS - (mark >> 8)) & 0xff;
+    uint32_t count = mark & 0xff;
+    return count > elapsed ? count - elapsed : 0;
+}
+
+// A decimal integer spelled the one way to_chars would spell it (so it
+// reads back byte for byte) that fits in an int64.
+bool packInteger(string_view value, char* packed) {
+    if (value.empty() || value[0] == '+' || value.size() > 20) return false;
+    size_t digits = value[0] == '-' ? 1 : 0;
+    if (value.size() > digits + 1 && value[digits] == '0') return false;
+    if (value == "-0") return false;
+    int64_t n;
+    auto [end, error] = from_chars(value.data(), value.data() + value.size(), n);
+    if (error != errc() || end != value.data() + value.size()) return false;
+    memcpy(packed, &n, sizeof(n));
+    return true;
+}
+
+// Writes a packed integer's decimal spelling (at most 20 bytes) over
+// `out`, which may be where it is packed; returns its length.
+size_t spellInteger(const char* packed, char* out) {
+    int64_t n;
+    memcpy(&n, packed, sizeof(n));
+    return static_cast<size_t>(to_chars(out, out + 20, n).ptr - out);
+}
+
+uint64_t xorshift(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+} // namespace
+
+ValueHandle::ValueHandle(ValueHandle&& other) noexcept
+    : holds_(other.holds_), view_(other.view_), owned_(move(other.owned_)), has_value_(other.has_value_) {
+    other.holds_ = nullptr;
+    other.has_value_ = false;
+}
+
+ValueHandle& ValueHandle::operator=(ValueHandle&& other) noexcept {
+    if (this != &other) {
+        release();
+        holds_ = other.holds_;
+        view_ = other.view_;
+        owned_ = move(other.owned_);
+        has_value_ = other.has_value_;
+        other.holds_ = nullptr;
+        other.has_value_ = false;
+    }
+    return *this;
+}
+
+void ValueHandle::release() {
+    // Release: the writer that recycles the block must see our reads done.
+    if (holds_) holds_->fetch_sub(1, memory_order_release);
+    holds_ = nullptr;
+}
+
+Trie::Node48::Node48() : Node(NodeType::Node48) {
+    memset(child_index, EMPTY, sizeof(child_index));
+}
+
+Trie::Trie() {
+    static_assert(sizeof(Node0) == 64, "a leaf is meant to fill one cache line");
+    // In the body: newNode reads generation_ and counters_, declared later.
+    root_.store(newNode(NodeType::Node0, ""), memory_order_relaxed);
+}
+
+size_t Trie::size() const { return root_.load(memory_order_acquire)->descendants; }
+
+TrieStats Trie::stats() const {
+    TrieStats stats = counters_;
+    stats.arena_in_use_bytes = node_arena_.bytesInUse() + value_arena_.bytesInUse();
+    stats.arena_reserved_bytes = node_arena_.bytesReserved() + value_arena_.bytesReserved();
+    stats.index_bytes = index_.memoryUsage();
+    return stats;
+}
+
+size_t Trie::findMismatch(string_view s1, string_view s2) {
     size_t len = min(s1.length(), s2.length());
     for (size_t i = 0; i < len; ++i) {
         if (s1[i] != s2[i]) {
@@ -14,91 +110,1526 @@ size_t Trie::findMismatch(string_view s1, string_view s2) const {
     return len;
 }
 
-bool Trie::put(string_view key, string_view value) {
-    TrieNode* current = root_.get();
-    size_t key_pos = 0;
+// --- Node memory management ---
+
+size_t Trie::nodeSize(NodeType type) {
+    switch (type) {
+        case NodeType::Node0:   return sizeof(Node0);
+        case NodeType::Node4:   return sizeof(Node4);
+        case NodeType::Node16:  return sizeof(Node16);
+        case NodeType::Node48:  return sizeof(Node48);
+        case NodeType::Node256: return sizeof(Node256);
+    }
+    return 0;
+}
+
+Trie::Node* Trie::newNode(NodeType type, string_view prefix) {
+    void* memory = node_arena_.allocate(nodeSize(type));
+    Node* node = nullptr;
+    switch (type) {
+        case NodeType::Node0:   node = new (memory) Node0(); break;
+        case NodeType::Node4:   node = new (memory) Node4(); break;
+        case NodeType::Node16:  node = new (memory) Node16(); break;
+        case NodeType::Node48:  node = new (memory) Node48(); break;
+        case NodeType::Node256: node = new (memory) Node256(); break;
+    }
+    node->prefix_len = static_cast<uint32_t>(prefix.size());
+    node->birth = generation_.load(memory_order_relaxed);
+    if (prefix.size() <= INLINE_BYTES) {
+        memcpy(node->inline_prefix, prefix.data(), prefix.size());
+    } else {
+        char* label = static_cast<char*>(node_arena_.allocate(prefix.size()));
+        memcpy(label, prefix.data(), prefix.size());
+        node->heap_prefix = label;
+        bytes_ += prefix.size();
+        KV_METRIC(counters_.key_bytes += prefix.size());
+    }
+    bytes_ += nodeSize(type);
+    KV_METRIC(counters_.nodes++; counters_.nodes_allocated++; counters_.node_bytes += nodeSize(type));
+    return node;
+}
+
+Trie::Node* Trie::makeLeaf(string_view prefix, const ValueData& data) {
+    Node* leaf = newNode(NodeType::Node0, prefix);
+    installValue(leaf, data);
+    touch(leaf);
+    leaf->descendants = 1;
+    return leaf;
+}
+
+void Trie::retireNode(Node* node) {
+    // The value is not owned here: replaced nodes hand it to their copy.
+    // Nodes are trivially destructible, so the memory just goes back.
+    if (node->prefix_len > INLINE_BYTES) {
+        retireShared(node_arena_, const_cast<char*>(node->heap_prefix), node->prefix_len, node->birth);
+        bytes_ -= node->prefix_len;
+        KV_METRIC(counters_.key_bytes -= node->prefix_len);
+    }
+    retireShared(node_arena_, node, nodeSize(node->type), node->birth);
+    bytes_ -= nodeSize(node->type);
+    KV_METRIC(counters_.nodes--; counters_.node_bytes -= nodeSize(node->type));
+}
+
+void Trie::retireTree(Node* node) {
+    forEachChild(node, [&](uint8_t, Node* child) { retireTree(child); });
+    retireValue(node->value_kind, node->value_kind == ValueKind::Heap ? node->heap_value : nullptr);
+    retireNode(node);
+}
+
+Trie::ValueData Trie::prepareValue(string_view value, uint64_t expires_at) {
+    ValueData data;
+    data.len = static_cast<uint32_t>(value.size());
+    if (value.size() <= INLINE_BYTES && expires_at == 0) {
+        data.kind = ValueKind::Inline;
+        memcpy(data.inline_bytes, value.data(), value.size());
+    } else if (codec_ && expires_at == 0 && packInteger(value, data.inline_bytes)) {
+        data.kind = ValueKind::Integer;
+        data.len = sizeof(int64_t);
+        KV_METRIC(counters_.integer_values++);
+    } else {
+        // Stored compressed if the codec finds that worthwhile
+        bool with_dictionary = false;
+        bool compressed = codec_ && codec_->compress(value, pack_buffer_, with_dictionary);
+        string_view stored = compressed ? string_view(pack_buffer_) : value;
+        data.kind = ValueKind::Heap;
+        data.block = new (value_arena_.allocate(sizeof(ValueBlock) + stored.size())) ValueBlock();
+        data.block->size = static_cast<uint32_t>(stored.size());
+        data.block->birth = generation_.load(memory_order_relaxed);
+        data.block->expires_at = expires_at;
+        if (compressed) data.block->raw_size = data.len | (with_dictionary ? ValueBlock::WITH_DICTIONARY : 0);
+        memcpy(data.block->data(), stored.data(), stored.size());
+        bytes_ += sizeof(ValueBlock) + stored.size();
+        KV_METRIC(counters_.value_bytes += sizeof(ValueBlock) + stored.size());
+        if (compressed) {
+            KV_METRIC(counters_.compressed_values++; counters_.compression_saved_bytes += value.size() - stored.size());
+        }
+    }
+    return data;
+}
+
+void Trie::installValue(Node* node, const ValueData& data) {
+    node->value_kind = data.kind;
+    if (data.kind == ValueKind::Heap) {
+        node->heap_value = data.block;
+    } else {
+        memcpy(node->inline_value, data.inline_bytes, data.len);
+        node->value_len = static_cast<uint16_t>(data.len);
+    }
+}
 
-    while (key_pos < key.length()) {
-        int index = key[key_pos] - 'A';
-        if (!current->children[index]) {
-            // No child starting with this character, create a new one
-            current->children[index] = make_unique<TrieNode>(key.substr(key_pos));
-            current->children[index]->value = value;
-            current->descendants++;
-            return false; // New key inserted
+void Trie::retireValue(ValueKind kind, ValueBlock* block) {
+    if (kind == ValueKind::Heap) {
+        if (block->compressed()) {
+            KV_METRIC(counters_.compressed_values--; counters_.compression_saved_bytes -= block->valueSize() - block->size);
         }
+        retireShared(value_arena_, block, sizeof(ValueBlock) + block->size, block->birth, &block->holds);
+        bytes_ -= sizeof(ValueBlock) + block->size;
+        KV_METRIC(counters_.value_bytes -= sizeof(ValueBlock) + block->size);
+    } else if (kind == ValueKind::Integer) {
+        KV_METRIC(counters_.integer_values--);
+    }
+}
+
+// --- Bulk loading ---
+
+void Trie::build(const pair<string_view, string_view>* entries, size_t count) {
+    if (count == 0) return;
+    if (indexed_) index_.reserve(count);
+    Node* empty = root_.load(memory_order_relaxed);
+    vector<const pair<string_view, string_view>*> runs;
+    root_.store(buildNode(entries, count, 0, true, runs), memory_order_release);
+    retireNode(empty);
+}
+
+Trie::Node* Trie::buildNode(const pair<string_view, string_view>* entries, size_t count, size_t depth, bool is_root,
+                            vector<const pair<string_view, string_view>*>& runs) {
+    // Sorted keys: what the range shares is what its first and last share.
+    string_view first = entries[0].first;
+    size_t end = depth;
+    if (!is_root) end += findMismatch(first.substr(depth), entries[count - 1].first.substr(depth));
+    bool has_value = first.size() == end; // Only the first key can end here
+    const auto* stop = entries + count;
+
+    // Keys past `end` are sorted by their byte there, so each child's run
+    // is found by binary search. The run starts go on the shared stack
+    // `runs` (children push theirs above), and their number picks the
+    // node's layout.
+    size_t base = runs.size();
+    for (const auto* run = entries + (has_value ? 1 : 0); run != stop;) {
+        runs.push_back(run);
+        char byte = run->first[end];
+        run = partition_point(run, stop, [&](const auto& entry) { return entry.first[end] == byte; });
+    }
+    size_t children = runs.size() - base;
+    NodeType type = children == 0    ? NodeType::Node0
+                    : children <= 4  ? NodeType::Node4
+                    : children <= 16 ? NodeType::Node16
+                    : children <= 48 ? NodeType::Node48
+                                     : NodeType::Node256;
+
+    Node* node = newNode(type, first.substr(depth, end - depth));
+    node->descendants = count;
+    if (has_value) {
+        ValueData data = prepareValue(entries[0].second, 0);
+        installValue(node, data);
+        touch(node);
+        if (indexed_) index_.insertOrAssign(first, data);
+    }
+    for (size_t i = 0; i < children; ++i) {
+        const auto* run = runs[base + i];
+        const auto* next = i + 1 < children ? runs[base + i + 1] : stop;
+        Node* child = buildNode(run, static_cast<size_t>(next - run), end + 1, false, runs);
+        insertChild(node, static_cast<uint8_t>(run->first[end]), child);
+    }
+    runs.resize(base);
+    return node;
+}
+
+void Trie::replaceWith(Trie& other) {
+    beginWrite();
+    node_arena_.absorb(other.node_arena_);
+    value_arena_.absorb(other.value_arena_);
+    // The adopted nodes carry `other`'s generations, which are no newer than
+    // ours: at worst a pin copies or defers one of them needlessly.
+    if (indexed_) {
+        if (!other.indexed_) other.enableHashIndex();
+        // Before the old values are retired: a reader must not find them
+        // through the index afterwards.
+        index_.replaceWith(other.index_);
+    }
+    Node* old_root = root_.load(memory_order_relaxed);
+    root_.store(other.root_.load(memory_order_relaxed), memory_order_release);
+    retireTree(old_root);
+    bytes_ += other.bytes_;
+    counters_ += other.counters_;
+    clock_hand_.clear();
+
+    other.bytes_ = 0;
+    other.counters_ = TrieStats();
+    other.root_.store(other.newNode(NodeType::Node0, ""), memory_order_relaxed);
+}
+
+// --- Versions ---
 
-        TrieNode* child = current->children[index].get();
-        size_t mismatch_pos = findMismatch(key.substr(key_pos), child->edge_label);
+Trie::Snapshot Trie::pin() const {
+    lock_guard lock(pins_mutex_);
+    uint32_t generation = generation_.load(memory_order_relaxed);
+    if (written_since_pin_ || generation == 0) {
+        // Freeze this generation: from now on writers copy what it owns.
+        generation_.store(generation + 1, memory_order_relaxed);
+        written_since_pin_ = false;
+    } else {
+        // Nothing changed since the last pin; share its generation.
+        generation--;
+    }
+    pins_.insert(generation);
+    newest_pin_.store(*pins_.rbegin(), memory_order_release);
+    return Snapshot(this, root_.load(memory_order_acquire), generation);
+}
+
+void Trie::beginWrite() {
+    // Plain load first: the common case must not write a shared line.
+    if (pins_released_.load(memory_order_relaxed) && pins_released_.exchange(false, memory_order_acq_rel)) {
+        sweepDeferred();
+    }
+    write_pin_ = newest_pin_.load(memory_order_acquire);
+    // pin() reads this under the caller's lock, which orders it after us.
+    written_since_pin_ = true;
+    if (policy_ != EvictionPolicy::None && ++writes_ % ACCESS_TICK_WRITES == 0) {
+        access_clock_.store(static_cast<uint32_t>(writes_ / ACCESS_TICK_WRITES), memory_order_relaxed);
+    }
+}
+
+void Trie::retireShared(SlabArena& arena, void* ptr, size_t size, uint32_t birth, const atomic<uint32_t>* holds) {
+    if (isShared(birth)) {
+        deferred_.push_back(Deferred{&arena, ptr, size, birth, generation_.load(memory_order_relaxed), holds});
+    } else {
+        arena.retire(ptr, size, holds);
+    }
+}
+
+void Trie::sweepDeferred() {
+    lock_guard lock(pins_mutex_);
+    size_t kept = 0;
+    for (const Deferred& d : deferred_) {
+        // Still visible if some live pin falls in [birth, retired_at).
+        auto pin = pins_.lower_bound(d.birth);
+        if (pin != pins_.end() && *pin < d.retired_at) {
+            deferred_[kept++] = d;
+        } else {
+            // Lock-free readers of the current tree may still hold it too.
+            d.arena->retire(d.ptr, d.size, d.holds);
+        }
+    }
+    deferred_.resize(kept);
+}
+
+Trie::Node* Trie::writable(Node* parent, Node** slot, Node* node) {
+    if (!isShared(node->birth)) return node;
+    // Same contents, so a reader passing through either one is unaffected;
+    // the parent was made writable first, so it can be updated in place.
+    Node* copy = copyNode(node, node->prefix());
+    replaceNode(parent, slot, node, copy);
+    KV_METRIC(counters_.path_copies++);
+    return copy;
+}
+
+Trie::Snapshot::Snapshot(Snapshot&& other) noexcept
+    : trie_(other.trie_), root_(other.root_), generation_(other.generation_), codec_(other.codec_) {
+    other.trie_ = nullptr;
+}
+
+Trie::Snapshot& Trie::Snapshot::operator=(Snapshot&& other) noexcept {
+    if (this != &other) {
+        release();
+        trie_ = other.trie_;
+        root_ = other.root_;
+        generation_ = other.generation_;
+        codec_ = other.codec_;
+        other.trie_ = nullptr;
+    }
+    return *this;
+}
+
+Trie::Snapshot::~Snapshot() { release(); }
+
+void Trie::Snapshot::release() {
+    if (!trie_) return;
+    {
+        lock_guard lock(trie_->pins_mutex_);
+        trie_->pins_.erase(trie_->pins_.find(generation_));
+        trie_->newest_pin_.store(trie_->pins_.empty() ? -1 : static_cast<int64_t>(*trie_->pins_.rbegin()),
+                                 memory_order_release);
+    }
+    // The trie's arenas belong to its writer, so the freeing is left to
+    // the next write.
+    trie_->pins_released_.store(true, memory_order_release);
+    trie_ = nullptr;
+}
+
+optional<string> Trie::Snapshot::get(string_view key, uint64_t* expires_at) const {
+    const Node* node = findNode(root_, key);
+    if (!node || !node->hasValue()) return nullopt;
+    if (expires_at) *expires_at = node->expiresAt();
+    string buffer;
+    return string(nodeValue(codec_, node, buffer));
+}
+
+optional<pair<string, string>> Trie::Snapshot::getNth(size_t n) const { return getNthFrom(codec_, root_, n); }
+size_t Trie::Snapshot::size() const { return root_->descendants; }
+size_t Trie::Snapshot::rank(string_view key) const { return rankFrom(root_, key); }
+Trie::Iterator Trie::Snapshot::begin(bool forward) const { return beginFrom(codec_, root_, forward); }
+Trie::Iterator Trie::Snapshot::seek(string_view key, bool forward) const {
+    return seekFrom(codec_, root_, key, forward);
+}
+
+// --- Optimistic lock coupling ---
+//
+// Writers are already serialized by the caller, so taking a node lock never
+// waits; it only tells optimistic readers that the node is changing.
+
+void Trie::writeLock(Node* node) {
+    node->version.store(node->version.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void Trie::writeUnlock(Node* node) {
+    node->version.store(node->version.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+void Trie::markObsolete(Node* node) {
+    // Locked and never unlocked again: every reader that reaches it restarts.
+    writeLock(node);
+}
+
+// --- Child lookup ---
+
+Trie::Node* const* Trie::findChild(const Node* node, uint8_t byte) {
+    switch (node->type) {
+        case NodeType::Node0:
+            return nullptr;
+        case NodeType::Node4: {
+            auto* n = static_cast<const Node4*>(node);
+            for (int i = 0; i < n->num_children; ++i) {
+                if (n->keys[i] == byte) return &n->children[i];
+            }
+            return nullptr;
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<const Node16*>(node);
+#if defined(__SSE2__)
+            // Compare all 16 key bytes at once and keep only the live slots.
+            __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(byte)),
+                                         _mm_loadu_si128(reinterpret_cast<const __m128i*>(n->keys)));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(cmp)) & ((1u << (n->num_children & 31)) - 1);
+            if (mask) return &n->children[__builtin_ctz(mask)];
+#else
+            for (int i = 0; i < n->num_children && i < 16; ++i) {
+                if (n->keys[i] == byte) return &n->children[i];
+            }
+#endif
+            return nullptr;
+        }
+        case NodeType::Node48: {
+            auto* n = static_cast<const Node48*>(node);
+            uint8_t slot = n->child_index[byte];
+            return slot >= Node48::EMPTY ? nullptr : &n->children[slot];
+        }
+        case NodeType::Node256: {
+            auto* n = static_cast<const Node256*>(node);
+            return n->children[byte] ? &n->children[byte] : nullptr;
+        }
+    }
+    return nullptr;
+}
+
+Trie::Node** Trie::findChild(Node* node, uint8_t byte) {
+    return const_cast<Node**>(findChild(static_cast<const Node*>(node), byte));
+}
+
+template <typename Fn>
+void Trie::forEachChild(const Node* node, Fn&& fn) {
+    switch (node->type) {
+        case NodeType::Node0:
+            break;
+        case NodeType::Node4: {
+            auto* n = static_cast<const Node4*>(node);
+            for (int i = 0; i < n->num_children; ++i) fn(n->keys[i], n->children[i]);
+            break;
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<const Node16*>(node);
+            for (int i = 0; i < n->num_children; ++i) fn(n->keys[i], n->children[i]);
+            break;
+        }
+        case NodeType::Node48: {
+            auto* n = static_cast<const Node48*>(node);
+            for (int b = 0; b < 256; ++b) {
+                if (n->child_index[b] != Node48::EMPTY) fn(static_cast<uint8_t>(b), n->children[n->child_index[b]]);
+            }
+            break;
+        }
+        case NodeType::Node256: {
+            auto* n = static_cast<const Node256*>(node);
+            for (int b = 0; b < 256; ++b) {
+                if (n->children[b]) fn(static_cast<uint8_t>(b), n->children[b]);
+            }
+            break;
+        }
+    }
+}
+
+// --- Layout edits ---
+
+bool Trie::isFull(const Node* node) {
+    switch (node->type) {
+        case NodeType::Node0:   return true;
+        case NodeType::Node4:   return node->num_children == 4;
+        case NodeType::Node16:  return node->num_children == 16;
+        case NodeType::Node48:  return node->num_children == 48;
+        case NodeType::Node256: return false;
+    }
+    return false;
+}
+
+bool Trie::isUnderfullAfterErase(const Node* node) {
+    // Shrink thresholds leave some slack so a node hovering around a
+    // boundary does not flip between layouts on every put/remove.
+    size_t remaining = node->num_children - 1;
+    switch (node->type) {
+        case NodeType::Node0:   return false;
+        case NodeType::Node4:   return remaining == 0;
+        case NodeType::Node16:  return remaining <= 3;
+        case NodeType::Node48:  return remaining <= 12;
+        case NodeType::Node256: return remaining <= 40;
+    }
+    return false;
+}
+
+void Trie::insertChild(Node* node, uint8_t byte, Node* child) {
+    switch (node->type) {
+        case NodeType::Node0:
+            return; // Callers grow a Node0 before adding children
+        case NodeType::Node4: {
+            auto* n = static_cast<Node4*>(node);
+            int pos = 0;
+            while (pos < n->num_children && n->keys[pos] < byte) ++pos;
+            memmove(n->keys + pos + 1, n->keys + pos, n->num_children - pos);
+            memmove(n->children + pos + 1, n->children + pos, (n->num_children - pos) * sizeof(Node*));
+            n->keys[pos] = byte;
+            n->children[pos] = child;
+            break;
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<Node16*>(node);
+            int pos = 0;
+            while (pos < n->num_children && n->keys[pos] < byte) ++pos;
+            memmove(n->keys + pos + 1, n->keys + pos, n->num_children - pos);
+            memmove(n->children + pos + 1, n->children + pos, (n->num_children - pos) * sizeof(Node*));
+            n->keys[pos] = byte;
+            n->children[pos] = child;
+            break;
+        }
+        case NodeType::Node48: {
+            auto* n = static_cast<Node48*>(node);
+            uint8_t slot = 0;
+            while (n->children[slot]) ++slot;
+            n->children[slot] = child;
+            n->child_index[byte] = slot;
+            break;
+        }
+        case NodeType::Node256: {
+            static_cast<Node256*>(node)->children[byte] = child;
+            break;
+        }
+    }
+    node->num_children++;
+}
+
+void Trie::eraseChild(Node* node, uint8_t byte) {
+    switch (node->type) {
+        case NodeType::Node0:
+            return;
+        case NodeType::Node4: {
+            auto* n = static_cast<Node4*>(node);
+            int pos = 0;
+            while (n->keys[pos] != byte) ++pos;
+            memmove(n->keys + pos, n->keys + pos + 1, n->num_children - pos - 1);
+            memmove(n->children + pos, n->children + pos + 1, (n->num_children - pos - 1) * sizeof(Node*));
+            break;
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<Node16*>(node);
+            int pos = 0;
+            while (n->keys[pos] != byte) ++pos;
+            memmove(n->keys + pos, n->keys + pos + 1, n->num_children - pos - 1);
+            memmove(n->children + pos, n->children + pos + 1, (n->num_children - pos - 1) * sizeof(Node*));
+            break;
+        }
+        case NodeType::Node48: {
+            auto* n = static_cast<Node48*>(node);
+            n->children[n->child_index[byte]] = nullptr;
+            n->child_index[byte] = Node48::EMPTY;
+            break;
+        }
+        case NodeType::Node256: {
+            static_cast<Node256*>(node)->children[byte] = nullptr;
+            break;
+        }
+    }
+    node->num_children--;
+}
+
+void Trie::copyHeader(Node* to, const Node* from) {
+    to->value_kind = from->value_kind;
+    to->value_len = from->value_len;
+    to->access.store(from->access.load(memory_order_relaxed), memory_order_relaxed);
+    memcpy(to->inline_value, from->inline_value, INLINE_BYTES); // Also carries heap_value
+    to->descendants = from->descendants;
+}
+
+Trie::Node* Trie::copyNode(const Node* node, string_view prefix) {
+    Node* copy = newNode(node->type, prefix);
+    switch (node->type) {
+        case NodeType::Node0:
+            break;
+        case NodeType::Node4: {
+            auto* n = static_cast<const Node4*>(node);
+            auto* c = static_cast<Node4*>(copy);
+            memcpy(c->keys, n->keys, sizeof(n->keys));
+            memcpy(c->children, n->children, sizeof(n->children));
+            break;
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<const Node16*>(node);
+            auto* c = static_cast<Node16*>(copy);
+            memcpy(c->keys, n->keys, sizeof(n->keys));
+            memcpy(c->children, n->children, sizeof(n->children));
+            break;
+        }
+        case NodeType::Node48: {
+            auto* n = static_cast<const Node48*>(node);
+            auto* c = static_cast<Node48*>(copy);
+            memcpy(c->child_index, n->child_index, sizeof(n->child_index));
+            memcpy(c->children, n->children, sizeof(n->children));
+            break;
+        }
+        case NodeType::Node256: {
+            auto* n = static_cast<const Node256*>(node);
+            memcpy(static_cast<Node256*>(copy)->children, n->children, sizeof(n->children));
+            break;
+        }
+    }
+    copy->num_children = node->num_children;
+    copyHeader(copy, node);
+    return copy;
+}
+
+Trie::Node* Trie::grow(const Node* node) {
+    string_view prefix = node->prefix();
+    Node* bigger = nullptr;
+    switch (node->type) {
+        case NodeType::Node0:
+            bigger = newNode(NodeType::Node4, prefix);
+            break;
+        case NodeType::Node4: {
+            auto* n = static_cast<const Node4*>(node);
+            auto* g = static_cast<Node16*>(newNode(NodeType::Node16, prefix));
+            memcpy(g->keys, n->keys, n->num_children);
+            memcpy(g->children, n->children, n->num_children * sizeof(Node*));
+            bigger = g;
+            break;
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<const Node16*>(node);
+            auto* g = static_cast<Node48*>(newNode(NodeType::Node48, prefix));
+            for (int i = 0; i < n->num_children; ++i) {
+                g->child_index[n->keys[i]] = static_cast<uint8_t>(i);
+                g->children[i] = n->children[i];
+            }
+            bigger = g;
+            break;
+        }
+        case NodeType::Node48: {
+            auto* n = static_cast<const Node48*>(node);
+            auto* g = static_cast<Node256*>(newNode(NodeType::Node256, prefix));
+            for (int b = 0; b < 256; ++b) {
+                if (n->child_index[b] != Node48::EMPTY) g->children[b] = n->children[n->child_index[b]];
+            }
+            bigger = g;
+            break;
+        }
+        case NodeType::Node256:
+            return copyNode(node, prefix);
+    }
+    KV_METRIC(counters_.grows++);
+    bigger->num_children = node->num_children;
+    copyHeader(bigger, node);
+    return bigger;
+}
+
+Trie::Node* Trie::shrink(const Node* node, uint8_t skip_byte) {
+    // Builds the next smaller layout holding every child except `skip_byte`.
+    static const NodeType smaller_type[] = {NodeType::Node0, NodeType::Node0, NodeType::Node4,
+                                            NodeType::Node16, NodeType::Node48};
+    Node* smaller = newNode(smaller_type[static_cast<int>(node->type)], node->prefix());
+    forEachChild(node, [&](uint8_t b, Node* c) {
+        if (b != skip_byte) insertChild(smaller, b, c);
+    });
+    copyHeader(smaller, node);
+    KV_METRIC(counters_.shrinks++);
+    return smaller;
+}
+
+// --- Publishing changes ---
+
+void Trie::replaceNode(Node* parent, Node** slot, Node* old_node, Node* replacement) {
+    if (!parent) {
+        root_.store(replacement, memory_order_release);
+    } else {
+        writeLock(parent);
+        *slot = replacement;
+        writeUnlock(parent);
+    }
+    markObsolete(old_node);
+    retireNode(old_node);
+}
 
-        if (mismatch_pos == child->edge_label.length()) {
-            // The key fragment matches the whole edge label, move down
-            key_pos += child->edge_label.length();
+void Trie::addChild(Node* parent, Node** slot, Node* node, uint8_t byte, Node* child) {
+    if (isFull(node)) {
+        Node* bigger = grow(node);
+        insertChild(bigger, byte, child);
+        replaceNode(parent, slot, node, bigger);
+    } else {
+        writeLock(node);
+        insertChild(node, byte, child);
+        writeUnlock(node);
+    }
+}
+
+void Trie::removeChild(Node* parent, Node** slot, Node* node, uint8_t byte) {
+    if (isUnderfullAfterErase(node)) {
+        replaceNode(parent, slot, node, shrink(node, byte));
+    } else {
+        writeLock(node);
+        eraseChild(node, byte);
+        writeUnlock(node);
+    }
+}
+
+// --- Public API ---
+
+bool Trie::put(string_view key, string_view value, uint64_t expires_at, uint64_t* old_expires_at) {
+    beginWrite();
+    if (old_expires_at) *old_expires_at = 0;
+    // Built once up front; exactly one branch below installs it.
+    Install install;
+    install.data = prepareValue(value, expires_at);
+    install.old_expires_at = old_expires_at;
+    // insertHelper reports whether a brand-new key was added
+    return !insertHelper(nullptr, nullptr, root_.load(memory_order_relaxed), key, 0, install);
+}
+
+bool Trie::updateWith(string_view key, Updater updater, void* context) {
+    beginWrite();
+    Install install;
+    install.updater = updater;
+    install.context = context;
+    Node* root = root_.load(memory_order_relaxed);
+    if (write_pin_ >= 0) {
+        // With a version pinned, the walk copies the path as it goes down;
+        // decide first, so a declined update leaves the tree untouched.
+        if (!decide(install, findNode(root, key))) return false;
+        install.updater = nullptr;
+    }
+    insertHelper(nullptr, nullptr, root, key, 0, install);
+    return install.stored;
+}
+
+bool Trie::decide(Install& install, const Node* node) {
+    uint64_t expires_at = node && node->hasValue() ? node->expiresAt() : 0;
+    optional<string_view> current;
+    string buffer;
+    if (node && node->hasValue()) current = nodeValue(codec_, node, buffer);
+    optional<string_view> value = install.updater(install.context, current, expires_at);
+    if (!value) return false;
+    install.data = prepareValue(*value, expires_at);
+    return true;
+}
+
+bool Trie::resolve(Install& install, string_view key, const Node* node) {
+    // The value is only known now that the key's current one is
+    if (install.updater && !decide(install, node)) return false;
+    install.stored = true;
+    // The index first: an old value is retired right after, and no reader
+    // may find it through the index by then.
+    if (indexed_) index_.insertOrAssign(key, install.data);
+    return true;
+}
+
+bool Trie::insertHelper(Node* parent, Node** slot, Node* node, string_view key, size_t depth, Install& install) {
+    string_view rest = key.substr(depth);
+    string_view prefix = node->prefix();
+    size_t mismatch_pos = findMismatch(rest, prefix);
+
+    if (mismatch_pos < prefix.length()) {
+        // Mismatch inside this node's prefix: split it. The new parent keeps
+        // the common part; the old node is re-created with what follows the
+        // diverging byte, since readers may still be walking the original.
+        if (!resolve(install, key, nullptr)) return false;
+        const ValueData& data = install.data;
+        Node* split = newNode(NodeType::Node4, prefix.substr(0, mismatch_pos));
+        KV_METRIC(counters_.splits++);
+        split->descendants = node->descendants + 1;
+        insertChild(split, static_cast<uint8_t>(prefix[mismatch_pos]), copyNode(node, prefix.substr(mismatch_pos + 1)));
+        if (mismatch_pos == rest.length()) {
+            // The new key ends at the split point
+            installValue(split, data);
+            touch(split);
+        } else {
+            insertChild(split, static_cast<uint8_t>(rest[mismatch_pos]), makeLeaf(rest.substr(mismatch_pos + 1), data));
+        }
+        replaceNode(parent, slot, node, split);
+        return true;
+    }
+
+    // Everything below changes this node in place (at least its count)
+    node = writable(parent, slot, node);
+    depth += prefix.length();
+    if (depth == key.length()) {
+        // Key already has a node; overwrite or set its value. The new value
+        // was built first so the node stays locked for just a few stores.
+        if (!resolve(install, key, node)) return false;
+        ValueKind old_kind = node->value_kind;
+        ValueBlock* old_block = old_kind == ValueKind::Heap ? node->heap_value : nullptr;
+        if (install.old_expires_at && old_block) *install.old_expires_at = old_block->expires_at;
+        writeLock(node);
+        installValue(node, install.data);
+        writeUnlock(node);
+        retireValue(old_kind, old_block);
+        // A new key must not inherit the mark of one removed from here
+        if (old_kind == ValueKind::None) node->access.store(0, memory_order_relaxed);
+        touch(node);
+        if (old_kind != ValueKind::None) return false;
+        node->descendants++;
+        return true;
+    }
+
+    uint8_t byte = static_cast<uint8_t>(key[depth]);
+    if (Node** child = findChild(node, byte)) {
+        bool inserted = insertHelper(node, child, *child, key, depth + 1, install);
+        if (inserted) node->descendants++;
+        return inserted;
+    }
+
+    // No child starting with this byte, hang a new leaf off this node
+    if (!resolve(install, key, nullptr)) return false;
+    node->descendants++;
+    addChild(parent, slot, node, byte, makeLeaf(key.substr(depth + 1), install.data));
+    return true;
+}
+
+string_view Trie::nodeValue(const ValueCodec* codec, const Node* node, string& buffer) {
+    if (node->value_kind == ValueKind::Integer) {
+        buffer.resize(SCRATCH_BYTES);
+        buffer.resize(spellInteger(node->inline_value, buffer.data()));
+        return buffer;
+    }
+    if (node->value_kind != ValueKind::Heap) return string_view(node->inline_value, node->value_len);
+    const ValueBlock* block = node->heap_value;
+    if (!block->compressed()) return string_view(block->data(), block->size);
+    decompress(codec, block, buffer);
+    return buffer;
+}
+
+void Trie::decompress(const ValueCodec* codec, const ValueBlock* block, string& out) {
+    out.resize(block->valueSize());
+    codec->decompress(string_view(block->data(), block->size), (block->raw_size & ValueBlock::WITH_DICTIONARY) != 0,
+                      out.data());
+}
+
+void Trie::viewValue(const ValueData& data, char* scratch, string_view& value, const ValueBlock*& block) {
+    if (data.kind == ValueKind::Inline) {
+        block = nullptr;
+        value = string_view(data.inline_bytes, data.len);
+    } else if (data.kind == ValueKind::Integer) {
+        block = nullptr;
+        value = string_view(scratch, spellInteger(data.inline_bytes, scratch));
+    } else {
+        block = data.block;
+        value = string_view(block->data(), block->size);
+    }
+}
+
+bool Trie::findValue(string_view key, char* scratch, string_view& value, const ValueBlock*& block) const {
+    if (indexed_) {
+        // Entries are immutable, so there is nothing to validate
+        const ValueData* data = index_.find(key);
+        if (!data) return false;
+        viewValue(*data, scratch, value, block);
+        return true;
+    }
+    for (int attempt = 0;; ++attempt) {
+        if (attempt > 0 && attempt % 16 == 0) this_thread::yield();
+
+        const Node* current = root_.load(memory_order_acquire);
+        uint64_t version = current->version.load(memory_order_acquire);
+        if (version & 1) continue;
+
+        size_t depth = 0;
+        bool restart = false;
+        while (!restart) {
+            string_view prefix = current->prefix();
+            if (key.substr(depth, prefix.length()) != prefix) {
+                // Key mismatches the edge path. Prefixes never change in
+                // place, but the node might have been replaced meanwhile.
+                atomic_thread_fence(memory_order_acquire);
+                if (current->version.load(memory_order_relaxed) != version) break;
+                return false;
+            }
+            depth += prefix.length();
+            if (depth == key.length()) {
+                // Snapshot the value fields, validate, and only then follow
+                // a heap pointer (it may have been torn by a writer).
+                ValueKind kind = current->value_kind;
+                uint32_t len = current->value_len;
+                memcpy(scratch, current->inline_value, INLINE_BYTES);
+                atomic_thread_fence(memory_order_acquire);
+                if (current->version.load(memory_order_relaxed) != version) break;
+                if (kind == ValueKind::None) return false;
+                touch(current);
+                if (kind == ValueKind::Inline) {
+                    block = nullptr;
+                    value = string_view(scratch, len);
+                    return true;
+                }
+                if (kind == ValueKind::Integer) {
+                    block = nullptr;
+                    value = string_view(scratch, spellInteger(scratch, scratch));
+                    return true;
+                }
+                memcpy(&block, scratch, sizeof(block));
+                value = string_view(block->data(), block->size);
+                return true;
+            }
+
+            Node* const* slot = findChild(current, static_cast<uint8_t>(key[depth]));
+            const Node* child = slot ? *slot : nullptr;
+            // Validate the parent before trusting what was read from it.
+            atomic_thread_fence(memory_order_acquire);
+            if (current->version.load(memory_order_relaxed) != version) break;
+            if (!child) return false;
+
+            version = child->version.load(memory_order_acquire);
+            restart = (version & 1) != 0;
             current = child;
+            depth++;
+        }
+    }
+}
+
+optional<string> Trie::get(string_view key, uint64_t* expires_at) const {
+    EpochGuard guard;
+    char scratch[SCRATCH_BYTES];
+    string_view value;
+    const ValueBlock* block = nullptr;
+    if (!findValue(key, scratch, value, block)) return nullopt;
+    if (expires_at) *expires_at = block ? block->expires_at : 0;
+    if (block && block->compressed()) {
+        string decoded;
+        decompress(codec_, block, decoded);
+        return decoded;
+    }
+    return string(value);
+}
+
+ValueHandle Trie::getHandle(string_view key, uint64_t* expires_at) const {
+    EpochGuard guard;
+    char scratch[SCRATCH_BYTES];
+    string_view value;
+    const ValueBlock* block = nullptr;
+    if (!findValue(key, scratch, value, block)) return ValueHandle();
+    if (expires_at) *expires_at = block ? block->expires_at : 0;
+    if (!block) return ValueHandle(string(value));
+    if (block->compressed()) {
+        string decoded;
+        decompress(codec_, block, decoded);
+        return ValueHandle(move(decoded));
+    }
+    // The block cannot be recycled while the guard is held, even if it was
+    // retired a moment ago; leaving the guard publishes the count to the
+    // arena before it next looks.
+    block->holds.fetch_add(1, memory_order_relaxed);
+    return ValueHandle(&block->holds, value);
+}
+
+bool Trie::remove(string_view key, uint64_t* old_expires_at) {
+    beginWrite();
+    if (old_expires_at) *old_expires_at = 0;
+    // As in put(), the index lets go of the value before it is retired
+    if (indexed_ && !index_.erase(key)) return false;
+    Node* root = root_.load(memory_order_relaxed);
+    if (write_pin_ >= 0) {
+        // Do not copy a path just to find the key is not there
+        const Node* node = findNode(root, key);
+        if (!node || !node->hasValue()) return false;
+    }
+    return removeHelper(nullptr, nullptr, root, key, 0, old_expires_at);
+}
+
+bool Trie::contains(string_view key, uint64_t* expires_at) const {
+    const Node* node = findNode(root_.load(memory_order_acquire), key);
+    if (!node || !node->hasValue()) return false;
+    if (expires_at) *expires_at = node->expiresAt();
+    return true;
+}
+
+const Trie::Node* Trie::findNode(const Node* root, string_view key) {
+    const Node* current = root;
+    size_t depth = 0;
+    while (true) {
+        string_view prefix = current->prefix();
+        if (key.substr(depth, prefix.length()) != prefix) return nullptr;
+        depth += prefix.length();
+        if (depth == key.length()) return current;
+        Node* const* child = findChild(current, static_cast<uint8_t>(key[depth]));
+        if (!child) return nullptr;
+        current = *child;
+        depth++;
+    }
+}
+
+bool Trie::removeHelper(Node* parent, Node** slot, Node* node, string_view key, size_t depth, uint64_t* old_expires_at) {
+    string_view prefix = node->prefix();
+    if (key.substr(depth, prefix.length()) != prefix) return false;
+    depth += prefix.length();
+    node = writable(parent, slot, node);
+
+    if (depth == key.length()) {
+        if (!node->hasValue()) return false;
+        ValueKind old_kind = node->value_kind;
+        ValueBlock* old_block = old_kind == ValueKind::Heap ? node->heap_value : nullptr;
+        if (old_expires_at && old_block) *old_expires_at = old_block->expires_at;
+        writeLock(node);
+        node->value_kind = ValueKind::None;
+        writeUnlock(node);
+        retireValue(old_kind, old_block);
+        node->descendants--;
+        return true;
+    }
+
+    uint8_t byte = static_cast<uint8_t>(key[depth]);
+    Node** child_slot = findChild(node, byte);
+    if (!child_slot || !removeHelper(node, child_slot, *child_slot, key, depth + 1, old_expires_at)) return false;
+    node->descendants--;
+
+    // Path compression: a node without a value needs at least two children.
+    Node* child = *child_slot;
+    if (child->hasValue()) return true;
+    if (child->num_children == 0) {
+        removeChild(parent, slot, node, byte);
+        markObsolete(child);
+        retireNode(child);
+    } else if (child->num_children == 1) {
+        // Fold the only grandchild into this edge: prefix + byte + its prefix.
+        uint8_t only_byte = 0;
+        Node* only = nullptr;
+        forEachChild(child, [&](uint8_t b, Node* c) { only_byte = b; only = c; });
+        string merged(child->prefix());
+        merged.push_back(static_cast<char>(only_byte));
+        merged += only->prefix();
+        replaceNode(node, child_slot, child, copyNode(only, merged));
+        markObsolete(only);
+        retireNode(only);
+    }
+    return true;
+}
+
+optional<pair<string, string>> Trie::getNth(size_t n) const {
+    return getNthFrom(codec_, root_.load(memory_order_acquire), n);
+}
+
+optional<pair<string, string>> Trie::getNthFrom(const ValueCodec* codec, const Node* root, size_t n) {
+    const Node* current = root;
+    if (n >= current->descendants) return nullopt;
+
+    string key;
+    while (true) {
+        key += current->prefix();
+        if (current->hasValue()) {
+            if (n == 0) {
+                string buffer;
+                return make_pair(move(key), string(nodeValue(codec, current, buffer)));
+            }
+            n--;
+        }
+        // Skip whole subtrees using their descendant counts
+        const Node* next = nullptr;
+        uint8_t next_byte = 0;
+        forEachChild(current, [&](uint8_t b, Node* c) {
+            if (next) return;
+            if (n < c->descendants) {
+                next = c;
+                next_byte = b;
+            } else {
+                n -= c->descendants;
+            }
+        });
+        if (!next) return nullopt; // Counts are inconsistent; should not happen
+        key.push_back(static_cast<char>(next_byte));
+        current = next;
+    }
+}
+
+bool Trie::removeNth(size_t n) {
+    auto entry = getNth(n);
+    if (!entry) return false;
+    return remove(entry->first);
+}
+
+// --- Eviction ---
+
+void Trie::setEvictionPolicy(EvictionPolicy policy, size_t samples) {
+    policy_ = policy;
+    samples_ = max<size_t>(1, samples);
+}
+
+// --- Hash index ---
+
+void Trie::enableHashIndex() {
+    if (indexed_) return;
+    indexed_ = true;
+    index_.reserve(size());
+    for (Iterator it = begin(); it.valid(); it.next()) {
+        const Node* node = it.current_;
+        ValueData data;
+        data.kind = node->value_kind;
+        if (data.kind == ValueKind::Heap) {
+            data.block = node->heap_value;
+            data.len = data.block->size;
         } else {
-            // Mismatch found, need to split the node
-            string_view common_prefix = child->edge_label.substr(0, mismatch_pos);
-            string_view child_suffix = child->edge_label.substr(mismatch_pos);
-            string_view key_suffix = key.substr(key_pos + mismatch_pos);
-
-            // Create the new split node
-            auto split_node = make_unique<TrieNode>(common_prefix);
-            split_node->descendants = child->descendants;
-
-            // Move the old child down
-            child->edge_label = child_suffix;
-            int child_index = child->edge_label[0] - 'A';
-            split_node->children[child_index] = move(current->children[index]);
-            
-            // Re-point the current child to the new split node
-            current->children[index] = move(split_node);
-            
-            if (key_suffix.empty()) {
-                // The new key ends at the split point
-                current->children[index]->value = value;
+            data.len = node->value_len;
+            memcpy(data.inline_bytes, node->inline_value, data.len);
+        }
+        index_.insertOrAssign(it.key(), data);
+    }
+}
+
+void Trie::touch(const Node* node) const {
+    if (policy_ == EvictionPolicy::None) return;
+    uint16_t old_mark = node->access.load(memory_order_relaxed);
+    uint32_t clock = access_clock_.load(memory_order_relaxed);
+    uint16_t mark = old_mark;
+    switch (policy_) {
+        case EvictionPolicy::None:
+            return;
+        case EvictionPolicy::Lru:
+            mark = static_cast<uint16_t>(clock);
+            break;
+        case EvictionPolicy::Clock:
+            mark = 1;
+            break;
+        case EvictionPolicy::Lfu: {
+            // A Morris counter: the higher it is, the less likely another
+            // access bumps it, so 8 bits cover a wide range of frequencies.
+            thread_local uint64_t random = hash<thread::id>{}(this_thread::get_id()) | 1;
+            uint32_t count = old_mark == 0 ? LFU_INIT : lfuCount(old_mark, clock);
+            uint32_t odds = (count > LFU_INIT ? count - LFU_INIT : 0) * LFU_LOG_FACTOR + 1;
+            if (count < 255 && xorshift(random) % odds == 0) count++;
+            mark = static_cast<uint16_t>(((clock / LFU_DECAY_TICKS) & 0xff) << 8 | count);
+            break;
+        }
+    }
+    // Only store a change: a hot key's line stays clean in every reader's cache.
+    if (mark != old_mark) node->access.store(mark, memory_order_relaxed);
+}
+
+uint32_t Trie::coldness(const Node* node, uint32_t clock) const {
+    uint16_t mark = node->access.load(memory_order_relaxed);
+    if (policy_ == EvictionPolicy::Lfu) return 255 - lfuCount(mark, clock);
+    return (clock - mark) & 0xffff; // Ticks since the last use, modulo the stamp's width
+}
+
+optional<string> Trie::evictionVictim() {
+    const Node* root = root_.load(memory_order_relaxed);
+    size_t count = root->descendants;
+    if (policy_ == EvictionPolicy::None || count == 0) return nullopt;
+    if (policy_ == EvictionPolicy::Clock) return clockVictim();
+
+    uint32_t clock = access_clock_.load(memory_order_relaxed);
+    optional<string> victim;
+    uint32_t victim_coldness = 0;
+    string key;
+    for (size_t i = 0; i < samples_; ++i) {
+        const Node* node = randomNode(root, key);
+        if (!node) continue;
+        uint32_t c = coldness(node, clock);
+        if (!victim || c > victim_coldness) {
+            victim = key;
+            victim_coldness = c;
+        }
+    }
+    return victim;
+}
+
+const Trie::Node* Trie::randomNode(const Node* root, string& key) {
+    // A random walk rather than a uniform draw by rank: picking a child by
+    // subtree counts would read the count of every child of a wide node, a
+    // cache miss each, while this only reads the node's own child array.
+    // Keys under sparse subtrees come up more often; the sample is still
+    // unrelated to how keys are used, which is all the policies need.
+    const Node* current = root;
+    key.clear();
+    while (true) {
+        key += current->prefix();
+        if (current->num_children == 0) return current->hasValue() ? current : nullptr;
+        if (current->hasValue() && xorshift(random_) % current->descendants == 0) return current;
+        uint8_t byte = 0;
+        current = randomChild(current, byte);
+        key.push_back(static_cast<char>(byte));
+    }
+}
+
+const Trie::Node* Trie::randomChild(const Node* node, uint8_t& byte) {
+    switch (node->type) {
+        case NodeType::Node0:
+            return nullptr;
+        case NodeType::Node4: {
+            auto* n = static_cast<const Node4*>(node);
+            size_t i = xorshift(random_) % n->num_children;
+            byte = n->keys[i];
+            return n->children[i];
+        }
+        case NodeType::Node16: {
+            auto* n = static_cast<const Node16*>(node);
+            size_t i = xorshift(random_) % n->num_children;
+            byte = n->keys[i];
+            return n->children[i];
+        }
+        case NodeType::Node48:
+        case NodeType::Node256:
+            // Probe random bytes, each one lookup in the node itself. A
+            // Node48 keeps at least 13 children and a Node256 at least 41,
+            // so 64 probes nearly always hit; if not, take the first child.
+            for (int attempt = 0; attempt < 8; ++attempt) {
+                uint64_t bits = xorshift(random_);
+                for (int i = 0; i < 8; ++i, bits >>= 8) {
+                    if (Node* const* child = findChild(node, static_cast<uint8_t>(bits))) {
+                        byte = static_cast<uint8_t>(bits);
+                        return *child;
+                    }
+                }
+            }
+            break;
+    }
+    const Node* first = nullptr;
+    forEachChild(node, [&](uint8_t b, Node* c) {
+        if (first) return;
+        first = c;
+        byte = b;
+    });
+    return first;
+}
+
+optional<string> Trie::clockVictim() {
+    // The hand clears reference bits until it finds a key without one. The
+    // sweep is bounded: if every key in reach was used since the last pass,
+    // the one the hand stops on goes anyway.
+    constexpr size_t MAX_SWEEP = 64;
+    const Node* root = root_.load(memory_order_relaxed);
+    Iterator it = seekFrom(codec_, root, clock_hand_, true);
+    for (size_t step = 0;; ++step) {
+        if (!it.valid()) it = beginFrom(codec_, root, true); // Wrap around
+        if (!it.valid()) return nullopt;
+        if (step == MAX_SWEEP || it.current_->access.load(memory_order_relaxed) == 0) {
+            clock_hand_ = it.key();
+            return clock_hand_;
+        }
+        it.current_->access.store(0, memory_order_relaxed);
+        it.next();
+    }
+}
+
+size_t Trie::rank(string_view key) const {
+    return rankFrom(root_.load(memory_order_acquire), key);
+}
+
+size_t Trie::rankFrom(const Node* root, string_view key) {
+    const Node* current = root;
+    size_t count = 0;
+    size_t depth = 0;
+    while (true) {
+        string_view prefix = current->prefix();
+        string_view rest = key.substr(depth);
+        int cmp = prefix.substr(0, rest.size()).compare(rest.substr(0, prefix.size()));
+        if (cmp > 0 || (cmp == 0 && prefix.size() > rest.size())) {
+            return count; // Every key below here is greater than `key`
+        }
+        if (cmp < 0) {
+            return count + current->descendants; // ... or every key is smaller
+        }
+        depth += prefix.length();
+        if (depth == key.length()) return count;
+
+        // This node's own key is a proper prefix of `key`, hence smaller
+        if (current->hasValue()) count++;
+        uint8_t byte = static_cast<uint8_t>(key[depth]);
+        const Node* next = nullptr;
+        forEachChild(current, [&](uint8_t b, Node* c) {
+            if (b < byte) count += c->descendants;
+            else if (b == byte) next = c;
+        });
+        if (!next) return count;
+        current = next;
+        depth++;
+    }
+}
+
+// --- Ordered iteration ---
+
+bool Trie::adjacentChild(const Node* node, int after, bool forward, uint8_t& byte, const Node*& child) {
+    switch (node->type) {
+        case NodeType::Node0:
+            return false;
+        case NodeType::Node4:
+        case NodeType::Node16: {
+            // Both keep their key bytes sorted.
+            const uint8_t* keys = node->type == NodeType::Node4 ? static_cast<const Node4*>(node)->keys
+                                                                : static_cast<const Node16*>(node)->keys;
+            Node* const* children = node->type == NodeType::Node4 ? static_cast<const Node4*>(node)->children
+                                                                  : static_cast<const Node16*>(node)->children;
+            int count = node->num_children;
+            if (forward) {
+                for (int i = 0; i < count; ++i) {
+                    if (keys[i] > after) { byte = keys[i]; child = children[i]; return true; }
+                }
             } else {
-                // The new key has a remaining part, create a new child for it
-                int key_index = key_suffix[0] - 'A';
-                current->children[index]->children[key_index] = make_unique<TrieNode>(key_suffix);
-                current->children[index]->children[key_index]->value = value;
-                current->children[index]->descendants++;
+                for (int i = count - 1; i >= 0; --i) {
+                    if (keys[i] < after) { byte = keys[i]; child = children[i]; return true; }
+                }
+            }
+            return false;
+        }
+        case NodeType::Node48:
+        case NodeType::Node256: {
+            int step = forward ? 1 : -1;
+            for (int b = after + step; b >= 0 && b < 256; b += step) {
+                const Node* c = nullptr;
+                if (node->type == NodeType::Node48) {
+                    auto* n = static_cast<const Node48*>(node);
+                    if (n->child_index[b] != Node48::EMPTY) c = n->children[n->child_index[b]];
+                } else {
+                    c = static_cast<const Node256*>(node)->children[b];
+                }
+                if (c) { byte = static_cast<uint8_t>(b); child = c; return true; }
             }
-            return false; // New key inserted
+            return false;
         }
     }
+    return false;
+}
 
-    // Key already existed, overwrite value
-    bool existed = current->value.has_value();
-    current->value = value;
-    if (!existed) {
-        // This path existed but wasn't a word before.
-        // We need to increment the descendant count of all parents.
-        // This part is complex and omitted for brevity but would be needed for a perfect implementation.
+void Trie::Iterator::next() {
+    // Forward order visits a node's own key before its children (a key
+    // sorts before its extensions); backward order is the exact reverse.
+    current_ = nullptr;
+    while (!stack_.empty()) {
+        size_t top = stack_.size() - 1;
+        const Node* node = stack_[top].node;
+        if (forward_ && !stack_[top].value_done) {
+            stack_[top].value_done = true;
+            if (node->hasValue()) {
+                key_.resize(stack_[top].key_len);
+                current_ = node;
+                return;
+            }
+        }
+        uint8_t byte;
+        const Node* child;
+        if (adjacentChild(node, stack_[top].last_byte, forward_, byte, child)) {
+            stack_[top].last_byte = byte;
+            key_.resize(stack_[top].key_len);
+            key_.push_back(static_cast<char>(byte));
+            key_ += child->prefix();
+            stack_.push_back(Frame{child, key_.size(), forward_ ? -1 : 256, false});
+            continue;
+        }
+        if (!forward_ && !stack_[top].value_done) {
+            stack_[top].value_done = true;
+            if (node->hasValue()) {
+                key_.resize(stack_[top].key_len);
+                current_ = node;
+                return;
+            }
+        }
+        stack_.pop_back();
     }
-    return existed; // Value was overwritten
 }
 
+Trie::Iterator Trie::begin(bool forward) const {
+    return beginFrom(codec_, root_.load(memory_order_acquire), forward);
+}
+
+Trie::Iterator Trie::beginFrom(const ValueCodec* codec, const Node* root, bool forward) {
+    Iterator it(forward, codec);
+    it.key_ = root->prefix();
+    it.stack_.push_back(Iterator::Frame{root, it.key_.size(), forward ? -1 : 256, false});
+    it.next();
+    return it;
+}
+
+Trie::Iterator Trie::seek(string_view key, bool forward) const {
+    return seekFrom(codec_, root_.load(memory_order_acquire), key, forward);
+}
+
+Trie::Iterator Trie::seekFrom(const ValueCodec* codec, const Node* root, string_view key, bool forward) {
+    // Walk down along `key`, leaving behind frames that already account for
+    // everything on the wrong side of it; next() then finds the first hit.
+    Iterator it(forward, codec);
+    const Node* current = root;
+    size_t depth = 0;
+    while (true) {
+        string_view prefix = current->prefix();
+        it.key_ += prefix;
+        Iterator::Frame frame{current, it.key_.size(), forward ? -1 : 256, false};
 
-optional<string> Trie::get(string_view key) const {
-    const TrieNode* current = root_.get();
-    size_t key_pos = 0;
-    while (key_pos < key.length()) {
-        int index = key[key_pos] - 'A';
-        if (!current->children[index]) return nullopt;
+        string_view rest = key.substr(depth);
+        int cmp = prefix.substr(0, rest.size()).compare(rest.substr(0, prefix.size()));
+        if (cmp > 0 || (cmp == 0 && prefix.size() > rest.size())) {
+            // The whole subtree sorts after `key`
+            if (!forward) {
+                frame.last_byte = -1;
+                frame.value_done = true;
+            }
+            it.stack_.push_back(frame);
+            break;
+        }
+        if (cmp < 0) {
+            // The whole subtree sorts before `key`
+            if (forward) {
+                frame.last_byte = 256;
+                frame.value_done = true;
+            }
+            it.stack_.push_back(frame);
+            break;
+        }
 
-        const TrieNode* child = current->children[index].get();
-        if (key.substr(key_pos, child->edge_label.length()) != child->edge_label) {
-            // Key mismatches the edge path
-            return nullopt;
+        depth += prefix.length();
+        if (depth == key.length()) {
+            // This node's key equals `key`; its children are all greater
+            if (!forward) frame.last_byte = -1;
+            it.stack_.push_back(frame);
+            break;
         }
-        key_pos += child->edge_label.length();
-        current = child;
+
+        // This node's own key is smaller; children split around `byte`
+        uint8_t byte = static_cast<uint8_t>(key[depth]);
+        if (forward) frame.value_done = true;
+        frame.last_byte = byte;
+        it.stack_.push_back(frame);
+        Node* const* child = findChild(current, byte);
+        if (!child) break;
+        it.key_.push_back(static_cast<char>(byte));
+        current = *child;
+        depth++;
     }
-    return current->value;
+    it.next();
+    return it;
+}
+
+// --- Batched lookups ---
+
+#if defined(__GNUC__)
+#define TRIE_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define TRIE_PREFETCH(address) ((void)(address))
+#endif
+
+namespace {
+void assignValue(optional<string>& out, const char* data, size_t len) {
+    if (out) out->assign(data, len);
+    else out.emplace(data, len);
+}
 }
 
-// Implementations for remove, getNth, and removeNth would follow a similar,
-// modernized pattern but are omitted here for clarity and brevity.
-bool Trie::remove(string_view key) { return false; /* Placeholder */ }
-optional<pair<string, string>> Trie::getNth(size_t n) const { return nullopt; /* Placeholder */ }
-bool Trie::removeNth(size_t n) { return false; /* Placeholder */ }
\ No newline at end of file
+void Trie::multiGet(const string_view* keys, size_t count, optional<string>* out, uint64_t* expires_at) const {
+    // Lookups in flight at once; enough to cover memory latency without
+    // the per-lookup state spilling out of registers and L1.
+    constexpr size_t GROUP = 8;
+
+    struct Lookup {
+        size_t index;       // Which key this is
+        const Node* node;   // Node to visit next (prefetched, not yet read)
+        uint64_t version;
+        size_t depth;
+    };
+
+    // Decoded straight into the result, reusing its buffer
+    auto assignBlock = [&](optional<string>& result, const ValueBlock* block) {
+        if (!block->compressed()) return assignValue(result, block->data(), block->size);
+        if (!result) result.emplace();
+        decompress(codec_, block, *result);
+    };
+
+    EpochGuard guard;
+    if (indexed_) {
+        // Each lookup is one probe: prefetch a group's worth, then probe them
+        for (size_t first = 0; first < count; first += GROUP) {
+            size_t last = min(count, first + GROUP);
+            for (size_t i = first; i < last; ++i) index_.prefetch(keys[i]);
+            for (size_t i = first; i < last; ++i) {
+                const ValueData* data = index_.find(keys[i]);
+                if (!data) {
+                    out[i].reset();
+                    if (expires_at) expires_at[i] = 0;
+                    continue;
+                }
+                char scratch[SCRATCH_BYTES];
+                string_view value;
+                const ValueBlock* block = nullptr;
+                viewValue(*data, scratch, value, block);
+                if (block) assignBlock(out[i], block);
+                else assignValue(out[i], value.data(), value.size());
+                if (expires_at) expires_at[i] = block ? block->expires_at : 0;
+            }
+        }
+        return;
+    }
+
+    Lookup group[GROUP];
+    size_t active = 0;
+    size_t next_key = 0;
+
+    auto start = [&](Lookup& lookup) {
+        lookup.index = next_key++;
+        lookup.node = root_.load(memory_order_acquire);
+        lookup.depth = 0;
+    };
+    while (active < GROUP && next_key < count) start(group[active++]);
+    auto retry = [&](size_t index) {
+        if (expires_at) expires_at[index] = 0; // get() leaves it alone on a miss
+        return get(keys[index], expires_at ? &expires_at[index] : nullptr);
+    };
+    auto deadline = [&](size_t index, uint64_t value) {
+        if (expires_at) expires_at[index] = value;
+    };
+    // Also clears the deadline, so a reused output keeps none from before
+    auto miss = [&](size_t index) {
+        out[index].reset();
+        deadline(index, 0);
+    };
+
+    while (active > 0) {
+        for (size_t s = 0; s < active;) {
+            Lookup& lookup = group[s];
+            string_view key = keys[lookup.index];
+            optional<string>& result = out[lookup.index];
+            const Node* current = lookup.node;
+            bool done = true;
+
+            // One step of the same optimistic walk as get(). Any validation
+            // failure hands the key over to get(), which retries on its own.
+            lookup.version = current->version.load(memory_order_acquire);
+            string_view prefix = current->prefix();
+            if (lookup.version & 1) {
+                result = retry(lookup.index);
+            } else if (key.substr(lookup.depth, prefix.length()) != prefix) {
+                atomic_thread_fence(memory_order_acquire);
+                if (current->version.load(memory_order_relaxed) != lookup.version) result = retry(lookup.index);
+                else miss(lookup.index);
+            } else if (lookup.depth + prefix.length() == key.length()) {
+                ValueKind kind = current->value_kind;
+                uint32_t len = current->value_len;
+                char bytes[SCRATCH_BYTES];
+                memcpy(bytes, current->inline_value, INLINE_BYTES);
+                atomic_thread_fence(memory_order_acquire);
+                if (current->version.load(memory_order_relaxed) != lookup.version) {
+                    result = retry(lookup.index);
+                } else if (kind == ValueKind::None) {
+                    miss(lookup.index);
+                } else if (kind == ValueKind::Inline) {
+                    assignValue(result, bytes, len);
+                    deadline(lookup.index, 0);
+                    touch(current);
+                } else if (kind == ValueKind::Integer) {
+                    assignValue(result, bytes, spellInteger(bytes, bytes));
+                    deadline(lookup.index, 0);
+                    touch(current);
+                } else {
+                    const ValueBlock* block;
+                    memcpy(&block, bytes, sizeof(block));
+                    assignBlock(result, block);
+                    deadline(lookup.index, block->expires_at);
+                    touch(current);
+                }
+            } else {
+                size_t depth = lookup.depth + prefix.length();
+                Node* const* slot = findChild(current, static_cast<uint8_t>(key[depth]));
+                const Node* child = slot ? *slot : nullptr;
+                atomic_thread_fence(memory_order_acquire);
+                if (current->version.load(memory_order_relaxed) != lookup.version) {
+                    result = retry(lookup.index);
+                } else if (!child) {
+                    miss(lookup.index);
+                } else {
+                    // Start pulling the child in now; it is read on this
+                    // lookup's next turn, after the others had theirs.
+                    TRIE_PREFETCH(child);
+                    lookup.node = child;
+                    lookup.depth = depth + 1;
+                    done = false;
+                }
+            }
+
+            if (!done) {
+                ++s;
+            } else if (next_key < count) {
+                start(lookup); // Refill the slot and give it its turn next round
+                TRIE_PREFETCH(lookup.node);
+                ++s;
+            } else {
+                group[s] = group[--active];
+            }
+        }
+    }
+}
@@ -1,39 +1,572 @@
 #pragma once
 
+#include "arena.hpp"
+#include "epoch.hpp"
+#include "hash_index.hpp"
+#include "metrics.hpp"
+#include "value_codec.hpp"
 #include <string>
 #include <string_view>
 #include <memory>
 #include <vector>
 #include <optional>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <set>
 using namespace std;
 
-// The number of possible characters in a key (A-Z, a-z, etc.)
-constexpr int ALPHABET_SIZE = 58;
+// How keys are ranked for eviction. Reads and writes leave a mark on the
+// key they reach; Trie::evictionVictim() picks by it.
+enum class EvictionPolicy : uint8_t {
+    None,  // No marks, no victims
+    Lru,   // Least recently used of a few randomly sampled keys
+    Clock, // First key without its reference bit, swept in key order
+    Lfu,   // Least frequently used of a few sampled keys; counts decay
+};
 
+// A value read without copying it out of the trie (Trie::getHandle,
+// KVStore::getHandle). view() stays valid and unchanged for the handle's
+// lifetime, even if the key is overwritten or removed meanwhile: the handle
+// holds a count on the value's block, and a retired block is not recycled
+// until its count is back to zero. Values short enough to live inside
+// their node, and values stored in a compact encoding (which have to be
+// decoded anyway), are copied into the handle instead.
+//
+// A handle must not outlive the trie (or store) it came from.
+class ValueHandle {
+public:
+    ValueHandle() = default;
+    explicit ValueHandle(string value) : owned_(move(value)), has_value_(true) {}
+    ValueHandle(ValueHandle&& other) noexcept;
+    ValueHandle& operator=(ValueHandle&& other) noexcept;
+    ~ValueHandle() { release(); }
+
+    ValueHandle(const ValueHandle&) = delete;
+    ValueHandle& operator=(const ValueHandle&) = delete;
+
+    bool has_value() const { return has_value_; }
+    explicit operator bool() const { return has_value_; }
+    string_view view() const { return holds_ ? view_ : string_view(owned_); }
+    string_view operator*() const { return view(); }
+
+private:
+    friend class Trie;
+    ValueHandle(atomic<uint32_t>* holds, string_view view) : holds_(holds), view_(view), has_value_(true) {}
+    void release();
+
+    atomic<uint32_t>* holds_ = nullptr; // The block's count; null if owned_
+    string_view view_;
+    string owned_;
+    bool has_value_ = false;
+};
+
+// Adaptive Radix Tree (ART) over raw key bytes.
+//
+// Keys may contain any byte 0-255 (digits, '_', ':', UTF-8, ...). Inner nodes
+// pick the smallest layout that fits their fan-out and are grown/shrunk as
+// children come and go:
+//   Node0   - leaf, no children
+//   Node4   - up to 4 children, sorted key bytes
+//   Node16  - up to 16 children, sorted key bytes, searched with SIMD
+//   Node48  - up to 48 children, 256-entry byte -> slot index
+//   Node256 - direct 256-entry child array
+//
+// The byte that selects a child lives in the parent; the child's prefix
+// holds the rest of its edge (path compression).
+//
+// Memory: nodes come from a per-trie slab arena. Edge labels and values of
+// up to INLINE_BYTES live inside the node itself (a leaf is one 64-byte
+// block); longer ones get a block of their own, values from a separate
+// value arena. Destroying the trie frees the arenas' slabs, not each node.
+//
+// Concurrency: `get` is lock-free and may run alongside one writer. Every
+// node carries a version counter (optimistic lock coupling): writers lock
+// just the nodes they modify in place, readers validate the versions they
+// passed and restart if one changed. A node whose prefix or layout changes
+// is replaced by a fresh copy instead, and the old one is retired to its
+// arena, which recycles it only once EpochManager says no reader can still
+// see it. Writers (put/remove) and the ordered reads (getNth/removeNth/size)
+// still need external mutual exclusion among themselves.
+//
+// Versions: pin() freezes the current tree in O(1). Every node and value
+// block records the generation it was created in, and pinning starts a new
+// generation; a writer that is about to modify a node from a pinned
+// generation copies it (and so the path above it) instead. The pinned
+// version is therefore never modified in place, and its readers need no
+// locks at all. Nodes replaced while pinned versions can still reach them
+// wait on a deferred list until the last such pin is released.
+//
+// Eviction: each node has a 16-bit access mark that readers update with a
+// relaxed store - and only when it changes, so a hot key does not keep
+// dirtying its cache line. Recency is measured on a logical clock that
+// ticks every ACCESS_TICK_WRITES writes, not on wall time, so marking costs
+// no clock read.
 class Trie {
+    struct Node; // Defined below; iterators hold pointers to it
+
 public:
     Trie();
-    
-    // Public API for the data structure
-    bool put(string_view key, string_view value);
-    optional<string> get(string_view key) const;
-    bool remove(string_view key);
+    ~Trie() = default;
+
+    // The tree owns raw node memory, so copying is not allowed.
+    Trie(const Trie&) = delete;
+    Trie& operator=(const Trie&) = delete;
+
+    // Public API for the data structure.
+    //
+    // A value may carry a deadline (`expires_at`, 0 for none). The trie
+    // only stores it - callers compare it against their own clock - and
+    // reports it on reads and for the value a put/remove replaced.
+    bool put(string_view key, string_view value, uint64_t expires_at = 0, uint64_t* old_expires_at = nullptr);
+    optional<string> get(string_view key, uint64_t* expires_at = nullptr) const;
+    bool remove(string_view key, uint64_t* old_expires_at = nullptr);
     optional<pair<string, string>> getNth(size_t n) const;
     bool removeNth(size_t n);
 
+    // Bulk loading. build() fills a new, empty trie from `count` entries
+    // sorted by key, none repeated, bottom-up in one pass: each node is
+    // created once, at its final layout and with its final count, instead
+    // of being split and grown a key at a time. Not for a shared trie.
+    void build(const pair<string_view, string_view>* entries, size_t count);
+
+    // Replaces this trie's contents with `other`'s (typically just built),
+    // taking over its arenas and leaving it empty. Lock-free readers switch
+    // over with one pointer store; the old tree is retired like any
+    // replaced node, so they and pinned versions can go on reading it.
+    // Writers must be kept out.
+    void replaceWith(Trie& other);
+
+    // Atomic read-modify-write of one key, in the same single walk as put():
+    // on reaching the key, calls fn(current, expires_at) with its value
+    // (nullopt if it has none) and deadline (0 if none). fn returns the
+    // value to store - the view must hold until update() returns - with
+    // `expires_at` set to its deadline, or nullopt to leave the key as it
+    // is. Returns whether a value was stored. A writer, like put(). While a
+    // snapshot is pinned, fn runs before the walk that copies shared nodes,
+    // so an update it declines copies nothing.
+    template <typename Fn>
+    bool update(string_view key, Fn&& fn);
+
+    // get() without the copy: see ValueHandle. Lock-free like get().
+    ValueHandle getHandle(string_view key, uint64_t* expires_at = nullptr) const;
+
+    // Calls fn(value, expires_at) with the value of `key` where it lies, if
+    // there is one, and returns whether there was. Takes no count on the
+    // value, so a hot key's block is not written by every reader; instead
+    // fn runs inside an EpochGuard and should be brief.
+    template <typename Fn>
+    bool visit(string_view key, Fn&& fn) const;
+
+    // Looks up `count` keys at once, writing the results to out[0..count).
+    // Several lookups walk the tree in lockstep, each prefetching its next
+    // node, so their cache misses overlap instead of running back to back.
+    // Entries of `out` are assigned in place and reuse their string capacity.
+    // With `expires_at`, deadlines go to expires_at[0..count), 0 for a miss.
+    void multiGet(const string_view* keys, size_t count, optional<string>* out, uint64_t* expires_at = nullptr) const;
+
+    // Whether `key` has a value, and its deadline. Writers must be kept out.
+    bool contains(string_view key, uint64_t* expires_at = nullptr) const;
+
+    // Number of keys currently stored.
+    size_t size() const;
+
+    // Node counts, memory use and structural events (see TrieStats). Like
+    // size(), writers must be kept out for a consistent answer.
+    TrieStats stats() const;
+
+    // Bytes held by the current tree: nodes, long labels and value blocks.
+    // Unlike stats() this is always maintained. Writers must be kept out.
+    size_t memoryUsage() const { return bytes_; }
+
+    // Starts marking accesses for `policy`; sampled policies look at
+    // `samples` keys per victim. Set before the trie is shared.
+    void setEvictionPolicy(EvictionPolicy policy, size_t samples);
+
+    // The key to evict next, or nullopt if empty or without a policy. The
+    // caller removes it. Writers must be kept out.
+    optional<string> evictionVictim();
+
+    // Lets writers store values in compact encodings from `codec` (see
+    // ValueCodec): decimal integers too long to be inline raw are packed
+    // into 8 bytes inside the node, and values in blocks of their own are
+    // compressed where that saves enough. Reads decode them, so getHandle()
+    // hands out a copy of such a value and visit() a view of a decoded
+    // one. Call before the trie is shared; `codec` must outlive it, and any
+    // trie passed to replaceWith() must use the same one.
+    void setValueCodec(ValueCodec* codec) { codec_ = codec; }
+
+    // Adds a hash index over the keys (see HashIndex), kept in step by
+    // every write. get(), getHandle(), visit() and multiGet() then find a
+    // key with one hash probe instead of walking the tree; ordered reads
+    // and pinned versions still use the tree. Call before the trie is
+    // shared, and not together with an eviction policy: reads through the
+    // index leave no access marks on the nodes.
+    void enableHashIndex();
+
+    // Number of keys strictly less than `key`, i.e. its rank if present.
+    // Like getNth, cost is bounded by key length times node fan-out.
+    size_t rank(string_view key) const;
+
+    // Ordered iterator over keys and values. It points straight into the
+    // nodes, so - like getNth - it is only valid while writers are kept out.
+    class Iterator {
+    public:
+        bool valid() const { return current_ != nullptr; }
+        string_view key() const { return key_; }
+        // Valid until next(); a value in a compact encoding is decoded
+        string_view value() const { return nodeValue(codec_, current_, buffer_); }
+        uint64_t expiresAt() const { return current_->expiresAt(); }
+
+        // Steps to the next key in the iterator's direction.
+        void next();
+
+    private:
+        friend class Trie;
+
+        struct Frame {
+            const Node* node;
+            size_t key_len;  // Length of key_ up to and including this node's prefix
+            int last_byte;   // Last child byte visited (-1 / 256 before the first)
+            bool value_done; // Whether this node's own value has been passed
+        };
+
+        Iterator(bool forward, const ValueCodec* codec) : forward_(forward), codec_(codec) {}
+
+        vector<Frame> stack_;
+        string key_;
+        const Node* current_ = nullptr;
+        bool forward_;
+        const ValueCodec* codec_;
+        mutable string buffer_; // The current value, if it had to be decoded
+    };
+
+    // Iterator at the smallest key (forward) or the largest key (backward).
+    Iterator begin(bool forward = true) const;
+
+    // Iterator at the first key >= `key` (forward) or the last key <= `key`
+    // (backward).
+    Iterator seek(string_view key, bool forward = true) const;
+
+    // Labels and values up to this many bytes are stored inside the node.
+    static constexpr size_t INLINE_BYTES = 16;
+
+    // Writes per tick of the access clock.
+    static constexpr uint64_t ACCESS_TICK_WRITES = 64;
+
+    // A frozen version of the trie with its full read API. Nothing it can
+    // reach is modified or freed while it exists, so it needs no locks and
+    // never holds up writers. It must not outlive the trie.
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&& other) noexcept;
+        Snapshot& operator=(Snapshot&& other) noexcept;
+        ~Snapshot();
+
+        optional<string> get(string_view key, uint64_t* expires_at = nullptr) const;
+        optional<pair<string, string>> getNth(size_t n) const;
+        size_t size() const;
+        size_t rank(string_view key) const;
+        Iterator begin(bool forward = true) const;
+        Iterator seek(string_view key, bool forward = true) const;
+
+    private:
+        friend class Trie;
+        Snapshot(const Trie* trie, const Node* root, uint32_t generation)
+            : trie_(trie), root_(root), generation_(generation), codec_(trie->codec_) {}
+        void release();
+
+        const Trie* trie_;
+        const Node* root_;
+        uint32_t generation_;
+        const ValueCodec* codec_;
+    };
+
+    // Pins the current version. Writers must be kept out for the call (a
+    // shared lock is enough); afterwards they may proceed freely.
+    Snapshot pin() const;
+
 private:
-    struct TrieNode {
-        unique_ptr<TrieNode> children[ALPHABET_SIZE];
-        string edge_label; // The part of the key this node represents
-        optional<string> value; // The actual value stored, if this is a terminal node
-        size_t descendants = 0; // Count of terminal nodes in this subtree for Nth element search
+    enum class NodeType : uint8_t { Node0, Node4, Node16, Node48, Node256 };
+    // Integer: a decimal integer longer than INLINE_BYTES (with a codec),
+    // held in the node as its 8-byte binary value.
+    enum class ValueKind : uint8_t { None, Inline, Heap, Integer };
+
+    // Out-of-line value storage; immutable once published. Values with a
+    // deadline always live here, whatever their size.
+    struct ValueBlock {
+        static constexpr uint32_t WITH_DICTIONARY = 1u << 31;
+
+        uint32_t size;       // Bytes stored
+        uint32_t birth;      // Generation it was created in
+        uint64_t expires_at; // 0: never
+        mutable atomic<uint32_t> holds{0}; // Live ValueHandles on it
+        // Compressed: the value's own size, | WITH_DICTIONARY if decoding
+        // needs the codec's dictionary. 0: the bytes are the value.
+        uint32_t raw_size = 0;
+        const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+        char* data() { return reinterpret_cast<char*>(this + 1); }
+        bool compressed() const { return raw_size != 0; }
+        uint32_t valueSize() const { return compressed() ? raw_size & ~WITH_DICTIONARY : size; }
+    };
+
+    struct Node {
+        NodeType type;
+        ValueKind value_kind = ValueKind::None;
+        uint16_t num_children = 0;
+        uint32_t prefix_len = 0;
+        uint16_t value_len = 0; // Length of an inline value
+        // Eviction mark: a CLOCK reference bit, an LRU clock stamp, or an
+        // LFU decay stamp (high byte) and log counter (low byte).
+        mutable atomic<uint16_t> access{0};
+        uint32_t birth = 0;     // Generation it was created in
+        // Optimistic lock: odd while a writer holds it, and odd forever once
+        // the node has been replaced (obsolete).
+        atomic<uint64_t> version{0};
+        size_t descendants = 0; // Count of values in this subtree (including this node)
+        // The rest of the edge after the byte stored in the parent. Never
+        // changes after the node is published.
+        union {
+            char inline_prefix[INLINE_BYTES];
+            const char* heap_prefix;
+        };
+        // The actual value stored, if this is a terminal node
+        union {
+            char inline_value[INLINE_BYTES];
+            ValueBlock* heap_value;
+        };
+
+        explicit Node(NodeType t) : type(t) {}
 
-        TrieNode(string_view label) : edge_label(label) {}
+        string_view prefix() const {
+            return string_view(prefix_len <= INLINE_BYTES ? inline_prefix : heap_prefix, prefix_len);
+        }
+        bool hasValue() const { return value_kind != ValueKind::None; }
+        uint64_t expiresAt() const { return value_kind == ValueKind::Heap ? heap_value->expires_at : 0; }
     };
 
-    unique_ptr<TrieNode> root_;
+    struct Node0 : Node {
+        Node0() : Node(NodeType::Node0) {}
+    };
+
+    struct Node4 : Node {
+        uint8_t keys[4];
+        Node* children[4] = {};
+        Node4() : Node(NodeType::Node4) {}
+    };
+
+    struct Node16 : Node {
+        uint8_t keys[16];
+        Node* children[16] = {};
+        Node16() : Node(NodeType::Node16) {}
+    };
+
+    struct Node48 : Node {
+        static constexpr uint8_t EMPTY = 48;
+        uint8_t child_index[256];
+        Node* children[48] = {};
+        Node48();
+    };
+
+    struct Node256 : Node {
+        Node* children[256] = {};
+        Node256() : Node(NodeType::Node256) {}
+    };
+
+    // Prepared value storage, built before a node lock is taken so the
+    // critical section is just a few stores.
+    struct ValueData {
+        ValueKind kind = ValueKind::None;
+        uint32_t len = 0;
+        char inline_bytes[INLINE_BYTES];
+        ValueBlock* block = nullptr;
+    };
+
+    SlabArena node_arena_;  // Nodes and long edge labels
+    SlabArena value_arena_; // Values longer than INLINE_BYTES
+    ValueCodec* codec_ = nullptr; // Null: values stored as given
+    string pack_buffer_;          // The writer's compression output
+    // Optional index from whole keys to their values' storage. A value's
+    // ValueData never changes while it is current (an overwrite prepares a
+    // new one), so node copies and layout changes leave the index alone.
+    HashIndex<ValueData> index_;
+    bool indexed_ = false;
+    atomic<Node*> root_;
+    TrieStats counters_;    // Maintained by writers when KV_ENABLE_METRICS
+    size_t bytes_ = 0;      // See memoryUsage()
+
+    // Eviction state. The policy is fixed before readers arrive; the rest
+    // belongs to the writer, except the clock, which readers load.
+    EvictionPolicy policy_ = EvictionPolicy::None;
+    size_t samples_ = 5;
+    uint64_t writes_ = 0;
+    atomic<uint32_t> access_clock_{0};
+    uint64_t random_ = 0x9e3779b97f4a7c15ULL; // Sampling state (xorshift)
+    string clock_hand_;                         // CLOCK resumes its sweep here
+
+    // Memory unlinked from the current tree while a pinned version could
+    // still reach it. Pinned version g sees it iff birth <= g < retired_at.
+    struct Deferred {
+        SlabArena* arena;
+        void* ptr;
+        size_t size;
+        uint32_t birth;
+        uint32_t retired_at;
+        const atomic<uint32_t>* holds; // See SlabArena::retire
+    };
+
+    // Version bookkeeping. pin() runs concurrently with other pins (under
+    // the caller's shared lock) and release() from any thread, so the
+    // registry has a mutex of its own; writers only read `newest_pin_`
+    // once per operation and sweep `deferred_` after a release.
+    mutable mutex pins_mutex_;
+    mutable multiset<uint32_t> pins_;            // Generations of live pins
+    mutable atomic<uint32_t> generation_{0};     // Birth of nodes created now
+    mutable atomic<int64_t> newest_pin_{-1};     // Max of pins_, -1 if none
+    mutable atomic<bool> pins_released_{false};  // deferred_ may be sweepable
+    mutable bool written_since_pin_ = true;      // Under pins_mutex_ for pin()
+    int64_t write_pin_ = -1;                     // newest_pin_ as of this write
+    vector<Deferred> deferred_;
+
+    // Eviction marks
+    void touch(const Node* node) const;
+    uint32_t coldness(const Node* node, uint32_t clock) const;
+    optional<string> clockVictim();
+    // A key reached by a random walk from the root, into `key`.
+    const Node* randomNode(const Node* root, string& key);
+    const Node* randomChild(const Node* node, uint8_t& byte);
+
+    // Node memory management
+    static size_t nodeSize(NodeType type);
+    Node* newNode(NodeType type, string_view prefix);
+    Node* makeLeaf(string_view prefix, const ValueData& data);
+    void retireNode(Node* node);
+    void retireTree(Node* node); // A whole subtree, values included
+    ValueData prepareValue(string_view value, uint64_t expires_at);
+    // The value of `node`, decoded into `buffer` if it is in a compact
+    // encoding; otherwise a view of it where it lies.
+    static string_view nodeValue(const ValueCodec* codec, const Node* node, string& buffer);
+    // A compressed block's value, written over `out`.
+    static void decompress(const ValueCodec* codec, const ValueBlock* block, string& out);
+    static void installValue(Node* node, const ValueData& data);
+    void retireValue(ValueKind kind, ValueBlock* block);
+
+    // Versioning. A node (or value block) is shared with a pinned version
+    // if it is at least as old as the newest pin.
+    void beginWrite();
+    bool isShared(uint32_t birth) const { return static_cast<int64_t>(birth) <= write_pin_; }
+    void retireShared(SlabArena& arena, void* ptr, size_t size, uint32_t birth,
+                      const atomic<uint32_t>* holds = nullptr);
+    void sweepDeferred();
+    // Returns `node`, or a private copy linked in its place if it is shared.
+    Node* writable(Node* parent, Node** slot, Node* node);
+
+    // Room for an inline value, or a packed integer spelled out.
+    static constexpr size_t SCRATCH_BYTES = 24;
+
+    // The optimistic lookup behind get(), getHandle() and visit(); the
+    // caller holds an EpochGuard. `value` ends up in `scratch` (an inline
+    // value or integer, copied out before validation) or in `block`, its
+    // heap block - still compressed, if the block is. With the hash
+    // index, an inline value is viewed in its index entry.
+    bool findValue(string_view key, char* scratch, string_view& value, const ValueBlock*& block) const;
+    static void viewValue(const ValueData& data, char* scratch, string_view& value, const ValueBlock*& block);
+
+    // Read algorithms shared by the live tree and pinned versions
+    static const Node* findNode(const Node* root, string_view key);
+    static optional<pair<string, string>> getNthFrom(const ValueCodec* codec, const Node* root, size_t n);
+    static size_t rankFrom(const Node* root, string_view key);
+    static Iterator beginFrom(const ValueCodec* codec, const Node* root, bool forward);
+    static Iterator seekFrom(const ValueCodec* codec, const Node* root, string_view key, bool forward);
+
+    // Optimistic lock coupling primitives
+    static void writeLock(Node* node);
+    static void writeUnlock(Node* node);
+    static void markObsolete(Node* node);
+
+    // Child lookup for every node layout
+    static Node* const* findChild(const Node* node, uint8_t byte);
+    static Node** findChild(Node* node, uint8_t byte);
+
+    // Raw layout edits; only valid on unpublished or write-locked nodes
+    static void insertChild(Node* node, uint8_t byte, Node* child);
+    static void eraseChild(Node* node, uint8_t byte);
+
+    // Copies: the originals stay intact for concurrent readers
+    Node* copyNode(const Node* node, string_view prefix);
+    Node* grow(const Node* node);
+    Node* shrink(const Node* node, uint8_t skip_byte);
+    static void copyHeader(Node* to, const Node* from);
+    static bool isFull(const Node* node);
+    static bool isUnderfullAfterErase(const Node* node);
+
+    // Publishing changes. `parent`/`slot` locate the pointer to `node`;
+    // both are null when `node` is the root.
+    void replaceNode(Node* parent, Node** slot, Node* old_node, Node* replacement);
+    void addChild(Node* parent, Node** slot, Node* node, uint8_t byte, Node* child);
+    void removeChild(Node* parent, Node** slot, Node* node, uint8_t byte);
+
+    // The closest child after `after` (forward) or before it (backward).
+    static bool adjacentChild(const Node* node, int after, bool forward, uint8_t& byte, const Node*& child);
+
+    // Calls fn(byte, child) for every child in ascending byte order.
+    template <typename Fn>
+    static void forEachChild(const Node* node, Fn&& fn);
+
+    // update() without its template: fn behind a function pointer
+    using Updater = optional<string_view> (*)(void* context, optional<string_view> current, uint64_t& expires_at);
+    bool updateWith(string_view key, Updater updater, void* context);
+
+    // What insertHelper installs: a value prepared before the walk (put),
+    // or one an updater derives from the key's current value on arrival.
+    struct Install {
+        ValueData data;
+        Updater updater = nullptr;
+        void* context = nullptr;
+        uint64_t* old_expires_at = nullptr; // Deadline of the value replaced
+        bool stored = false;
+    };
+    // Runs the updater on the value at `node` (null: the key has no node)
+    // and prepares what it returns in install.data. False: it declined.
+    bool decide(Install& install, const Node* node);
+    // Settles install.data where the key was found (`node`, null if it has
+    // no node) and enters it in the index. False: the updater declined.
+    bool resolve(Install& install, string_view key, const Node* node);
 
     // Private helper methods for recursive operations
-    bool removeHelper(TrieNode* node, string_view key);
-    size_t findMismatch(string_view s1, string_view s2) const;
-};
\ No newline at end of file
+    bool insertHelper(Node* parent, Node** slot, Node* node, string_view key, size_t depth, Install& install);
+    bool removeHelper(Node* parent, Node** slot, Node* node, string_view key, size_t depth, uint64_t* old_expires_at);
+    // The subtree for sorted `entries`, all sharing key[0, depth). The root
+    // keeps an empty prefix; below it each node takes the longest one its
+    // range shares. `runs` is scratch space for the recursion.
+    Node* buildNode(const pair<string_view, string_view>* entries, size_t count, size_t depth, bool is_root,
+                    vector<const pair<string_view, string_view>*>& runs);
+    static size_t findMismatch(string_view s1, string_view s2);
+};
+
+template <typename Fn>
+bool Trie::update(string_view key, Fn&& fn) {
+    using Callable = remove_reference_t<Fn>;
+    Updater updater = [](void* context, optional<string_view> current, uint64_t& expires_at) {
+        return optional<string_view>((*static_cast<Callable*>(context))(current, expires_at));
+    };
+    return updateWith(key, updater, const_cast<void*>(static_cast<const void*>(addressof(fn))));
+}
+
+template <typename Fn>
+bool Trie::visit(string_view key, Fn&& fn) const {
+    EpochGuard guard;
+    char scratch[SCRATCH_BYTES];
+    string_view value;
+    const ValueBlock* block = nullptr;
+    if (!findValue(key, scratch, value, block)) return false;
+    uint64_t expires_at = block ? block->expires_at : 0;
+    if (block && block->compressed()) {
+        string decoded;
+        decompress(codec_, block, decoded);
+        fn(string_view(decoded), expires_at);
+        return true;
+    }
+    fn(value, expires_at);
+    return true;
+}
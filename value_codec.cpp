@@ -0,0 +1,269 @@
+#include "value_codec.hpp"
+#include <algorithm>
+#include <cstring>
+#include <queue>
+using namespace std;
+
+// Compressed format: a run of sequences, each a token byte - literal count
+// in the high nibble, match length minus MIN_MATCH in the low one, 15
+// meaning "more in following bytes, 255 at a time" - then the literals,
+// then a 2-byte little-endian offset back into the output (or past its
+// start into the dictionary) and any extra match length. The last
+// sequence stops after its literals.
+
+namespace {
+
+constexpr size_t MIN_MATCH = 4;
+constexpr size_t MAX_OFFSET = 65535;
+constexpr int HASH_BITS = 12;            // Per-value match table
+constexpr int DICTIONARY_HASH_BITS = 14; // Dictionary match table
+
+uint32_t read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t hash4(uint32_t sequence, int bits) { return (sequence * 2654435761u) >> (32 - bits); }
+
+// Positions of recent 4-byte sequences, kept per thread and never cleared
+// between values: an entry holds base + position + 1, and each value gets
+// a base above every entry an earlier one could have left.
+struct MatchTable {
+    uint32_t slots[1 << HASH_BITS] = {};
+    uint32_t base = 0;
+};
+
+void putLength(string& out, size_t extra) {
+    for (; extra >= 255; extra -= 255) out.push_back(static_cast<char>(255));
+    out.push_back(static_cast<char>(extra));
+}
+
+// match_len 0: the closing sequence, literals only
+void putSequence(string& out, const char* literals, size_t literal_len, size_t offset, size_t match_len) {
+    size_t literal_code = min<size_t>(literal_len, 15);
+    size_t match_code = match_len > 0 ? min<size_t>(match_len - MIN_MATCH, 15) : 0;
+    out.push_back(static_cast<char>(literal_code << 4 | match_code));
+    if (literal_code == 15) putLength(out, literal_len - 15);
+    out.append(literals, literal_len);
+    if (match_len == 0) return;
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match_code == 15) putLength(out, match_len - MIN_MATCH - 15);
+}
+
+size_t getLength(const unsigned char*& in, size_t code) {
+    if (code != 15) return code;
+    unsigned char byte;
+    do {
+        byte = *in++;
+        code += byte;
+    } while (byte == 255);
+    return code;
+}
+
+} // namespace
+
+bool ValueCodec::compress(string_view value, string& out, bool& with_dictionary) {
+    const size_t n = value.size();
+    if (mode_ == ValueCompression::None || n < MIN_COMPRESS_BYTES || n > (size_t(1) << 30)) return false;
+    if (mode_ == ValueCompression::Dictionary && sampling_.load(memory_order_relaxed)) addSample(value);
+    const Dictionary* dictionary = dictionary_.load(memory_order_acquire);
+    if (dictionary && dictionary->bytes.empty()) dictionary = nullptr;
+
+    thread_local MatchTable table;
+    if (table.base > UINT32_MAX - n - 1) {
+        memset(table.slots, 0, sizeof(table.slots));
+        table.base = 0;
+    }
+    const uint32_t base = table.base;
+    table.base += static_cast<uint32_t>(n) + 1;
+
+    const char* src = value.data();
+    const size_t budget = n - n / 8; // Larger than this is not worth keeping
+    out.clear();
+    with_dictionary = false;
+    size_t anchor = 0; // Start of the literals not yet written
+    size_t i = 0;
+    unsigned misses = 0;
+    while (i + MIN_MATCH <= n) {
+        uint32_t sequence = read32(src + i);
+        uint32_t& slot = table.slots[hash4(sequence, HASH_BITS)];
+        uint32_t entry = slot;
+        slot = base + static_cast<uint32_t>(i) + 1;
+
+        size_t match_len = 0, offset = 0;
+        if (entry > base) {
+            size_t candidate = entry - base - 1;
+            if (i - candidate <= MAX_OFFSET && read32(src + candidate) == sequence) {
+                match_len = MIN_MATCH;
+                while (i + match_len < n && src[candidate + match_len] == src[i + match_len]) ++match_len;
+                offset = i - candidate;
+            }
+        }
+        if (match_len == 0 && dictionary) {
+            uint32_t found = dictionary->table[hash4(sequence, DICTIONARY_HASH_BITS)];
+            const string& bytes = dictionary->bytes;
+            size_t position = found - 1;
+            if (found != 0 && bytes.size() - position + i <= MAX_OFFSET && read32(bytes.data() + position) == sequence) {
+                match_len = MIN_MATCH;
+                while (i + match_len < n && position + match_len < bytes.size() &&
+                       bytes[position + match_len] == src[i + match_len]) {
+                    ++match_len;
+                }
+                offset = bytes.size() - position + i;
+                with_dictionary = true;
+            }
+        }
+        if (match_len == 0) {
+            // Skip ahead faster through data that keeps not matching
+            i += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+        putSequence(out, src + anchor, i - anchor, offset, match_len);
+        i += match_len;
+        anchor = i;
+        if (out.size() >= budget) return false;
+    }
+    putSequence(out, src + anchor, n - anchor, 0, 0);
+    return out.size() <= budget;
+}
+
+void ValueCodec::decompress(string_view compressed, bool with_dictionary, char* out) const {
+    const auto* in = reinterpret_cast<const unsigned char*>(compressed.data());
+    const auto* end = in + compressed.size();
+    const Dictionary* dictionary = with_dictionary ? dictionary_.load(memory_order_acquire) : nullptr;
+    char* op = out;
+    while (in < end) {
+        unsigned token = *in++;
+        size_t literal_len = getLength(in, token >> 4);
+        memcpy(op, in, literal_len);
+        op += literal_len;
+        in += literal_len;
+        if (in >= end) break;
+
+        size_t offset = static_cast<size_t>(in[0]) | static_cast<size_t>(in[1]) << 8;
+        in += 2;
+        size_t match_len = getLength(in, token & 15) + MIN_MATCH;
+        size_t produced = static_cast<size_t>(op - out);
+        if (offset > produced) {
+            // Starts in the dictionary, and may run on into the output
+            size_t back = offset - produced;
+            size_t take = min(match_len, back);
+            memcpy(op, dictionary->bytes.data() + dictionary->bytes.size() - back, take);
+            op += take;
+            match_len -= take;
+            if (match_len == 0) continue;
+        }
+        const char* from = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, from, match_len);
+            op += match_len;
+        } else {
+            // Overlapping: a run that repeats its own start
+            for (size_t k = 0; k < match_len; ++k) *op++ = from[k];
+        }
+    }
+}
+
+size_t ValueCodec::dictionarySize() const {
+    const Dictionary* dictionary = dictionary_.load(memory_order_acquire);
+    return dictionary ? dictionary->bytes.size() : 0;
+}
+
+void ValueCodec::addSample(string_view value) {
+    // Long values say no more about the common shape than their start
+    constexpr size_t MAX_SAMPLE = 1024;
+    lock_guard lock(sample_mutex_);
+    if (!sampling_.load(memory_order_relaxed)) return;
+    samples_.emplace_back(value.substr(0, MAX_SAMPLE));
+    sample_bytes_ += samples_.back().size();
+    if (sample_bytes_ < DICTIONARY_SAMPLE_BYTES) return;
+    owned_dictionary_ = train(samples_);
+    dictionary_.store(owned_dictionary_.get(), memory_order_release);
+    sampling_.store(false, memory_order_relaxed);
+    samples_ = vector<string>();
+}
+
+unique_ptr<ValueCodec::Dictionary> ValueCodec::train(const vector<string>& samples) {
+    // Segments of the samples are scored by their 8-byte sequences, each
+    // worth the number of samples it appears in (if more than one). The
+    // best segment goes in and its sequences stop counting, so the next
+    // pick covers something else; scores only ever drop, so a stale score
+    // at the top of the heap just gets recomputed.
+    constexpr size_t K = 8;
+    constexpr size_t SEGMENT = 64;
+    constexpr size_t STEP = 16;
+    constexpr int FREQUENCY_BITS = 18;
+    vector<uint32_t> frequency(size_t(1) << FREQUENCY_BITS);
+    vector<uint32_t> seen_in(size_t(1) << FREQUENCY_BITS, UINT32_MAX);
+    auto sequenceAt = [](const char* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return static_cast<size_t>((v * 0x9E3779B97F4A7C15ULL) >> (64 - FREQUENCY_BITS));
+    };
+    for (uint32_t s = 0; s < samples.size(); ++s) {
+        const string& sample = samples[s];
+        for (size_t j = 0; j + K <= sample.size(); ++j) {
+            size_t h = sequenceAt(sample.data() + j);
+            if (seen_in[h] == s) continue;
+            seen_in[h] = s;
+            frequency[h]++;
+        }
+    }
+
+    struct Candidate {
+        uint64_t score;
+        uint32_t sample;
+        uint32_t offset;
+        bool operator<(const Candidate& other) const { return score < other.score; }
+    };
+    auto segmentOf = [&](const Candidate& c) {
+        return string_view(samples[c.sample]).substr(c.offset, SEGMENT);
+    };
+    auto score = [&](const Candidate& c) {
+        string_view segment = segmentOf(c);
+        uint64_t total = 0;
+        for (size_t j = 0; j + K <= segment.size(); ++j) {
+            uint32_t f = frequency[sequenceAt(segment.data() + j)];
+            if (f > 1) total += f;
+        }
+        return total;
+    };
+    priority_queue<Candidate> heap;
+    for (uint32_t s = 0; s < samples.size(); ++s) {
+        for (size_t offset = 0; offset + K <= samples[s].size(); offset += STEP) {
+            Candidate c{0, s, static_cast<uint32_t>(offset)};
+            c.score = score(c);
+            if (c.score > 0) heap.push(c);
+        }
+    }
+
+    vector<string_view> picked;
+    size_t total = 0;
+    while (!heap.empty() && total < DICTIONARY_BYTES) {
+        Candidate c = heap.top();
+        heap.pop();
+        c.score = score(c);
+        if (c.score == 0) continue;
+        if (!heap.empty() && c.score < heap.top().score) {
+            heap.push(c);
+            continue;
+        }
+        string_view segment = segmentOf(c).substr(0, DICTIONARY_BYTES - total);
+        for (size_t j = 0; j + K <= segment.size(); ++j) frequency[sequenceAt(segment.data() + j)] = 0;
+        picked.push_back(segment);
+        total += segment.size();
+    }
+
+    // The best segments last, nearest the data
+    auto dictionary = make_unique<Dictionary>();
+    for (auto it = picked.rbegin(); it != picked.rend(); ++it) dictionary->bytes.append(*it);
+    dictionary->table.assign(size_t(1) << DICTIONARY_HASH_BITS, 0);
+    const string& bytes = dictionary->bytes;
+    for (size_t p = 0; p + MIN_MATCH <= bytes.size(); ++p) {
+        dictionary->table[hash4(read32(bytes.data() + p), DICTIONARY_HASH_BITS)] = static_cast<uint32_t>(p) + 1;
+    }
+    return dictionary;
+}
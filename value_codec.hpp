@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+// How a store may encode values to save memory (StoreOptions::value_compression).
+enum class ValueCompression : uint8_t {
+    None,       // Values stored as given
+    Lz,         // Long decimal integers packed into 8 bytes; large values LZ-compressed
+    Dictionary, // Lz, against a dictionary trained on the first values written
+};
+
+// Compression for stored values: a byte-oriented LZ77 codec in the spirit
+// of LZ4 - greedy matching through a hash table of 4-byte sequences, 16-bit
+// offsets, no entropy stage - so a kilobyte compresses in about a
+// microsecond and decompresses faster still.
+//
+// Small values share little with themselves, so in Dictionary mode the
+// codec collects the first DICTIONARY_SAMPLE_BYTES of values it is asked
+// to compress and trains a dictionary on them: the segments whose 8-byte
+// sequences turn up in the most samples. From then on matches may also
+// reach back into the dictionary, which is how a 200-byte JSON record with
+// the same field names as its neighbours gets small. The dictionary never
+// changes once trained; values compressed before it exist are decoded
+// without it.
+//
+// Thread-safe: any number of writers may compress and readers decompress
+// at once. Training happens once, on the writer whose value completes the
+// sample.
+class ValueCodec {
+public:
+    explicit ValueCodec(ValueCompression mode) : mode_(mode) {}
+
+    ValueCodec(const ValueCodec&) = delete;
+    ValueCodec& operator=(const ValueCodec&) = delete;
+
+    // Values shorter than this are not worth a compression attempt.
+    static constexpr size_t MIN_COMPRESS_BYTES = 32;
+
+    // Dictionary mode: sample size that triggers training, and the most
+    // the dictionary may hold.
+    static constexpr size_t DICTIONARY_SAMPLE_BYTES = 128 * 1024;
+    static constexpr size_t DICTIONARY_BYTES = 16 * 1024;
+
+    ValueCompression mode() const { return mode_; }
+
+    // Replaces `out` with `value` compressed, if that saves at least an
+    // eighth of it, and returns whether it did. `with_dictionary` tells
+    // whether decompressing it needs the dictionary.
+    bool compress(string_view value, string& out, bool& with_dictionary);
+
+    // Writes what `compressed` decodes to into `out`, which must have room
+    // for the original value. The data must have come from compress() on
+    // this codec.
+    void decompress(string_view compressed, bool with_dictionary, char* out) const;
+
+    // Size of the trained dictionary; 0 before training (or if the samples
+    // shared too little to make one).
+    size_t dictionarySize() const;
+
+private:
+    struct Dictionary {
+        string bytes;
+        vector<uint32_t> table; // Hash of 4 bytes -> last position in `bytes`, plus one
+    };
+
+    void addSample(string_view value);
+    static unique_ptr<Dictionary> train(const vector<string>& samples);
+
+    ValueCompression mode_;
+    // Published once, read without a lock ever after
+    atomic<const Dictionary*> dictionary_{nullptr};
+    unique_ptr<Dictionary> owned_dictionary_;
+    atomic<bool> sampling_{true}; // Dictionary mode, until trained
+    mutex sample_mutex_;
+    vector<string> samples_;
+    size_t sample_bytes_ = 0;
+};
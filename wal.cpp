@@ -0,0 +1,339 @@
+#include "wal.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+using namespace std;
+
+namespace {
+
+constexpr size_t HEADER_BYTES = 8;            // crc32c + payload length
+constexpr size_t MAX_BUFFERED = 64 << 20;     // Writers wait once this much is queued
+
+// Record type byte. PUT and DEL match their EventType values.
+constexpr uint8_t RECORD_PUT = 0;
+constexpr uint8_t RECORD_DEL = 1;
+constexpr uint8_t RECORD_PUT_EXPIRING = 2; // Followed by a u64 deadline
+
+// CRC-32C (Castagnoli), the checksum used by ext4, iSCSI and most logs.
+uint32_t crc32c(const char* data, size_t size) {
+    uint32_t crc = ~0u;
+#if defined(__SSE4_2__)
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+    }
+    for (; size > 0; ++data, --size) {
+        crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+    }
+#else
+    static const auto table = [] {
+        array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+            t[i] = c;
+        }
+        return t;
+    }();
+    for (; size > 0; ++data, --size) {
+        crc = table[(crc ^ static_cast<uint8_t>(*data)) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+    return ~crc;
+}
+
+void putU32(char* out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out[i] = static_cast<char>(v >> (8 * i));
+}
+
+uint32_t getU32(const char* in) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(static_cast<uint8_t>(in[i])) << (8 * i);
+    return v;
+}
+
+[[noreturn]] void throwErrno(int error, const char* what) {
+    throw system_error(error, generic_category(), what);
+}
+
+// write() until everything is out, retrying short writes and EINTR.
+int writeAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return 0;
+}
+
+int syncFile(int fd) {
+#if defined(__linux__)
+    return ::fdatasync(fd) == 0 ? 0 : errno;
+#else
+    return ::fsync(fd) == 0 ? 0 : errno;
+#endif
+}
+
+} // namespace
+
+void WriteAheadLog::encode(string& out, EventType type, string_view key, string_view value, uint64_t expires_at) {
+    size_t start = out.size();
+    out.resize(start + HEADER_BYTES);
+    if (type == EventType::DEL) {
+        out.push_back(static_cast<char>(RECORD_DEL));
+    } else if (expires_at == 0) {
+        out.push_back(static_cast<char>(RECORD_PUT));
+    } else {
+        out.push_back(static_cast<char>(RECORD_PUT_EXPIRING));
+        for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(expires_at >> (8 * i)));
+    }
+    for (size_t n = key.size(); ; n >>= 7) {
+        if (n < 0x80) {
+            out.push_back(static_cast<char>(n));
+            break;
+        }
+        out.push_back(static_cast<char>((n & 0x7F) | 0x80));
+    }
+    out.append(key);
+    out.append(value);
+
+    char* header = &out[start];
+    putU32(header + 4, static_cast<uint32_t>(out.size() - start - HEADER_BYTES));
+    putU32(header, crc32c(header + 4, out.size() - start - 4));
+}
+
+LogContents WriteAheadLog::load(const string& path) {
+    LogContents contents;
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return contents;
+        throwErrno(errno, "open write-ahead log");
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        int error = errno;
+        ::close(fd);
+        throwErrno(error, "stat write-ahead log");
+    }
+    contents.data.resize(static_cast<size_t>(st.st_size));
+    size_t got = 0;
+    while (got < contents.data.size()) {
+        ssize_t n = ::read(fd, contents.data.data() + got, contents.data.size() - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += static_cast<size_t>(n);
+    }
+    contents.data.resize(got);
+
+    // Walk the records; the first one that is cut short or fails its
+    // checksum ends the log.
+    const char* data = contents.data.data();
+    size_t pos = 0;
+    while (contents.data.size() - pos >= HEADER_BYTES) {
+        const char* header = data + pos;
+        size_t length = getU32(header + 4);
+        if (length < 2 || length > contents.data.size() - pos - HEADER_BYTES) break;
+        if (crc32c(header + 4, length + 4) != getU32(header)) break;
+
+        const char* payload = header + HEADER_BYTES;
+        const char* end = payload + length;
+        auto tag = static_cast<uint8_t>(payload[0]);
+        const char* p = payload + 1;
+        if (tag > RECORD_PUT_EXPIRING) break;
+        uint64_t expires_at = 0;
+        if (tag == RECORD_PUT_EXPIRING) {
+            if (end - p < 8) break;
+            for (int i = 0; i < 8; ++i) expires_at |= static_cast<uint64_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+            p += 8;
+        }
+        size_t key_size = 0;
+        int shift = 0;
+        while (p < end && (static_cast<uint8_t>(*p) & 0x80) && shift < 63) {
+            key_size |= static_cast<size_t>(static_cast<uint8_t>(*p++) & 0x7F) << shift;
+            shift += 7;
+        }
+        if (p == end) break;
+        key_size |= static_cast<size_t>(static_cast<uint8_t>(*p++)) << shift;
+        if (key_size > static_cast<size_t>(end - p)) break;
+
+        string_view key(p, key_size);
+        string_view value(p + key_size, static_cast<size_t>(end - p) - key_size);
+        EventType type = tag == RECORD_DEL ? EventType::DEL : EventType::PUT;
+        contents.records.push_back(LogRecord{type, key, value, expires_at});
+        pos += HEADER_BYTES + length;
+    }
+
+    if (pos < static_cast<size_t>(st.st_size)) {
+        // Drop the torn tail so new records follow the last intact one.
+        if (::ftruncate(fd, static_cast<off_t>(pos)) != 0 || syncFile(fd) != 0) {
+            int error = errno;
+            ::close(fd);
+            throwErrno(error, "truncate write-ahead log");
+        }
+    }
+    ::close(fd);
+    return contents;
+}
+
+WriteAheadLog::WriteAheadLog(const string& path, FsyncPolicy policy, chrono::milliseconds fsync_interval)
+    : policy_(policy), fsync_interval_(fsync_interval) {
+    fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) throwErrno(errno, "open write-ahead log");
+
+    // LSNs continue from the end of what is already on disk.
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        int error = errno;
+        ::close(fd_);
+        throwErrno(error, "stat write-ahead log");
+    }
+    appended_ = static_cast<uint64_t>(st.st_size);
+    synced_ = appended_;
+    durable_lsn_.store(appended_, memory_order_relaxed);
+    worker_ = thread(&WriteAheadLog::run, this);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    work_.notify_one();
+    worker_.join();
+    ::close(fd_);
+}
+
+uint64_t WriteAheadLog::append(string_view encoded) {
+    unique_lock lock(mutex_);
+    space_.wait(lock, [&] { return buffer_.size() < MAX_BUFFERED || error_ != 0; });
+    if (error_ != 0) throwErrno(error_, "write-ahead log");
+    bool was_empty = buffer_.empty();
+    buffer_.append(encoded);
+    appended_ += encoded.size();
+    uint64_t lsn = appended_;
+    lock.unlock();
+    // A non-empty buffer means the log thread is already due to come back
+    // for it; only the first record of a batch needs to wake it.
+    if (was_empty) work_.notify_one();
+    return lsn;
+}
+
+void WriteAheadLog::waitDurable(uint64_t lsn) {
+    if (durable_lsn_.load(memory_order_acquire) >= lsn) return;
+    unique_lock lock(mutex_);
+    durable_.wait(lock, [&] { return durable_lsn_.load(memory_order_relaxed) >= lsn || error_ != 0; });
+    if (durable_lsn_.load(memory_order_relaxed) < lsn) throwErrno(error_, "write-ahead log");
+}
+
+void WriteAheadLog::sync() {
+    uint64_t lsn;
+    {
+        lock_guard lock(mutex_);
+        lsn = appended_;
+        sync_requested_ = max(sync_requested_, lsn);
+    }
+    work_.notify_one();
+    // Not waitDurable(): under Never, durable only means written.
+    unique_lock lock(mutex_);
+    durable_.wait(lock, [&] { return synced_ >= lsn || error_ != 0; });
+    if (synced_ < lsn) throwErrno(error_, "write-ahead log");
+}
+
+void WriteAheadLog::reset() {
+    // With appends held off, once sync() returns the log thread is idle
+    // and the file holds everything.
+    sync();
+    lock_guard lock(mutex_);
+    if (::ftruncate(fd_, 0) != 0 || syncFile(fd_) != 0) throwErrno(errno, "truncate write-ahead log");
+}
+
+void WriteAheadLog::fail(int error) {
+    lock_guard lock(mutex_);
+    if (error_ == 0) error_ = error;
+    durable_.notify_all();
+    space_.notify_all();
+}
+
+void WriteAheadLog::run() {
+    string batch;
+    uint64_t written = durable_lsn_.load(memory_order_relaxed); // LSN handed to the OS
+    uint64_t synced = written;                                  // LSN known to be on disk
+    auto last_sync = chrono::steady_clock::now();
+
+    for (;;) {
+        bool force_sync = false;
+        bool stop = false;
+        {
+            unique_lock lock(mutex_);
+            auto ready = [&] {
+                return !buffer_.empty() || sync_requested_ > synced || stopping_;
+            };
+            if (policy_ == FsyncPolicy::Interval && written > synced) {
+                // Unsynced data is waiting: come back when its interval is up.
+                work_.wait_until(lock, last_sync + fsync_interval_, ready);
+            } else {
+                work_.wait(lock, ready);
+            }
+            if (error_ != 0) return;
+            batch.swap(buffer_);
+            force_sync = sync_requested_ > synced;
+            stop = stopping_;
+        }
+        space_.notify_all();
+
+        if (!batch.empty()) {
+            if (int error = writeAll(fd_, batch.data(), batch.size())) {
+                fail(error);
+                return;
+            }
+            written += batch.size();
+            batch.clear();
+            // Buffers grown by a burst are not kept around for good.
+            if (batch.capacity() > MAX_BUFFERED) string().swap(batch);
+        }
+
+        bool do_sync = written > synced &&
+                       (force_sync || stop || policy_ == FsyncPolicy::EveryBatch ||
+                        (policy_ == FsyncPolicy::Interval &&
+                         chrono::steady_clock::now() - last_sync >= fsync_interval_));
+        if (do_sync) {
+            if (int error = syncFile(fd_)) {
+                fail(error);
+                return;
+            }
+            synced = written;
+            last_sync = chrono::steady_clock::now();
+        }
+
+        uint64_t durable = policy_ == FsyncPolicy::Never ? written : synced;
+        if (durable > durable_lsn_.load(memory_order_relaxed) || do_sync) {
+            {
+                // Under the mutex so a waiter cannot check, miss this store
+                // and then sleep through the notify.
+                lock_guard lock(mutex_);
+                durable_lsn_.store(durable, memory_order_release);
+                synced_ = synced;
+            }
+            durable_.notify_all();
+        }
+
+        if (stop) {
+            lock_guard lock(mutex_);
+            if (buffer_.empty()) return;
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "store_observer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// When the log thread forces written records onto stable storage.
+enum class FsyncPolicy {
+    EveryBatch, // After every group-commit batch: nothing acknowledged is lost
+    Interval,   // At most every fsync_interval: a crash loses that window
+    Never,      // Leave it to the OS: survives a process crash, not a power cut
+};
+
+// One change read back from the log. The views point into the buffer of
+// the LogContents that produced it.
+struct LogRecord {
+    EventType type;
+    string_view key;
+    string_view value; // Empty for DEL
+    uint64_t expires_at = 0; // PUT deadline, 0 for none
+};
+
+// Everything that survived in a log file, in the order it was written.
+struct LogContents {
+    vector<char> data;
+    vector<LogRecord> records;
+};
+
+// Binary write-ahead log with group commit.
+//
+// Writers encode their records (checksum included) on their own thread and
+// then only append bytes to a shared buffer under a short mutex. A
+// dedicated log thread swaps that buffer out, writes it with one write()
+// call and syncs it according to the FsyncPolicy. Everything that arrived
+// while it was busy goes out together in the next batch, so one fsync
+// covers as many writers as were waiting for it.
+//
+// Positions in the log are byte offsets (LSNs): append() returns the end of
+// what it added, and waitDurable(lsn) blocks until the log is durable that
+// far.
+//
+// Record layout, little-endian:
+//   u32 crc32c   - over everything after this field
+//   u32 length   - of the payload
+//   payload: u8 type | [u64 deadline] | varint key length | key | value
+//   type 0 = PUT, 1 = DEL, 2 = PUT with the deadline field
+// A record that fails its checksum or runs past the end of the file marks
+// the end of the log (a write torn by a crash); load() cuts it off.
+class WriteAheadLog {
+public:
+    // Opens (creating if needed) the log at `path` for appending. Throws
+    // system_error if it cannot be opened.
+    WriteAheadLog(const string& path, FsyncPolicy policy, chrono::milliseconds fsync_interval);
+
+    // Writes and syncs whatever is still buffered, then stops the log thread.
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Reads every intact record of the log at `path` and truncates the file
+    // after the last one. A missing file is an empty log.
+    static LogContents load(const string& path);
+
+    // Appends one record to `out` in the on-disk format. `type` is PUT or
+    // DEL; `expires_at` is a PUT's deadline, 0 for none.
+    static void encode(string& out, EventType type, string_view key, string_view value, uint64_t expires_at = 0);
+
+    // Queues records produced by encode(). Returns the LSN just past them.
+    // Throws system_error once the log thread has failed.
+    uint64_t append(string_view encoded);
+
+    // Blocks until everything up to `lsn` is durable under the policy (for
+    // Never: handed to the OS). Throws system_error if the log thread has
+    // failed to write or sync.
+    void waitDurable(uint64_t lsn);
+
+    // Makes everything appended so far durable, syncing even under the
+    // Interval and Never policies.
+    void sync();
+
+    // Empties the log once a snapshot covers everything in it. The caller
+    // must keep appends out until it returns.
+    void reset();
+
+private:
+    void run();
+    void fail(int error);
+
+    int fd_ = -1;
+    FsyncPolicy policy_;
+    chrono::milliseconds fsync_interval_;
+
+    mutex mutex_;
+    condition_variable work_;    // Log thread: new records, sync request or stop
+    condition_variable durable_; // Writers waiting for their LSN
+    condition_variable space_;   // Writers waiting for the buffer to drain
+    string buffer_;              // Appended but not yet handed to write()
+    uint64_t appended_ = 0;      // LSN at the end of buffer_
+    uint64_t sync_requested_ = 0; // sync(): LSN that must be fsynced regardless of policy
+    uint64_t synced_ = 0;         // LSN known to be on disk, for sync()
+    bool stopping_ = false;
+    int error_ = 0;               // errno of the first failed write/sync
+
+    atomic<uint64_t> durable_lsn_{0};
+
+    thread worker_; // Started last, once everything above exists
+};